@@ -1,43 +1,502 @@
 #include <iostream>
-#include <fstream>
-#include <stdint.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_SIMD
+#endif
 
 using namespace std;
 
-static void encode(istream &is, ostream &os)
+static const char set2[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//-1 for anything outside the alphabet, '=' included
+struct DecodeTable
+{
+    int8_t t[256];
+
+    DecodeTable()
+    {
+        memset(t, -1, sizeof(t));
+
+        for (int i = 0; i < 64; ++i)
+            t[uint8_t(set2[i])] = i;
+    }
+};
+
+static const DecodeTable decodeTable;
+
+/*
+ * The kernels work on whole groups only: encoders take a multiple of 3
+ * bytes, decoders a multiple of 4 characters without padding. They return
+ * how much input they used, the caller finishes the rest with the scalar
+ * code. Vector loads read up to 4 bytes past the last group and vector
+ * stores write up to 8 bytes past the last output, so both buffers need
+ * that much slack.
+ */
+static size_t encodeScalar(const uint8_t *in, size_t n, char *out)
+{
+    size_t i = 0;
+
+    for (; i + 3 <= n; i += 3, out += 4)
+    {
+        uint32_t w = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+        out[0] = set2[w >> 18];
+        out[1] = set2[w >> 12 & 0x3f];
+        out[2] = set2[w >> 6 & 0x3f];
+        out[3] = set2[w & 0x3f];
+    }
+
+    return i;
+}
+
+//stops at the first quad with a character outside the alphabet
+static size_t decodeScalar(const char *in, size_t n, uint8_t *out)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4, out += 3)
+    {
+        int32_t a = decodeTable.t[uint8_t(in[i])], b = decodeTable.t[uint8_t(in[i + 1])];
+        int32_t c = decodeTable.t[uint8_t(in[i + 2])], d = decodeTable.t[uint8_t(in[i + 3])];
+
+        if ((a | b | c | d) < 0)
+            break;
+
+        uint32_t w = a << 18 | b << 12 | c << 6 | d;
+        out[0] = uint8_t(w >> 16);
+        out[1] = uint8_t(w >> 8);
+        out[2] = uint8_t(w);
+    }
+
+    return i;
+}
+
+#ifdef BASE64_SIMD
+/*
+ * Vector kernels after Muła and Lemire, "Faster Base64 Encoding and
+ * Decoding Using AVX2 Instructions". Each 32 bit lane holds 3 bytes on
+ * the way in and 4 sextets on the way out. Multiplies move the sextets
+ * into place and pshufb maps them to and from ASCII through a table
+ * indexed by range rather than by value.
+ */
+class Vec
+{
+public:
+    //12 bytes at the bottom of each 128 bit lane to 16 sextets
+    __attribute__((target("avx2"))) static __m256i split(__m256i in)
+    {
+        in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                                      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+        __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+                                        _mm256_set1_epi32(0x04000040));
+        __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+                                        _mm256_set1_epi32(0x01000010));
+        return _mm256_or_si256(t0, t1);
+    }
+
+    __attribute__((target("ssse3"))) static __m128i split(__m128i in)
+    {
+        in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+        __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(t0, t1);
+    }
+
+    //sextet to ASCII, the offset to add is picked by which range it is in
+    __attribute__((target("ssse3"))) static __m128i ascii(__m128i x)
+    {
+        const __m128i lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+        __m128i r = _mm_subs_epu8(x, _mm_set1_epi8(51));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), x), _mm_set1_epi8(13)));
+        return _mm_add_epi8(x, _mm_shuffle_epi8(lut, r));
+    }
+
+    __attribute__((target("avx2"))) static __m256i ascii(__m256i x)
+    {
+        const __m256i lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+        __m256i r = _mm256_subs_epu8(x, _mm256_set1_epi8(51));
+        r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), x), _mm256_set1_epi8(13)));
+        return _mm256_add_epi8(x, _mm256_shuffle_epi8(lut, r));
+    }
+
+    /*
+     * ASCII to sextet. The low nibble table has a bit for every high
+     * nibble that is invalid with it, the high nibble table has the bit
+     * for itself, so a character is bad when the two overlap. '/' is the
+     * only character that needs an offset different from the rest of its
+     * high nibble and gets moved to the unused slot 1.
+     */
+    __attribute__((target("ssse3"))) static bool sextets(__m128i &x)
+    {
+        const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+        const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i nib = _mm_set1_epi8(0x0f);
+
+        __m128i hi = _mm_and_si128(_mm_srli_epi32(x, 4), nib);
+        __m128i bad = _mm_and_si128(_mm_shuffle_epi8(lutLo, _mm_and_si128(x, nib)), _mm_shuffle_epi8(lutHi, hi));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xffff)
+            return false;
+
+        __m128i slash = _mm_cmpeq_epi8(x, _mm_set1_epi8('/'));
+        x = _mm_add_epi8(x, _mm_shuffle_epi8(lutRoll, _mm_add_epi8(slash, hi)));
+        return true;
+    }
+
+    __attribute__((target("avx2"))) static bool sextets(__m256i &x)
+    {
+        const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+        const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i nib = _mm256_set1_epi8(0x0f);
+
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi32(x, 4), nib);
+        __m256i bad = _mm256_and_si256(_mm256_shuffle_epi8(lutLo, _mm256_and_si256(x, nib)),
+                                       _mm256_shuffle_epi8(lutHi, hi));
+
+        if (!_mm256_testz_si256(bad, bad))
+            return false;
+
+        __m256i slash = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('/'));
+        x = _mm256_add_epi8(x, _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(slash, hi)));
+        return true;
+    }
+
+    //16 sextets to 12 bytes at the bottom of each 128 bit lane
+    __attribute__((target("ssse3"))) static __m128i join(__m128i x)
+    {
+        x = _mm_maddubs_epi16(x, _mm_set1_epi32(0x01400140));
+        x = _mm_madd_epi16(x, _mm_set1_epi32(0x00011000));
+        return _mm_shuffle_epi8(x, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    }
+
+    __attribute__((target("avx2"))) static __m256i join(__m256i x)
+    {
+        x = _mm256_maddubs_epi16(x, _mm256_set1_epi32(0x01400140));
+        x = _mm256_madd_epi16(x, _mm256_set1_epi32(0x00011000));
+        return _mm256_shuffle_epi8(x, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                       2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    }
+
+    __attribute__((target("ssse3"))) static size_t encodeSSSE3(const uint8_t *in, size_t n, char *out)
+    {
+        size_t i = 0;
+
+        for (; i + 16 <= n; i += 12, out += 16)
+            _mm_storeu_si128((__m128i *)out, ascii(split(_mm_loadu_si128((const __m128i *)(in + i)))));
+
+        return i + encodeScalar(in + i, n - i, out);
+    }
+
+    __attribute__((target("avx2"))) static size_t encodeAVX2(const uint8_t *in, size_t n, char *out)
+    {
+        size_t i = 0;
+
+        for (; i + 28 <= n; i += 24, out += 32)
+        {
+            __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + i))),
+                                                _mm_loadu_si128((const __m128i *)(in + i + 12)), 1);
+
+            _mm256_storeu_si256((__m256i *)out, ascii(split(x)));
+        }
+
+        return i + encodeSSSE3(in + i, n - i, out);
+    }
+
+    __attribute__((target("ssse3"))) static size_t decodeSSSE3(const char *in, size_t n, uint8_t *out)
+    {
+        size_t i = 0;
+
+        for (; i + 16 <= n; i += 16, out += 12)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+
+            if (!sextets(x))
+                break;
+
+            _mm_storeu_si128((__m128i *)out, join(x));
+        }
+
+        return i + decodeScalar(in + i, n - i, out);
+    }
+
+    __attribute__((target("avx2"))) static size_t decodeAVX2(const char *in, size_t n, uint8_t *out)
+    {
+        size_t i = 0;
+
+        for (; i + 32 <= n; i += 32, out += 24)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+
+            if (!sextets(x))
+                break;
+
+            x = _mm256_permutevar8x32_epi32(join(x), _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+            _mm256_storeu_si256((__m256i *)out, x);
+        }
+
+        return i + decodeSSSE3(in + i, n - i, out);
+    }
+};
+#endif
+
+typedef size_t (*Encoder)(const uint8_t *in, size_t n, char *out);
+typedef size_t (*Decoder)(const char *in, size_t n, uint8_t *out);
+
+static Encoder pickEncoder()
+{
+#ifdef BASE64_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return Vec::encodeAVX2;
+
+    if (__builtin_cpu_supports("ssse3"))
+        return Vec::encodeSSSE3;
+#endif
+    return encodeScalar;
+}
+
+static Decoder pickDecoder()
+{
+#ifdef BASE64_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return Vec::decodeAVX2;
+
+    if (__builtin_cpu_supports("ssse3"))
+        return Vec::decodeSSSE3;
+#endif
+    return decodeScalar;
+}
+
+//read until the buffer is full or the input ends
+static size_t readFull(int fd, void *buf, size_t n)
 {
-    char set2[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t got = 0;
 
-    for (int i = 1; is; i++)
+    while (got < n)
     {
-        uint8_t buf[3] = {0};
-        is.read((char *)buf, sizeof(buf));
+        ssize_t r = read(fd, (char *)buf + got, n - got);
 
-        if (is.gcount() <= 0)
+        if (r <= 0)
             break;
 
-        uint8_t s2 = (buf[1] >> 4 | buf[0] << 4) & 0x3f;
-        uint8_t s3 = ((buf[1] << 2)  | (buf[2] >> 6)) & 0x3f;
-        uint8_t remainder = is.gcount() % 3;
-        os.put(set2[(buf[0] >> 2) & 0x3f]);
-        os.put(set2[s2]);
-        os.put(remainder == 1 ? '=' : set2[s3]);
-        os.put(remainder != 0 ? '=' : set2[buf[2] & 0x3f]);
+        got += r;
+    }
 
-        if (i % 19 == 0)
-            os << "\n";
+    return got;
+}
+
+static void writeFull(int fd, const void *buf, size_t n)
+{
+    for (size_t done = 0; done < n;)
+    {
+        ssize_t r = write(fd, (const char *)buf + done, n - done);
+
+        if (r <= 0)
+        {
+            cerr << "base64: write error\n";
+            exit(1);
+        }
+
+        done += r;
     }
+}
+
+/*
+ * Encodes a block into one run of characters, then cuts the run into lines
+ * with a memcpy per line. The input block is a multiple of 3 so only the
+ * last block has padding, the column carries over from block to block.
+ */
+static void encode(int ifd, int ofd, size_t cols)
+{
+    static constexpr size_t BLOCK = 3 << 18, SLACK = 32;
+    static const Encoder encoder = pickEncoder();
+    vector<uint8_t> in(BLOCK + SLACK);
+    vector<char> enc(BLOCK / 3 * 4 + SLACK);
+    vector<char> out(BLOCK / 3 * 4 + (cols ? BLOCK / 3 * 4 / cols + 2 : 1));
+    size_t col = 0, n;
+
+    while ((n = readFull(ifd, in.data(), BLOCK)) > 0)
+    {
+        size_t used = encoder(in.data(), n, enc.data());
+        char *e = enc.data() + used / 3 * 4;
 
-    os << "\n";
+        if (n - used == 1)
+        {
+            uint32_t w = in[used] << 16;
+            *e++ = set2[w >> 18], *e++ = set2[w >> 12 & 0x3f], *e++ = '=', *e++ = '=';
+        }
+        else if (n - used == 2)
+        {
+            uint32_t w = in[used] << 16 | in[used + 1] << 8;
+            *e++ = set2[w >> 18], *e++ = set2[w >> 12 & 0x3f], *e++ = set2[w >> 6 & 0x3f], *e++ = '=';
+        }
+
+        const size_t len = e - enc.data();
+
+        if (cols == 0)
+        {
+            writeFull(ofd, enc.data(), len);
+            col += len;
+            continue;
+        }
+
+        char *o = out.data();
+
+        for (size_t i = 0; i < len;)
+        {
+            size_t take = min(cols - col, len - i);
+            memcpy(o, enc.data() + i, take);
+            o += take, i += take, col += take;
+
+            if (col == cols)
+                *o++ = '\n', col = 0;
+        }
+
+        writeFull(ofd, out.data(), o - out.data());
+    }
+
+    if (cols && col > 0)
+        writeFull(ofd, "\n", 1);
+}
+
+//takes out line ends, moving the text between them down with memmove
+static size_t strip(char *p, size_t n)
+{
+    char *end = p + n, *o = p;
+
+    for (char *q = p; q < end;)
+    {
+        char *nl = (char *)memchr(q, '\n', end - q);
+        char *stop = nl ? nl : end;
+
+        if (stop > q && stop[-1] == '\r')
+            --stop;
+
+        if (o != q)
+            memmove(o, q, stop - q);
+
+        o += stop - q;
+        q = nl ? nl + 1 : end;
+    }
+
+    return o - p;
+}
+
+/*
+ * Decodes all whole quads in the buffer and keeps up to 3 characters for
+ * the next read. The kernels stop at the first quad with padding or any
+ * other character outside the alphabet, which can only be the last one.
+ */
+static bool decode(int ifd, int ofd)
+{
+    static constexpr size_t BLOCK = 1 << 20, SLACK = 32;
+    static const Decoder decoder = pickDecoder();
+    vector<char> in(BLOCK + 4 + SLACK);
+    vector<uint8_t> out((BLOCK + 4) / 4 * 3 + SLACK);
+    size_t carry = 0;
+    bool done = false;
+
+    for (size_t n; (n = readFull(ifd, in.data() + carry, BLOCK)) > 0;)
+    {
+        n = strip(in.data() + carry, n) + carry;
+
+        if (n > 0 && done)
+            return false;
+
+        size_t used = decoder(in.data(), n & ~size_t(3), out.data());
+        uint8_t *o = out.data() + used / 4 * 3;
+
+        if (used + 4 <= n)
+        {
+            //a padded quad, "xx==" or "xxx=", and nothing may come after it
+            const char *q = in.data() + used;
+            const int8_t *t = decodeTable.t;
+            int32_t a = t[uint8_t(q[0])], b = t[uint8_t(q[1])], c = t[uint8_t(q[2])];
+
+            if (used + 4 < n || (a | b) < 0 || q[3] != '=' || (c < 0 && q[2] != '='))
+                return false;
+
+            *o++ = uint8_t(a << 2 | b >> 4);
+
+            if (q[2] != '=')
+                *o++ = uint8_t(b << 4 | c >> 2);
+
+            used = n, done = true;
+        }
+
+        writeFull(ofd, out.data(), o - out.data());
+        carry = n - used;
+        memmove(in.data(), in.data() + used, carry);
+    }
+
+    return carry == 0;
 }
 
 int main(int argc, char **argv)
 {
-    ifstream ifs(argv[1]);
-    encode(ifs, cout);
-    ifs.close();
+    bool decoding = false;
+    size_t cols = 76;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i)
+    {
+        if (strcmp(argv[i], "-d") == 0)
+            decoding = true;
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            cols = strtoul(argv[++i], nullptr, 10);
+        else
+        {
+            cerr << "usage: base64 [-d] [-w cols] [file]\n";
+            return 1;
+        }
+    }
+
+    int fd = i < argc ? open(argv[i], O_RDONLY) : 0;
+
+    if (fd < 0)
+    {
+        cerr << "base64: cannot open " << argv[i] << "\n";
+        return 1;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (!decoding)
+        encode(fd, 1, cols);
+    else if (!decode(fd, 1))
+    {
+        cerr << "base64: invalid input\n";
+        return 1;
+    }
+
+    if (fd != 0)
+        close(fd);
+
     return 0;
 }
 
 
-
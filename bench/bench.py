@@ -0,0 +1,390 @@
+#!/usr/bin/env python3
+"""Throughput of every codec in the repo on generated corpora.
+
+Builds the tools into a work directory, generates four deterministic
+corpora (text, binary records, highly repetitive, random), prepares the
+compressed inputs with the reference tools and times each compressor
+and decompressor. Every output is checked against the corpus before it
+is timed. Results go to JSON; with a baseline the run fails when a tool
+got slower by more than the tolerance.
+
+    ./bench.py                          run everything, print a table
+    ./bench.py -o baseline.json         save the results
+    ./bench.py -b baseline.json         compare against saved results
+    ./bench.py -t gzcat -c text -s 64M  a subset, bigger corpora
+
+Cycles per byte are CPU time times the clock in /proc/cpuinfo (or
+--mhz), an estimate that ignores turbo and frequency scaling.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import platform
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# name: (directory, source, compiler flags), the same flags as the Makefiles
+BUILD = {
+    'compress1': ('compress', 'compress1.cpp', '-O -std=c++20 -pthread'),
+    'compress2': ('compress', 'compress2.cpp', '-O -std=c++20'),
+    'compress3': ('compress', 'compress3.cpp', '-O -std=c++20'),
+    'zcatpp': ('compress', 'zcatpp.cpp', '-O -std=c++20'),
+    'gzcat': ('gzcat', 'gzcat.cpp', '-O2 -pthread -I../crc32'),
+    'gzip': ('gzcat', 'gzip.cpp', '-O2 -pthread -I../crc32'),
+    'bzcat': ('bzcat', 'bzcat.cpp', '-O2 -pthread -std=c++20 -I../crc32 -I../wincore'),
+    'pack': ('pack', 'pack.cpp', '-O'),
+    'pcat': ('pack', 'pcat.cpp', '-O'),
+    'wbzcat': ('wincore', 'bzcat.cpp', '-O -std=c++20 -I../crc32'),
+    'wcompress': ('wincore', 'compress.cpp', '-O -std=c++20 -I../crc32'),
+    'wgzcat': ('wincore', 'gzcat.cpp', '-O -std=c++20 -I../crc32'),
+    'wpack': ('wincore', 'pack.cpp', '-O -std=c++20 -I../crc32'),
+    'wpcat': ('wincore', 'pcat.cpp', '-O -std=c++23 -I../crc32'),
+    'wzcat': ('wincore', 'zcat.cpp', '-O -std=c++20 -I../crc32'),
+    'rusage': ('bench', 'rusage.cpp', '-O2'),
+}
+
+# how the compressed inputs are made and checked, system tools first
+FORMATS = {
+    'Z': {'make': [['compress', '-c', '{in}'], ['{bin}/compress1', '<']],
+          'check': [['uncompress', '-c', '{in}'], ['{bin}/zcatpp', '{in}']]},
+    'gz': {'make': [['gzip', '-6', '-n', '-c', '{in}'], ['{bin}/gzip', '{in}']],
+           'check': [['gzip', '-d', '-c', '{in}'], ['{bin}/gzcat', '{in}']]},
+    'bz2': {'make': [['bzip2', '-9', '-c', '{in}']],
+            'check': [['bzip2', '-d', '-c', '{in}'], ['{bin}/bzcat', '{in}']]},
+    'z': {'make': [['{bin}/pack', '{in}']],
+          'check': [['{bin}/pcat', '{in}']]},
+}
+
+# name, tool, direction, format, arguments; '<' feeds the file on stdin,
+# compress1 only reads stdin unless it runs with -p
+CODECS = [
+    ('compress1', 'compress1', 'c', 'Z', ['<']),
+    ('compress1 -o', 'compress1', 'c', 'Z', ['-o', '<']),
+    ('compress1 -p', 'compress1', 'c', 'Z', ['-p', '{in}']),
+    ('compress2', 'compress2', 'c', 'Z', ['{in}']),
+    ('compress3', 'compress3', 'c', 'Z', ['{in}']),
+    ('wincore compress', 'wcompress', 'c', 'Z', ['{in}']),
+    ('gzip', 'gzip', 'c', 'gz', ['{in}']),
+    ('gzip -p', 'gzip', 'c', 'gz', ['-p', '{in}']),
+    ('pack', 'pack', 'c', 'z', ['{in}']),
+    ('wincore pack', 'wpack', 'c', 'z', ['{in}']),
+    ('zcatpp', 'zcatpp', 'd', 'Z', ['{in}']),
+    ('wincore zcat', 'wzcat', 'd', 'Z', ['{in}']),
+    ('wincore zcat -f', 'wzcat', 'd', 'Z', ['-f', '{in}']),
+    ('gzcat', 'gzcat', 'd', 'gz', ['<']),
+    ('gzcat -p', 'gzcat', 'd', 'gz', ['-p', '{in}']),
+    ('wincore gzcat', 'wgzcat', 'd', 'gz', ['{in}']),
+    ('bzcat', 'bzcat', 'd', 'bz2', ['{in}']),
+    ('bzcat -p', 'bzcat', 'd', 'bz2', ['-p', '{in}']),
+    ('wincore bzcat', 'wbzcat', 'd', 'bz2', ['{in}']),
+    ('pcat', 'pcat', 'd', 'z', ['{in}']),
+    ('wincore pcat', 'wpcat', 'd', 'z', ['{in}']),
+]
+
+CORPORA = ['text', 'binary', 'repetitive', 'random']
+
+
+def parse_size(s):
+    units = {'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30}
+    return int(s[:-1]) * units[s[-1].upper()] if s[-1].upper() in units else int(s)
+
+
+def gen_text(rng, size):
+    """Words from a fixed vocabulary with a Zipf-like frequency, in lines."""
+    letters = 'etaoinshrdlcumwfgypbvkjxqz'
+    weights = [12, 9, 8, 8, 7, 7, 6, 6, 6, 4, 4, 3, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1]
+    vocab = [''.join(rng.choices(letters, weights, k=rng.randint(1, 10))) for _ in range(4000)]
+    zipf = [1.0 / (i + 1) for i in range(len(vocab))]
+    out, length = [], 0
+
+    while length < size:
+        words = rng.choices(vocab, zipf, k=12)
+        line = ' '.join(words).capitalize() + '.\n'
+        out.append(line)
+        length += len(line)
+
+    return ''.join(out).encode()[:size]
+
+
+def gen_binary(rng, size):
+    """Fixed layout records as in tables and executables: counters, small deltas, floats, flags."""
+    out, counter, value = [], 0, 1000
+
+    for _ in range(size // 16 + 1):
+        counter += 1
+        value += rng.randint(-8, 8)
+        out.append(struct.pack('<IifHBB', counter, value, value / 7.0, rng.randrange(16), 0, rng.randrange(4)))
+
+    return b''.join(out)[:size]
+
+
+def gen_repetitive(rng, size):
+    """A 4 KiB block over and over with a mutated byte every kilobyte or so."""
+    block = gen_text(rng, 4096)
+    data = bytearray(block * (size // len(block) + 1))[:size]
+
+    for pos in range(0, size, 1024):
+        data[pos + rng.randrange(min(1024, size - pos))] = rng.randrange(256)
+
+    return bytes(data)
+
+
+def gen_random(rng, size):
+    return rng.randbytes(size)
+
+
+def corpus(work, name, size):
+    path = os.path.join(work, '%s.%d' % (name, size))
+
+    if not os.path.exists(path):
+        gen = globals()['gen_' + name]
+        data = gen(random.Random('%s/%d' % (name, size)), size)
+
+        with open(path + '.tmp', 'wb') as f:
+            f.write(data)
+
+        os.rename(path + '.tmp', path)
+
+    return path
+
+
+def build(work, names):
+    bindir = os.path.join(work, 'bin')
+    os.makedirs(bindir, exist_ok=True)
+
+    for name in names:
+        directory, source, flags = BUILD[name]
+        src = os.path.join(ROOT, directory)
+        target = os.path.join(bindir, name)
+        dirs = [src] + [os.path.join(src, f[2:]) for f in flags.split() if f.startswith('-I')]
+        newest = max(os.path.getmtime(os.path.join(d, f)) for d in dirs for f in os.listdir(d))
+
+        if os.path.exists(target) and os.path.getmtime(target) >= newest:
+            continue
+
+        cmd = ['g++'] + flags.split() + ['-o', target, os.path.join(src, source)]
+        print('building', name, file=sys.stderr)
+
+        if subprocess.run(cmd, cwd=src).returncode != 0:
+            sys.exit('bench: cannot build %s' % name)
+
+    return bindir
+
+
+def expand(args, bindir, path):
+    """The command line and the file for stdin, if any."""
+    cmd = [a.replace('{bin}', bindir).replace('{in}', path) for a in args if a != '<']
+    return cmd, path if '<' in args else None
+
+
+def stdin_of(path):
+    return open(path, 'rb') if path else subprocess.DEVNULL
+
+
+def available(cmd):
+    return os.path.exists(cmd[0]) if os.sep in cmd[0] else shutil.which(cmd[0]) is not None
+
+
+def digest_of(cmd, stdin_path=None):
+    """sha256 of what a command writes, None when it fails."""
+    h = hashlib.sha256()
+
+    with subprocess.Popen(cmd, stdin=stdin_of(stdin_path), stdout=subprocess.PIPE,
+                          stderr=subprocess.DEVNULL) as p:
+        for chunk in iter(lambda: p.stdout.read(1 << 20), b''):
+            h.update(chunk)
+
+    return h.hexdigest() if p.returncode == 0 else None
+
+
+def prepare(work, bindir, fmt, path):
+    """Compressed copy of a corpus made with the first available reference tool."""
+    out = '%s.%s' % (path, fmt)
+
+    if os.path.exists(out):
+        return out
+
+    for args in FORMATS[fmt]['make']:
+        cmd, stdin_path = expand(args, bindir, path)
+
+        if available(cmd):
+            with open(out + '.tmp', 'wb') as f:
+                p = subprocess.run(cmd, stdin=stdin_of(stdin_path), stdout=f, stderr=subprocess.DEVNULL)
+
+                if p.returncode == 0:
+                    os.rename(out + '.tmp', out)
+                    return out
+
+    return None
+
+
+def check(bindir, fmt, path):
+    for args in FORMATS[fmt]['check']:
+        cmd, stdin_path = expand(args, bindir, path)
+
+        if available(cmd):
+            return digest_of(cmd, stdin_path)
+
+    return None
+
+
+def timed(bindir, work, cmd, stdin_path):
+    """Exit code, wall time, CPU time and peak RSS in KiB of one run with output to /dev/null."""
+    report = os.path.join(work, 'rusage.out')
+    subprocess.run([os.path.join(bindir, 'rusage'), report] + cmd, stdin=stdin_of(stdin_path),
+                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    with open(report) as f:
+        rc, wall, cpu, rss = f.read().split()
+
+    os.remove(report)
+    return int(rc), float(wall), float(cpu), int(rss)
+
+
+def run_codec(codec, bindir, work, path, size, want, repeat, mhz):
+    name, tool, direction, fmt, args = codec
+    src = path if direction == 'c' else prepare(work, bindir, fmt, path)
+
+    if src is None:
+        return {'status': 'no input'}
+
+    cmd, stdin_path = expand(['{bin}/' + tool] + args, bindir, src)
+
+    #the output must be right before it counts
+    if direction == 'd':
+        ok = digest_of(cmd, stdin_path) == want
+    else:
+        out = os.path.join(work, 'out.' + fmt)
+
+        with open(out, 'wb') as f:
+            p = subprocess.run(cmd, stdin=stdin_of(stdin_path), stdout=f, stderr=subprocess.DEVNULL)
+
+        ok = p.returncode == 0 and check(bindir, fmt, out) == want
+        os.remove(out)
+
+    if not ok:
+        return {'status': 'wrong output'}
+
+    best = None
+
+    for _ in range(repeat):
+        rc, wall, cpu, rss = timed(bindir, work, cmd, stdin_path)
+
+        if rc != 0:
+            return {'status': 'exit %d' % rc}
+
+        if best is None or wall < best[0]:
+            best = (wall, cpu, rss)
+
+    wall, cpu, rss = best
+    return {'status': 'ok', 'mb_s': round(size / wall / 1e6, 2), 'wall': round(wall, 4),
+            'cpu': round(cpu, 4), 'rss_kb': rss, 'cycles_per_byte': round(cpu * mhz * 1e6 / size, 2)}
+
+
+def cpu_mhz():
+    try:
+        with open('/proc/cpuinfo') as f:
+            for line in f:
+                if line.startswith('cpu MHz'):
+                    return float(line.split(':')[1])
+    except OSError:
+        pass
+
+    return 0.0
+
+
+def compare(results, baseline, tolerance):
+    """Print changes against the baseline, return the number of regressions."""
+    old = {(r['codec'], r['corpus']): r for r in baseline['results']}
+    regressions = 0
+
+    if baseline.get('size') != results['size']:
+        print('bench: baseline corpora are %s bytes, these are %s' % (baseline.get('size'), results['size']))
+
+    for r in results['results']:
+        b = old.get((r['codec'], r['corpus']))
+
+        if b is None or b['status'] != 'ok':
+            continue
+
+        if r['status'] != 'ok':
+            print('REGRESSION %-18s %-10s %s' % (r['codec'], r['corpus'], r['status']))
+            regressions += 1
+            continue
+
+        ratio = r['mb_s'] / b['mb_s']
+        slower = ratio < 1 - tolerance
+        regressions += slower
+        print('%-10s %-18s %-10s %9.2f -> %9.2f MB/s %+6.1f%%' % ('REGRESSION' if slower else '',
+              r['codec'], r['corpus'], b['mb_s'], r['mb_s'], (ratio - 1) * 100))
+
+    return regressions
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    ap.add_argument('-s', '--size', default='16M', help='bytes per corpus, K/M/G suffixes (16M)')
+    ap.add_argument('-c', '--corpus', action='append', choices=CORPORA, help='corpora to use (all)')
+    ap.add_argument('-t', '--tool', action='append', help='codecs whose name starts with this (all)')
+    ap.add_argument('-r', '--repeat', type=int, default=3, help='timed runs, the fastest counts (3)')
+    ap.add_argument('-w', '--work', default='/tmp/bench-work', help='corpora and binaries (/tmp/bench-work)')
+    ap.add_argument('-o', '--output', help='write the results as JSON')
+    ap.add_argument('-b', '--baseline', help='JSON from an earlier run to compare against')
+    ap.add_argument('--tolerance', type=float, default=0.10, help='allowed slowdown (0.10)')
+    ap.add_argument('--mhz', type=float, default=cpu_mhz(), help='clock for cycles per byte')
+    opts = ap.parse_args()
+
+    size = parse_size(opts.size)
+    codecs = [c for c in CODECS if not opts.tool or any(c[0].startswith(t) for t in opts.tool)]
+    os.makedirs(opts.work, exist_ok=True)
+
+    #the reference tools for the formats are needed even when only decoders run
+    needed = {c[1] for c in codecs} | {'compress1', 'zcatpp', 'gzip', 'gzcat', 'bzcat', 'pack', 'pcat', 'rusage'}
+    bindir = build(opts.work, sorted(needed))
+
+    results = {'host': platform.node(), 'machine': platform.machine(), 'mhz': opts.mhz,
+               'size': size, 'date': time.strftime('%Y-%m-%d %H:%M:%S'), 'corpora': {}, 'results': []}
+
+    print('%-18s %-10s %9s %9s %8s %7s' % ('codec', 'corpus', 'MB/s', 'cyc/B', 'RSS KiB', 'status'))
+
+    for name in opts.corpus or CORPORA:
+        path = corpus(opts.work, name, size)
+
+        with open(path, 'rb') as f:
+            want = hashlib.sha256(f.read()).hexdigest()
+
+        results['corpora'][name] = want
+
+        for codec in codecs:
+            r = run_codec(codec, bindir, opts.work, path, size, want, opts.repeat, opts.mhz)
+            r.update(codec=codec[0], corpus=name)
+            results['results'].append(r)
+
+            if r['status'] == 'ok':
+                print('%-18s %-10s %9.2f %9.2f %8d %7s' % (codec[0], name, r['mb_s'],
+                      r['cycles_per_byte'], r['rss_kb'], 'ok'))
+            else:
+                print('%-18s %-10s %9s %9s %8s %s' % (codec[0], name, '-', '-', '-', r['status']))
+
+    if opts.output:
+        with open(opts.output, 'w') as f:
+            json.dump(results, f, indent=1)
+
+    if opts.baseline:
+        with open(opts.baseline) as f:
+            baseline = json.load(f)
+
+        if compare(results, baseline, opts.tolerance):
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
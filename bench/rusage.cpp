@@ -0,0 +1,49 @@
+//rusage out cmd [args], runs cmd and writes its exit code, wall and CPU
+//seconds and peak RSS in KiB to out. Python cannot measure the peak RSS
+//itself: a child inherits the high water mark of whoever forked it, and
+//this process is a lot smaller than the interpreter.
+
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: rusage out cmd [args]\n");
+        return 2;
+    }
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        execvp(argv[2], argv + 2);
+        _exit(127);
+    }
+
+    int status;
+    rusage ru;
+
+    if (pid < 0 || wait4(pid, &status, 0, &ru) < 0)
+        return 2;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    FILE *fp = fopen(argv[1], "w");
+
+    if (fp == nullptr)
+        return 2;
+
+    fprintf(fp, "%d %.6f %.6f %ld\n", WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status),
+            end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9,
+            ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6,
+            ru.ru_maxrss);
+
+    fclose(fp);
+    return 0;
+}
@@ -3,84 +3,38 @@
 
 #define FAST
 
+#include "crc32.h"
 #include <cstdint>
 #include <cassert>
-#ifdef FAST
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef FAST
+#include "mystd.h"
 #else
 #include <iostream>
 #include <fstream>
 #endif
 
 #ifdef FAST
-class istream
-{
-private:
-    uint32_t _cap;
-    uint32_t _head = 0, _tail = 0;
-    uint8_t *_buf;
-protected:
-    int _fd;
-public:
-    ~istream() { delete[] _buf; }
-
-    istream(int fd = -1, uint32_t capacity = 8192)
-      : _cap(capacity), _buf(new uint8_t[capacity]), _fd(fd) { }
-
-    int get()
-    {
-        if (_tail == _head)
-        {
-            ssize_t n = ::read(_fd, _buf, _cap);
-            if (n < 1) return -1;
-            _head = n;
-            _tail = 0;
-        }
-        return _buf[_tail++];
-    }
-};
-
-class ifstream : public istream
-{
-public:
-    void close() { ::close(_fd); }
-    void open(const char *fn) { _fd = ::open(fn, O_RDONLY); }
-};
-
-class ostream
-{
-public:
-    virtual void put(char) { }
-    virtual void flush() { }
-    virtual ostream& operator<<(const char *) { return *this; }
-};
-
-class outstream : public ostream
-{
-    int _fd;
-    uint32_t _cap;
-    uint32_t _pos = 0;
-    char *_buf;
-public:
-    ~outstream() { delete[] _buf; }
-    void put(char c) override { if (_pos > _cap) flush(); _buf[_pos++] = c; }
-    ostream& operator<<(const char *s) override { while (*s) put(*s++); return *this; }
-    void flush() { ::write(_fd, _buf, _pos), _pos = 0; }
-
-    outstream(int fd, uint32_t capacity = 8192)
-      : _fd(fd), _cap(capacity), _buf(new char[capacity]) { }
-};
-
-class NullStream : public ostream
+class NullStream : public mystd::ostream
 {
 public:
     ostream& operator<<(const char *) override { return *this; }
 };
 
-static istream cin(0, 8192);
-static outstream cout(1, 8192);
-static outstream cerr(2, 8192);
+using mystd::istream;
+using mystd::ostream;
+using mystd::ifstream;
+using mystd::cin;
+using mystd::cout;
+using mystd::cerr;
 static NullStream nullstream;
 #else
 class nullbuf : public std::streambuf
@@ -114,18 +68,73 @@ public:
 
 class BitInputStream
 {
-    istream &_is;
-    unsigned _window = 0, _bitCount = 0;
+    istream *_is = nullptr;
+    const uint8_t *_begin = nullptr, *_ptr = nullptr, *_end = nullptr;
+    uint64_t _window = 0;
+    unsigned _bitCount = 0;
+
+    //past the end of a memory buffer we feed zeros, the caller validates
+    uint8_t _get() { return _is ? _is->get() : _ptr < _end ? *_ptr++ : 0; }
+
+    //top up the window to at least 57 bits
+    void _fill()
+    {
+        const uint8_t *p = _ptr;
+        size_t avail = _is ? 0 : _end - _ptr;
+#ifdef FAST
+        if (_is)
+        {
+            std::span<const uint8_t> buf = _is->peek();
+            p = buf.data(), avail = buf.size();
+        }
+#endif
+        if (avail >= 8)
+        {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            unsigned bytes = 63 - _bitCount >> 3;
+            _window = _window << bytes * 8 | __builtin_bswap64(word) >> 64 - bytes * 8;
+#ifdef FAST
+            if (_is)
+                _is->skip(bytes);
+            else
+#endif
+                _ptr += bytes;
+
+            _bitCount += bytes * 8;
+            return;
+        }
+
+        while (_bitCount <= 56)
+            _window = _window << 8 | _get(), _bitCount += 8;
+    }
 public:
-    BitInputStream(istream &is) : _is(is) { }
+    BitInputStream(istream &is) : _is(&is) { }
+
+    //read from a memory buffer, starting at an arbitrary bit offset
+    BitInputStream(const uint8_t *buf, size_t len, uint64_t bitPos)
+      : _begin(buf), _ptr(buf + Toolbox::min<uint64_t>(bitPos >> 3, len)), _end(buf + len)
+    { readBits24(bitPos & 7); }
+
+    //bit offset of the next bit to be read, memory buffers only
+    uint64_t tell() const { return uint64_t(_ptr - _begin) * 8 - _bitCount; }
+
+    //look at the next n bits without consuming them
+    unsigned peekBits(unsigned n)
+    {
+        if (_bitCount < n)
+            _fill();
+        return _window >> _bitCount - n & (1 << n) - 1;
+    }
+
+    void skipBits(unsigned n) { _bitCount -= n; }
 
     unsigned readBits24(unsigned n)
     {
         assert(n <= 24);
-        while (_bitCount < n)
-            _window = _window << 8 | _is.get(), _bitCount += 8;
+        unsigned ret = peekBits(n);
         _bitCount -= n;
-        return _window >> _bitCount & (1 << n) - 1;
+        return ret;
     }
 
     unsigned readBits32(unsigned n)
@@ -152,26 +161,6 @@ public:
     { uint8_t val = _buf[i]; for (; i; --i) _buf[i] = _buf[i - 1]; return _buf[0] = val; }
 };
 
-class CRC32
-{
-    uint32_t _table[256];
-    uint32_t _crc = 0xffffffff;
-public:
-    void update(uint8_t c) { _crc = _crc << 8 ^ _table[(_crc >> 24 ^ c) & 0xff]; }
-    uint32_t crc() const { return ~_crc; }
-
-    CRC32()
-    {
-        //https://github.com/gcc-mirror/gcc/blob/master/libiberty/crc32.c
-        for (uint32_t i = 0, j, c; i < 256; ++i)
-        {
-            for (c = i << 24, j = 8; j > 0; --j)
-                c = c & 0x80000000 ? c << 1 ^ 0x04c11db7 : c << 1;
-            _table[i] = c;
-        }
-    }
-};
-
 class Table
 {
     uint8_t _codeLengths[258];
@@ -181,8 +170,13 @@ class Table
     unsigned _symbols[258] = {0};
     uint8_t _minLen = 23;
     uint8_t _maxLen = 0;
+    uint16_t _lookup[1 << 10] = {0};
 public:
-    void read(BitInputStream &bis, unsigned symbolCount);
+    //codes up to LOOKUP_BITS long resolve with a single table probe,
+    //entries hold symbol << 5 | code length, zero means a longer code
+    static constexpr unsigned LOOKUP_BITS = 10;
+    bool read(BitInputStream &bis, unsigned symbolCount);
+    uint16_t lookup(unsigned bits) const { return _lookup[bits]; }
     uint8_t minLength() const { return _minLen; }
     uint32_t limit(uint8_t i) const { return _limits[i]; }
     uint32_t symbol(uint16_t i) const { return _symbols[i]; }
@@ -190,15 +184,31 @@ public:
 };
 
 //read the canonical Huffman code lengths for table
-void Table::read(BitInputStream &bis, unsigned symbolCount)
+bool Table::read(BitInputStream &bis, unsigned symbolCount)
 {
     for (unsigned i = 0, c = bis.readBits24(5); i <= symbolCount + 1; ++i)
     {
-        while (bis.readBits24(1))
+        //checked before every step, the initial five bits alone reach
+        //0 and 21 to 31
+        while (c >= 1 && c <= 20 && bis.readBits24(1))
             c += bis.readBits24(1) ? -1 : 1;
+
+        if (c < 1 || c > 20)
+            return false;
+
         _codeLengths[_pos++] = c;
     }
 
+    //an over-subscribed code would run the canonical codes, and with
+    //them the _lookup fill below, past the end
+    uint32_t kraft = 0;
+
+    for (unsigned i = 0; i < symbolCount + 2; ++i)
+        kraft += 1 << 20 - _codeLengths[i];
+
+    if (kraft > 1 << 20)
+        return false;
+
     for (unsigned i = 0; i < symbolCount + 2; ++i)
         _bases[_codeLengths[i] + 1]++;
 
@@ -211,59 +221,89 @@ void Table::read(BitInputStream &bis, unsigned symbolCount)
         _maxLen = Toolbox::max(_codeLengths[i], _maxLen);
     }
 
+    for (unsigned i = 0, minLen = _minLen; minLen <= _maxLen; ++minLen)
+        for (unsigned symbol = 0; symbol < symbolCount + 2; ++symbol)
+            if (_codeLengths[symbol] == minLen)
+                _symbols[i++] = symbol;
+
     for (unsigned i = _minLen, code = 0; i <= _maxLen; ++i)
     {
         unsigned base = code;
         code += _bases[i + 1] - _bases[i];
+
+        //every code of this length owns a run of 2^(LOOKUP_BITS - i) entries
+        if (i <= LOOKUP_BITS)
+            for (unsigned c = base, j = _bases[i]; c < code; ++c, ++j)
+                for (unsigned k = c << LOOKUP_BITS - i; k < c + 1 << LOOKUP_BITS - i; ++k)
+                    _lookup[k] = _symbols[j] << 5 | i;
+
         _bases[i] = base - _bases[i];
         _limits[i] = code - 1;
         code <<= 1;
     }
 
-    for (unsigned i = 0, minLen = _minLen; minLen <= _maxLen; ++minLen)
-        for (unsigned symbol = 0; symbol < symbolCount + 2; ++symbol)
-            if (_codeLengths[symbol] == minLen)
-                _symbols[i++] = symbol;
+    return true;
 }
 
 class Tables
 {
     Table _tables[6];
-    uint8_t *_selectors;
-    uint32_t grpIdx, grpPos, curTbl;
+    uint8_t *_selectors = nullptr;
+    uint32_t _nSelectors = 0, grpIdx, grpPos, curTbl;
 public:
+    static constexpr uint32_t INVALID = 0xffffffff;
     ~Tables() { delete[] _selectors; }
-    void read(BitInputStream &bis, uint32_t symbolCount);
+    bool read(BitInputStream &bis, uint32_t symbolCount);
     uint32_t nextSymbol(BitInputStream &bis);
 };
 
-void Tables::read(BitInputStream &bis, uint32_t symbolCount)
+bool Tables::read(BitInputStream &bis, uint32_t symbolCount)
 {
     uint8_t nTables = bis.readBits24(3);
-    uint16_t nSelectors = bis.readBits24(15);
-    _selectors = new uint8_t[nSelectors];
+    _nSelectors = bis.readBits24(15);
+
+    if (nTables < 2 || nTables > 6 || _nSelectors == 0)
+        return false;
+
+    _selectors = new uint8_t[_nSelectors];
     MoveToFront tableMTF;
     
-    for (uint32_t i = 0; i < nSelectors; ++i)
+    for (uint32_t i = 0; i < _nSelectors; ++i)
     {
         uint8_t u = 0;
 
         while (bis.readBits24(1))
-            ++u;
+            if (++u >= nTables)
+                return false;
 
         _selectors[i] = tableMTF.indexToFront(u);
     }
 
     for (uint32_t t = 0; t < nTables; ++t)
-        _tables[t].read(bis, symbolCount);
+        if (!_tables[t].read(bis, symbolCount))
+            return false;
 
     curTbl = _selectors[0], grpIdx = 0, grpPos = 0;
+    return true;
 }
 
 uint32_t Tables::nextSymbol(BitInputStream &bis)
 {
     if (grpPos++ % 50 == 0)
+    {
+        if (grpIdx == _nSelectors)
+            return INVALID;
+
         curTbl = _selectors[grpIdx++];
+    }
+
+    uint16_t entry = _tables[curTbl].lookup(bis.peekBits(Table::LOOKUP_BITS));
+
+    if (entry != 0)
+    {
+        bis.skipBits(entry & 0x1f);
+        return entry >> 5;
+    }
 
     unsigned i = _tables[curTbl].minLength();
     unsigned codeBits = bis.readBits24(i);
@@ -276,30 +316,95 @@ uint32_t Tables::nextSymbol(BitInputStream &bis)
         codeBits = codeBits << 1 | bis.readBits24(1);
     }
 
-    return 0;
+    return INVALID;
 }
 
 class Block
 {
-    CRC32 _crc;
-    uint32_t _dec = 0, _curp = 0, *_merged;
-    uint8_t _nextByte();
+    uint32_t _blockCRC = 0, _crc = 0;
+    std::vector<uint8_t> _bwt, _out;
+    std::vector<uint32_t> _merged;
+    size_t _outLength = 0;
+    void _inverseBWT(uint32_t length, uint32_t startPointer);
+    void _runLengthDecode(uint32_t length);
 public:
+    bool decode(BitInputStream &bi, uint32_t blockSize);
+    uint32_t crc() const { return _crc; }
+    size_t size() const { return _outLength; }
+    std::vector<uint8_t> &output() { return _out; }
     uint32_t process(BitInputStream &bi, uint32_t blockSize, ostream &os);
 };
 
-uint8_t Block::_nextByte()
-{       
-    uint8_t ret = _curp & 0xff;
-    _curp = _merged[_curp >> 8];
-    ++_dec;
-    return ret;
+//follow the chain from the start pointer. A second chain walked backwards
+//through a predecessor array hid some of the load latency, but building
+//that array cost more than it saved; a prefetch cannot help either, the
+//next index is only known once the load before it has completed
+void Block::_inverseBWT(uint32_t length, uint32_t startPointer)
+{
+    const uint32_t *merged = _merged.data();
+    uint8_t *out = _bwt.data();
+
+    for (uint32_t i = 0, fwd = startPointer; i < length; ++i)
+    {
+        uint32_t a = merged[fwd];
+        out[i] = a & 0xff, fwd = a >> 8;
+    }
 }
 
-uint32_t Block::process(BitInputStream &bi, uint32_t blockSize, ostream &os)
+//undo the initial run length encoding, four equal bytes are followed by a repeat count
+void Block::_runLengthDecode(uint32_t length)
 {
-    uint32_t _blockCRC = bi.readBits32(32);
-    assert(bi.readBits24(1) == 0);
+    const uint8_t *in = _bwt.data();
+    size_t total = 0;
+
+    for (uint32_t i = 0; i < length;)
+    {
+        uint32_t j = i + 1;
+
+        while (j < length && j - i < 4 && in[j] == in[i])
+            ++j;
+
+        total += j - i;
+
+        if (j - i == 4 && j < length)
+            total += in[j++];
+
+        i = j;
+    }
+
+    if (_out.size() < total)
+        _out.resize(total);
+
+    uint8_t *out = _out.data();
+
+    for (uint32_t i = 0; i < length;)
+    {
+        uint32_t j = i + 1;
+
+        while (j < length && j - i < 4 && in[j] == in[i])
+            ++j;
+
+        size_t run = j - i;
+
+        if (run == 4 && j < length)
+            run += in[j++];
+
+        memset(out, in[i], run);
+        out += run, i = j;
+    }
+
+    _outLength = total;
+}
+
+//decode a block into memory, returns false when the bits do not form a valid block
+bool Block::decode(BitInputStream &bi, uint32_t blockSize)
+{
+    _blockCRC = bi.readBits32(32);
+    _outLength = 0;
+
+    if (bi.readBits24(1) != 0)
+        return false;
+
     unsigned bwtStartPointer = bi.readBits24(24), symbolCount = 0;
     unsigned bwtByteCounts[256] = {0};
     uint8_t symbolMap[256] = {0};
@@ -311,8 +416,14 @@ uint32_t Block::process(BitInputStream &bi, uint32_t blockSize, ostream &os)
                     symbolMap[symbolCount++] = uint8_t(k);
 
     Tables tables;
-    tables.read(bi, symbolCount);
-    uint8_t bwtBlock[blockSize], mtfValue = 0;
+
+    if (symbolCount == 0 || !tables.read(bi, symbolCount))
+        return false;
+
+    if (_bwt.size() < blockSize)
+        _bwt.resize(blockSize), _merged.resize(blockSize);
+
+    uint8_t *bwtBlock = _bwt.data(), mtfValue = 0;
     MoveToFront symbolMTF;
     uint32_t _length = 0;
 
@@ -320,6 +431,9 @@ uint32_t Block::process(BitInputStream &bi, uint32_t blockSize, ostream &os)
     {
         unsigned nextSymbol = tables.nextSymbol(bi);
 
+        if (nextSymbol == Tables::INVALID)
+            return false;
+
         if (nextSymbol == 0)
         {
             n += inc;
@@ -336,25 +450,31 @@ uint32_t Block::process(BitInputStream &bi, uint32_t blockSize, ostream &os)
 
         if (n > 0)
         {
+            if (n > blockSize - _length)
+                return false;
+
             uint8_t nextByte = symbolMap[mtfValue];
             bwtByteCounts[nextByte] += n;
-            ++n, inc = 1;
-
-            while (--n >= 1)
-                bwtBlock[_length++] = nextByte;
+            memset(bwtBlock + _length, nextByte, n);
+            _length += n, n = 0, inc = 1;
         }
 
         //end of block
         if (nextSymbol == symbolCount + 1)
             break;
 
+        if (_length == blockSize)
+            return false;
+
         mtfValue = symbolMTF.indexToFront(nextSymbol - 1);
         uint8_t nextByte = symbolMap[mtfValue];
         bwtByteCounts[nextByte]++;
         bwtBlock[_length++] = nextByte;
     }
 
-    _merged = new uint32_t[_length];
+    if (bwtStartPointer >= _length)
+        return false;
+
     unsigned characterBase[256] = {0};
 
     for (unsigned i = 0; i < 255; ++i)
@@ -369,46 +489,203 @@ uint32_t Block::process(BitInputStream &bi, uint32_t blockSize, ostream &os)
         _merged[characterBase[val]++] = (i << 8) | val;
     }
 
-    _curp = _merged[bwtStartPointer];
-    unsigned repeat = 0, acc = 0;
-    int last = -1;
+    _inverseBWT(_length, bwtStartPointer);
+    _runLengthDecode(_length);
+    CRC32BZ crc;
+    crc.update(_out.data(), _outLength);
+    _crc = crc.crc();
+    return _blockCRC == _crc;
+}
+
+uint32_t Block::process(BitInputStream &bi, uint32_t blockSize, ostream &os)
+{
+    bool valid = decode(bi, blockSize);
+    assert(valid);
+    os.write((const char *)_out.data(), _outLength);
+    os.flush();
+    return _crc;
+}
+
+//decodes the blocks of a memory mapped file on a pool of worker threads
+class ParallelDecoder
+{
+    struct Job
+    {
+        uint64_t pos;
+        bool eos, done = false, valid = false;
+        uint64_t end = 0;
+        uint32_t crc = 0;
+        std::vector<uint8_t> out;
+        size_t size = 0;
+        Job(uint64_t pos, bool eos) : pos(pos), eos(eos) { }
+    };
+
+    const uint8_t *_buf;
+    size_t _len;
+    uint32_t _blockSize;
+    unsigned _nThreads, _window;
+    std::vector<Job> _jobs;
+    std::vector<std::vector<uint8_t>> _spare;
+    size_t _next = 0, _written = 0;
+    bool _stop = false;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    void _scan();
+    void _work();
+public:
+    ParallelDecoder(const uint8_t *buf, size_t len, unsigned nThreads);
+    uint32_t run(ostream &os);
+};
+
+ParallelDecoder::ParallelDecoder(const uint8_t *buf, size_t len, unsigned nThreads)
+  : _buf(buf), _len(len), _nThreads(nThreads), _window(nThreads * 2)
+{
+    assert(len >= 4 && buf[0] == 'B' && buf[1] == 'Z' && buf[2] == 'h');
+    _blockSize = (buf[3] - '0') * 100000;
+    _scan();
+}
+
+//record every block and end-of-stream magic, at any bit alignment
+void ParallelDecoder::_scan()
+{
+    static constexpr uint64_t BLOCK = 0x314159265359, EOS = 0x177245385090;
+    static constexpr uint64_t MASK = 0xffffffffffff;
+    uint64_t window = 0;
+
+    for (size_t i = 0; i < _len; ++i)
+    {
+        window = window << 8 | _buf[i];
+
+        for (int shift = 7; shift >= 0; --shift)
+        {
+            uint64_t bits = window >> shift & MASK;
+            int64_t pos = int64_t(i + 1) * 8 - shift - 48;
+
+            if (pos >= 32 && (bits == BLOCK || bits == EOS))
+                _jobs.emplace_back(pos, bits == EOS);
+        }
+    }
+}
+
+void ParallelDecoder::_work()
+{
+    Block block;
 
     while (true)
     {
-        if (repeat < 1)
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this] { return _stop || _next == _jobs.size() || _next < _written + _window; });
+
+        if (_stop || _next == _jobs.size())
+            return;
+
+        Job &job = _jobs[_next++];
+
+        //the output buffer went out with the last job, take back one
+        //that has been written
+        if (block.output().empty() && !_spare.empty())
+            block.output().swap(_spare.back()), _spare.pop_back();
+
+        lock.unlock();
+
+        if (!job.eos)
         {
-            if (_dec == _length)
-                break;
-
-            uint8_t nextByte = _nextByte();
-
-            if (nextByte != last)
-            {
-                last = nextByte, repeat = 1, acc = 1;
-                _crc.update(nextByte);
-            }
-            else if (++acc == 4)
-            {
-                repeat = _nextByte() + 1, acc = 0;
-
-                for (unsigned i = 0; i < repeat; ++i)
-                    _crc.update(nextByte);
-            }
-            else
-            {
-                repeat = 1;
-                _crc.update(nextByte);
-            }
+            BitInputStream bi(_buf, _len, job.pos + 48);
+            bool valid = block.decode(bi, _blockSize);
+            lock.lock();
+            job.valid = valid, job.end = bi.tell(), job.crc = block.crc();
+            job.out.swap(block.output()), job.size = block.size();
+        }
+        else
+        {
+            lock.lock();
+        }
+
+        job.done = true;
+        _cv.notify_all();
+    }
+}
+
+//write the blocks in stream order; candidates that start inside an earlier
+//block are false positives of the magic scan and are dropped
+uint32_t ParallelDecoder::run(ostream &os)
+{
+    std::vector<std::thread> workers;
+
+    for (unsigned i = 0; i < _nThreads; ++i)
+        workers.emplace_back(&ParallelDecoder::_work, this);
+
+    uint64_t pos = 32;
+    uint32_t streamCRC = 0;
+    bool finished = false;
+
+    for (size_t i = 0; i < _jobs.size() && !finished; ++i)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this, i] { return _jobs[i].done; });
+        Job &job = _jobs[i];
+        std::vector<uint8_t> out;
+        out.swap(job.out);
+        lock.unlock();
+
+        if (job.pos == pos && job.eos)
+        {
+            BitInputStream bi(_buf, _len, pos + 48);
+            uint32_t crc = bi.readBits32(32);
+            assert(crc == streamCRC);
+            finished = true;
+        }
+        else if (job.pos == pos)
+        {
+            assert(job.valid);
+            os.write((const char *)out.data(), job.size);
+            streamCRC = (streamCRC << 1 | streamCRC >> 31) ^ job.crc;
+            pos = job.end;
+        }
+        else
+        {
+            assert(job.pos < pos);
         }
 
-        --repeat;
-        os.put(last);
+        lock.lock();
+        _written = i + 1;
+
+        if (!out.empty())
+            _spare.push_back(std::move(out));
+
+        _cv.notify_all();
     }
 
+    assert(finished);
     os.flush();
-    delete[] _merged;
-    assert(_blockCRC == _crc.crc());
-    return _crc.crc();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _cv.notify_all();
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+
+    return streamCRC;
+}
+
+static uint32_t parallel(const char *fn, ostream &os)
+{
+    int fd = ::open(fn, O_RDONLY);
+    assert(fd >= 0);
+    struct stat st;
+    fstat(fd, &st);
+    void *buf = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    assert(buf != MAP_FAILED);
+    madvise(buf, st.st_size, MADV_SEQUENTIAL);
+    unsigned nThreads = Toolbox::max(1U, std::thread::hardware_concurrency());
+    ParallelDecoder decoder((const uint8_t *)buf, st.st_size, nThreads);
+    uint32_t crc = decoder.run(os);
+    munmap(buf, st.st_size);
+    ::close(fd);
+    return crc;
 }
 
 int main(int argc, char **argv)
@@ -422,6 +699,17 @@ int main(int argc, char **argv)
     if (quiet)
         msg = &nullstream;
 
+    //bzcat -p file decodes the blocks in parallel
+    if (argc == 3 && strcmp(argv[1], "-p") == 0)
+    {
+        uint32_t crc = parallel(argv[2], *os);
+        *msg << "0x";
+        Toolbox::hex32(crc, *msg);
+        *msg << "\r\n";
+        msg->flush();
+        return 0;
+    }
+
     if (argc == 2)
         ifs.open(argv[1]), is = &ifs;
 
@@ -430,6 +718,7 @@ int main(int argc, char **argv)
     bi.readBits24(8);
     uint8_t blockSize = bi.readBits24(8) - '0';
     uint32_t streamCRC = 0;
+    Block b;
 
     while (true)
     {
@@ -437,7 +726,6 @@ int main(int argc, char **argv)
 
         if (marker1 == 0x314159 && marker2 == 0x265359)
         {
-            Block b;
             uint32_t blockCRC = b.process(bi, blockSize * 100000, *os);
             streamCRC = (streamCRC << 1 | streamCRC >> 31) ^ blockCRC;
             continue;
@@ -461,4 +749,3 @@ int main(int argc, char **argv)
     ifs.close();
     return 0;
 }
-
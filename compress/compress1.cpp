@@ -6,6 +6,14 @@
 #include <cstring>
 #include <cassert>
 #include <iostream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using mystl::cin;
 using mystl::cout;
@@ -48,7 +56,53 @@ public:
     }
 };
 
-static Generator<unsigned> codify(istream &is)
+/*
+ * Same mapping as Dictionary, for benchmarking against it. Entries pack
+ * generation << 40 | c << 32 | ent << 16 | code into one word of a
+ * power-of-two table probed linearly. clear() bumps the generation
+ * instead of wiping the table, stale entries count as empty.
+ */
+class PackedDictionary
+{
+    static constexpr unsigned BITS = 17, SIZE = 1 << BITS, MASK = SIZE - 1;
+    static constexpr uint64_t MAXGEN = 1 << 24;
+    uint64_t *_table = new uint64_t[SIZE]();
+    uint64_t _gen = 0;
+public:
+    unsigned free_ent;
+    ~PackedDictionary() { delete[] _table; }
+    PackedDictionary() { clear(); }
+
+    void clear()
+    {
+        if (++_gen == MAXGEN)
+            memset(_table, 0, SIZE * sizeof(uint64_t)), _gen = 1;
+
+        free_ent = 257;
+    }
+
+    uint16_t find(unsigned c, unsigned ent, bool stcode)
+    {
+        const uint64_t key = _gen << 24 | c << 16 | ent;
+
+        for (unsigned hp = uint32_t(key * 0x9e3779b1U) >> 32 - BITS;; hp = hp + 1 & MASK)
+        {
+            const uint64_t e = _table[hp];
+
+            if (e >> 16 == key)
+                return e & 0xffff;
+
+            if (e >> 40 != _gen)
+            {
+                if (stcode)
+                    _table[hp] = key << 16 | free_ent++;
+                return 0;
+            }
+        }
+    }
+};
+
+template <class Dict> static Generator<unsigned> codify(istream &is)
 {
     static constexpr long CHECK_GAP = 10000;
     static constexpr unsigned IBUFSIZ = 8192;
@@ -60,7 +114,7 @@ static Generator<unsigned> codify(istream &is)
     int n_bits = 9;
     int rpos, rlop, stcode = 1, boff = 0, ratio = 0;
     uint32_t extcode = 513;
-    Dictionary dict;
+    Dict dict;
     outbits = boff = 3 << 3;
     unsigned ent;
 
@@ -182,36 +236,246 @@ static Generator<unsigned> codify(istream &is)
     }
 }
 
+//packs codes in groups of 8, a CLEAR or a width change starts a new group
+class Packer
+{
+    unsigned _cnt = 0, _nbits = 9, _bitdepth;
+    char _buf[20] = {0};
+public:
+    Packer(unsigned bitdepth) : _bitdepth(bitdepth) { }
+
+    template <class Sink> void put(unsigned code, Sink &os)
+    {
+        unsigned *window = (unsigned *)(_buf + _nbits * (_cnt % 8) / 8);
+        *window |= code << (_cnt % 8) * (_nbits - 8) % 8;
+        ++_cnt;
+
+        if (_cnt % 8 == 0 || code == 256)
+        {
+            os.write(_buf, _nbits);
+            fill(_buf, _buf + sizeof(_buf), 0);
+        }
+
+        if (code == 256)
+            _nbits = 9, _cnt = 0;
+
+        if (_nbits != _bitdepth && _cnt == 1U << _nbits - 1)
+            ++_nbits, _cnt = 0;
+    }
+
+    template <class Sink> void finish(Sink &os)
+    {
+        auto dv = div((_cnt % 8) * _nbits, 8);
+        os.write(_buf, dv.quot + (dv.rem ? 1 : 0));
+    }
+};
+
 static void press(Generator<unsigned> codes, ostream &os, unsigned bitdepth)
 {
-    unsigned cnt = 0, nbits = 9;
-    char buf[20] = {0};
+    Packer packer(bitdepth);
 
     while (codes)
+        packer.put(codes(), os);
+
+    packer.finish(os);
+    os.flush();
+}
+
+/*
+ * Parallel mode. The input is cut in chunks that are compressed on their
+ * own with a fresh dictionary. Every chunk but the last ends with a CLEAR,
+ * after which the decoder is back at 9 bits on a group boundary, so each
+ * worker can pack its chunk to bytes independently and the main thread
+ * only has to concatenate them.
+ */
+class ParallelCompressor
+{
+    static constexpr size_t CHUNK = 1 << 20;
+
+    struct Job
+    {
+        const uint8_t *in;
+        size_t len;
+        bool final;
+        std::vector<uint8_t> out;
+        bool done = false;
+    };
+
+    struct VectorSink
+    {
+        std::vector<uint8_t> &v;
+        void write(const char *buf, unsigned n) { v.insert(v.end(), buf, buf + n); }
+    };
+
+    unsigned _nThreads;
+    std::deque<Job *> _todo;
+    bool _stop = false;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    static void _compress(Job &job, PackedDictionary &dict, std::vector<uint16_t> &codes);
+    void _work();
+public:
+    ParallelCompressor(unsigned nThreads) : _nThreads(nThreads) { }
+    void run(const uint8_t *data, size_t size, ostream &os);
+};
+
+/*
+ * Plain LZW with the dictionary frozen once all 16 bit codes are taken.
+ * Like codify it then watches the ratio every CHECK_GAP bytes and emits a
+ * CLEAR when it drops, output size is estimated from the code widths.
+ */
+void ParallelCompressor::_compress(Job &job, PackedDictionary &dict, std::vector<uint16_t> &codes)
+{
+    static constexpr size_t CHECK_GAP = 10000;
+    dict.clear();
+    codes.clear();
+    unsigned ent = job.in[0];
+    size_t checkpoint = CHECK_GAP, start = 0;
+    uint64_t bits = 0, ratio = 0;
+
+    for (size_t i = 1; i < job.len; ++i)
     {
-        unsigned code = codes();
-        unsigned *window = (unsigned *)(buf + nbits * (cnt % 8) / 8);
-        *window |= code << (cnt % 8) * (nbits - 8) % 8;
-        ++cnt;
+        unsigned c = job.in[i];
+        bool stcode = dict.free_ent < 1 << 16;
+        uint16_t x = dict.find(c, ent, stcode);
 
-        if (cnt % 8 == 0 || code == 256)
+        if (x)
         {
-            os.write(buf, nbits);
-            fill(buf, buf + sizeof(buf), 0);
+            ent = x;
+            continue;
         }
 
-        if (code == 256)
-            nbits = 9, cnt = 0;
+        codes.push_back(ent);
+        bits += std::max(9, 32 - __builtin_clz(dict.free_ent - 1));
+        ent = c;
+
+        if (stcode || i < checkpoint)
+            continue;
 
-        if (nbits != bitdepth && cnt == 1U << nbits - 1)
-            ++nbits, cnt = 0;
+        checkpoint = i + CHECK_GAP;
+        uint64_t rat = (i - start << 8) / (bits >> 3);
+
+        if (rat >= ratio)
+        {
+            ratio = rat;
+            continue;
+        }
+
+        codes.push_back(256);
+        dict.clear();
+        start = i, bits = 0, ratio = 0;
     }
 
-    auto dv = div((cnt % 8) * nbits, 8);
-    os.write(buf, dv.quot + (dv.rem ? 1 : 0));
+    codes.push_back(ent);
+
+    if (!job.final)
+        codes.push_back(256);
+
+    Packer packer(16);
+    VectorSink sink{job.out};
+
+    for (uint16_t code : codes)
+        packer.put(code, sink);
+
+    packer.finish(sink);
+}
+
+void ParallelCompressor::_work()
+{
+    PackedDictionary dict;
+    std::vector<uint16_t> codes;
+
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this] { return _stop || !_todo.empty(); });
+
+        if (_todo.empty())
+            return;
+
+        Job *job = _todo.front();
+        _todo.pop_front();
+        lock.unlock();
+        _compress(*job, dict, codes);
+        lock.lock();
+        job->done = true;
+        _cv.notify_all();
+    }
+}
+
+void ParallelCompressor::run(const uint8_t *data, size_t size, ostream &os)
+{
+    std::vector<std::thread> workers;
+
+    for (unsigned i = 0; i < _nThreads; ++i)
+        workers.emplace_back(&ParallelCompressor::_work, this);
+
+    std::deque<std::unique_ptr<Job>> inflight;
+
+    for (size_t pos = 0; pos < size;)
+    {
+        auto job = std::make_unique<Job>();
+        job->in = data + pos;
+        job->len = min(CHUNK, size - pos);
+        pos += job->len;
+        job->final = pos == size;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _todo.push_back(job.get());
+            _cv.notify_all();
+        }
+
+        inflight.push_back(std::move(job));
+
+        while (inflight.size() > _nThreads * 2 || pos == size && !inflight.empty())
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [&inflight] { return inflight.front()->done; });
+            lock.unlock();
+            std::vector<uint8_t> &out = inflight.front()->out;
+            os.write((char *)out.data(), out.size());
+            inflight.pop_front();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _cv.notify_all();
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+
     os.flush();
 }
 
+static void parallel(const char *fn, ostream &os)
+{
+    int fd = open(fn, O_RDONLY);
+    assert(fd >= 0);
+    struct stat st;
+    fstat(fd, &st);
+    const uint8_t *data = nullptr;
+
+    if (st.st_size > 0)
+    {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        assert(p != MAP_FAILED);
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        data = (const uint8_t *)p;
+    }
+
+    ParallelCompressor compressor(std::max(1U, std::thread::hardware_concurrency()));
+    compressor.run(data, st.st_size, os);
+
+    if (data)
+        munmap((void *)data, st.st_size);
+
+    close(fd);
+}
+
 int main(int argc, char **argv)
 {
     static constexpr unsigned bitdepth = 16;
@@ -219,13 +483,30 @@ int main(int argc, char **argv)
     ostream *os = &cout;
     ifstream ifs;
 
-    if (argc > 1)
-        ifs.open(argv[1]), is = &ifs;
+    //compress1 -p file compresses chunks on all cores
+    if (argc > 2 && strcmp(argv[1], "-p") == 0)
+    {
+        os->put(0x1f);
+        os->put(0x9d);
+        os->put(bitdepth | 0x80);
+        parallel(argv[2], *os);
+        return 0;
+    }
+
+    //compress1 -o uses the open addressing PackedDictionary
+    bool packed = argc > 1 && strcmp(argv[1], "-o") == 0;
+
+    if (argc > 1 + packed)
+        ifs.open(argv[1 + packed]), is = &ifs;
 
     os->put(0x1f);
     os->put(0x9d);
     os->put(bitdepth | 0x80);
-    press(codify(*is), *os, bitdepth);
+
+    if (packed)
+        press(codify<PackedDictionary>(*is), *os, bitdepth);
+    else
+        press(codify<Dictionary>(*is), *os, bitdepth);
     return 0;
 }
 
@@ -1,6 +1,15 @@
+#include "crc32.h"
 #include <iostream>
 #include <fstream>
 #include <cstdint>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static char nibble(uint8_t n)
 {
@@ -21,66 +30,102 @@ static std::string hex32(uint32_t dw)
     return ret;
 }
 
-class CRC32
+/*
+ * Each thread takes one contiguous slice of the mapping and computes its
+ * CRC from scratch. The slices are joined left to right with combine(),
+ * which shifts the running CRC over the length of the next slice, so the
+ * result is the same as one pass over the whole file.
+ */
+static bool parallel(const char *fn, uint32_t &result)
 {
-private:
-    uint32_t _table[256];
-    uint32_t _crc = 0xffffffff;
-    void _makeTable();
-public:
-    CRC32() { _makeTable(); }
-    void update(char c);
-    uint32_t crc() const { return ~_crc; }
-};
-
-void CRC32::_makeTable()
-{
-    //adapted from https://www.ietf.org/rfc/rfc1952.txt
-    for (uint32_t n = 0; n < 256; ++n)
+    static constexpr size_t MIN_SLICE = 1 << 22;
+    int fd = open(fn, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
     {
-        uint32_t c = n;
-        for (uint32_t k = 0; k < 8; ++k)
-            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
-        _table[n] = c;
+        close(fd);
+        return false;
     }
-#if 0
-    for (uint32_t crc : _table)
-        std::cerr << "0x" << hex32(crc) << "\r\n";
-#endif
-}
 
-void CRC32::update(char c)
-{
-#if 1
-    _crc = _table[(_crc ^ c) & 0xff] ^ (_crc >> 8);
-#else
-    _crc ^= c;
-
-    for (int i = 0; i < 8; ++i)
-        _crc = (_crc >> 1) ^ ((_crc & 1) * uint32_t(0xedb88320));
-#endif
+    const size_t len = st.st_size;
+    void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED)
+        return false;
+
+    const uint8_t *data = (const uint8_t *)p;
+    const size_t nThreads = std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()),
+                                             (len + MIN_SLICE - 1) / MIN_SLICE);
+    std::vector<uint32_t> crcs(nThreads);
+    std::vector<size_t> begin(nThreads + 1);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i <= nThreads; ++i)
+        begin[i] = len / nThreads * i + std::min(i, len % nThreads);
+
+    for (size_t i = 0; i < nThreads; ++i)
+    {
+        threads.emplace_back([&, i]
+        {
+            madvise((void *)(data + (begin[i] & ~size_t(4095))), begin[i + 1] - (begin[i] & ~size_t(4095)),
+                    MADV_SEQUENTIAL);
+
+            CRC32 crc;
+            crc.update(data + begin[i], begin[i + 1] - begin[i]);
+            crcs[i] = crc.crc();
+        });
+    }
+
+    for (std::thread &t : threads)
+        t.join();
+
+    result = crcs[0];
+
+    for (size_t i = 1; i < nThreads; ++i)
+        result = CRC32::combine(result, crcs[i], begin[i + 1] - begin[i]);
+
+    munmap(p, len);
+    return true;
 }
 
 int main(int argc, char **argv)
 {
+    //crc32 -p file splits a regular file over all cores
+    if (argc == 3 && strcmp(argv[1], "-p") == 0)
+    {
+        uint32_t result;
+
+        if (parallel(argv[2], result))
+        {
+            std::cout << "0x" << hex32(result) << "\r\n";
+            return 0;
+        }
+
+        argv[1] = argv[2], argc = 2;
+    }
+
     CRC32 crc;
     std::istream *is = &std::cin;
     std::ifstream ifs;
 
     if (argc == 2)
     {
-        ifs.open(argv[1]);
+        ifs.open(argv[1], std::ios::binary);
         is = &ifs;
     }
 
-    while (true)
-    {
-        int c = is->get();
-        
-        if (c == -1)
-            break;
+    std::vector<char> buf(1 << 20);
 
-        crc.update(c);
+    while (*is)
+    {
+        is->read(buf.data(), buf.size());
+        crc.update((const uint8_t *)buf.data(), is->gcount());
     }
 
     std::cout << "0x" << hex32(crc.crc()) << "\r\n";
@@ -0,0 +1,237 @@
+//CRC-32, polynomial 0x04c11db7, in both bit orders
+//CRC32 is the reflected one of gzip and zip, CRC32BZ the MSB first one of bzip2
+//shared by crc32, bzcat, gzcat and wincore, the others build with -I../crc32
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_CLMUL
+#endif
+
+template <bool REFLECTED> class CRCEngine
+{
+    static constexpr uint32_t POLY = REFLECTED ? 0xedb88320 : 0x04c11db7;
+
+    //slicing-by-16, t[k][c] is the CRC of byte c followed by k zero bytes
+    //x2n[k] is x^(2^k) mod P, in the same bit order as the CRC
+    struct Tables
+    {
+        uint32_t t[16][256];
+        uint32_t x2n[64];
+
+        Tables()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = REFLECTED ? i : i << 24;
+
+                for (int j = 0; j < 8; ++j)
+                    c = REFLECTED ? (c & 1 ? c >> 1 ^ POLY : c >> 1)
+                                  : (c & 0x80000000 ? c << 1 ^ POLY : c << 1);
+
+                t[0][i] = c;
+            }
+
+            for (int k = 1; k < 16; ++k)
+                for (uint32_t i = 0; i < 256; ++i)
+                    t[k][i] = REFLECTED ? t[k - 1][i] >> 8 ^ t[0][t[k - 1][i] & 0xff]
+                                        : t[k - 1][i] << 8 ^ t[0][t[k - 1][i] >> 24];
+
+            x2n[0] = REFLECTED ? 1U << 30 : 2;
+
+            for (int k = 1; k < 64; ++k)
+                x2n[k] = multiply(x2n[k - 1], x2n[k - 1]);
+        }
+    };
+
+    static const Tables &_tables() { static const Tables tables; return tables; }
+    uint32_t _crc = 0xffffffff;
+
+    static uint32_t _load(const uint8_t *p)
+    { return REFLECTED ? p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24
+                       : uint32_t(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+    static uint32_t _byte(const uint32_t (&t)[16][256], uint32_t crc, uint8_t c)
+    { return REFLECTED ? t[0][(crc ^ c) & 0xff] ^ crc >> 8 : crc << 8 ^ t[0][(crc >> 24 ^ c) & 0xff]; }
+
+    //t[k] at byte position i of a 4 byte word, in the order the bytes came in
+    static uint32_t _word(const uint32_t (&t)[16][256], uint32_t w, unsigned k)
+    {
+        return REFLECTED ? t[k + 3][w & 0xff] ^ t[k + 2][w >> 8 & 0xff] ^ t[k + 1][w >> 16 & 0xff] ^ t[k][w >> 24]
+                         : t[k + 3][w >> 24] ^ t[k + 2][w >> 16 & 0xff] ^ t[k + 1][w >> 8 & 0xff] ^ t[k][w & 0xff];
+    }
+
+#ifdef CRC32_CLMUL
+    __attribute__((target("pclmul,ssse3"))) static __m128i _load16(const uint8_t *p)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        return REFLECTED ? x : _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    }
+
+    //low half times the low constant, high half times the high one, plus new data
+    __attribute__((target("pclmul,ssse3"))) static __m128i _fold(__m128i x, __m128i k, __m128i data)
+    {
+        __m128i a = _mm_clmulepi64_si128(x, k, 0x00);
+        __m128i b = _mm_clmulepi64_si128(x, k, 0x11);
+        return _mm_xor_si128(_mm_xor_si128(a, b), data);
+    }
+
+    __attribute__((target("pclmul,ssse3"))) static uint32_t _clmul(uint32_t crc, const uint8_t *buf, size_t n);
+#endif
+    typedef uint32_t (*Kernel)(uint32_t crc, const uint8_t *buf, size_t n);
+    static Kernel _pick();
+public:
+    //product of two polynomials mod P
+    static uint32_t multiply(uint32_t a, uint32_t b);
+
+    //x^(8n) mod P, what appending n zero bytes multiplies the CRC by
+    static uint32_t zeros(uint64_t n);
+
+    //CRC of A followed by B from CRC(A), CRC(B) and the length of B
+    static uint32_t combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+    { return multiply(zeros(len2), crc1) ^ crc2; }
+
+    //raw register update, no pre or post inversion
+    template <unsigned N> static uint32_t slice(uint32_t crc, const uint8_t *buf, size_t n);
+
+    //fastest kernel this CPU has, chosen on first use
+    static uint32_t raw(uint32_t crc, const uint8_t *buf, size_t n)
+    { static const Kernel kernel = _pick(); return kernel(crc, buf, n); }
+
+    void update(uint8_t c) { _crc = _byte(_tables().t, _crc, c); }
+    void update(const uint8_t *buf, size_t n) { _crc = raw(_crc, buf, n); }
+    uint32_t crc() const { return ~_crc; }
+};
+
+typedef CRCEngine<true> CRC32;
+typedef CRCEngine<false> CRC32BZ;
+
+template <bool REFLECTED> uint32_t CRCEngine<REFLECTED>::multiply(uint32_t a, uint32_t b)
+{
+    uint32_t p = 0;
+
+    if (REFLECTED)
+    {
+        //x^0 is the top bit, x^31 bit 0
+        for (uint32_t m = 1U << 31; m; m >>= 1)
+        {
+            if (a & m)
+                p ^= b;
+
+            b = b & 1 ? b >> 1 ^ POLY : b >> 1;
+        }
+    }
+    else
+    {
+        for (int i = 31; i >= 0; --i)
+        {
+            p = p & 0x80000000 ? p << 1 ^ POLY : p << 1;
+
+            if (a >> i & 1)
+                p ^= b;
+        }
+    }
+
+    return p;
+}
+
+template <bool REFLECTED> uint32_t CRCEngine<REFLECTED>::zeros(uint64_t n)
+{
+    const Tables &tables = _tables();
+    uint32_t p = REFLECTED ? 1U << 31 : 1;
+
+    for (unsigned k = 3; n; n >>= 1, ++k)
+        if (n & 1)
+            p = multiply(tables.x2n[k & 63], p);
+
+    return p;
+}
+
+template <bool REFLECTED> template <unsigned N>
+uint32_t CRCEngine<REFLECTED>::slice(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    static_assert(N == 8 || N == 16, "slicing by 8 or 16");
+    const uint32_t (&t)[16][256] = _tables().t;
+
+    for (; n >= N; buf += N, n -= N)
+    {
+        uint32_t x = _word(t, crc ^ _load(buf), N - 4);
+
+        for (unsigned i = 4; i < N; i += 4)
+            x ^= _word(t, _load(buf + i), N - 4 - i);
+
+        crc = x;
+    }
+
+    while (n--)
+        crc = _byte(t, crc, *buf++);
+
+    return crc;
+}
+
+#ifdef CRC32_CLMUL
+/*
+ * Folding with carry-less multiplication, as in Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ". Four 128 bit
+ * accumulators move forward 64 bytes per round, each half multiplied by
+ * x^k mod P for the distance it travels. The last accumulator is then
+ * run through the tables as 16 bytes of message, which saves the Barrett
+ * reduction. MSB first input is byte reversed so that the first byte is
+ * the high end of the 128 bit value, reflected input is used as it is
+ * and its constants are bit reversed and shifted up by one.
+ */
+template <bool REFLECTED> __attribute__((target("pclmul,ssse3")))
+uint32_t CRCEngine<REFLECTED>::_clmul(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    if (n < 64)
+        return slice<16>(crc, buf, n);
+
+    //x^d mod P for folding a 64 bit half over d bits, d is a whole number of bytes
+    auto k = [](unsigned d) -> uint64_t
+    { return REFLECTED ? uint64_t(zeros(d / 8)) << 1 : zeros(d / 8); };
+
+    static const __m128i k512 = REFLECTED ? _mm_set_epi64x(k(480), k(544)) : _mm_set_epi64x(k(576), k(512));
+    static const __m128i k128 = REFLECTED ? _mm_set_epi64x(k(96), k(160)) : _mm_set_epi64x(k(192), k(128));
+    __m128i x[4];
+
+    for (int i = 0; i < 4; ++i)
+        x[i] = _load16(buf + 16 * i);
+
+    x[0] = _mm_xor_si128(x[0], REFLECTED ? _mm_cvtsi32_si128(crc) : _mm_slli_si128(_mm_cvtsi32_si128(crc), 12));
+    buf += 64, n -= 64;
+
+    for (; n >= 64; buf += 64, n -= 64)
+        for (int i = 0; i < 4; ++i)
+            x[i] = _fold(x[i], k512, _load16(buf + 16 * i));
+
+    __m128i acc = _fold(_fold(_fold(x[0], k128, x[1]), k128, x[2]), k128, x[3]);
+
+    for (; n >= 16; buf += 16, n -= 16)
+        acc = _fold(acc, k128, _load16(buf));
+
+    //back in message order, _load16 undoes its own byte swap
+    uint8_t tail[16];
+    _mm_storeu_si128((__m128i *)tail, acc);
+    _mm_storeu_si128((__m128i *)tail, _load16(tail));
+    return slice<16>(slice<16>(0, tail, 16), buf, n);
+}
+#endif
+
+template <bool REFLECTED> typename CRCEngine<REFLECTED>::Kernel CRCEngine<REFLECTED>::_pick()
+{
+#ifdef CRC32_CLMUL
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+        return _clmul;
+#endif
+    return slice<16>;
+}
+
+#endif
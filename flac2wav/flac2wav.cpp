@@ -6,6 +6,22 @@
 #include <fstream>
 #include <cstdint>
 #include <cassert>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+#include <chrono>
+#include <string>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 using std::ostream;
 using std::istream;
@@ -386,6 +402,11 @@ void FlacFrame::write(ostream &os)
             {
                 Toolbox::writeWLE(os, val);
             }
+            else if (_sampleDepth == 24)
+            {
+                Toolbox::writeWLE(os, val);
+                os.put(char(val >> 16));
+            }
             else
             {
                 throw "Unsupported sample depth";
@@ -402,22 +423,661 @@ FlacFrame::FlacFrame(Matrix<int64_t> *mat, int numChannels, int sampleDepth)
 {
 }
 
-int main()
+/*
+ * The fast engine. Frames are decoded from memory through a 64 bit bit
+ * window, unary prefixes are counted with count leading zeros, and every
+ * channel is a plane of int32 samples. Predictors are templated on their
+ * order so that each one is an unrolled loop; LPC sums are 32 bit when
+ * sample depth, coefficient precision and order leave room for it, which
+ * is the case for anything up to 16 bit audio with the usual precision,
+ * and those above order 8 go to AVX2 where the CPU has it. Handles up
+ * to 24 bit samples, the side channel then still fits in 32.
+ */
+class BitReader
+{
+    const uint8_t *_begin, *_p, *_end;
+    uint64_t _bits = 0;     //left aligned, below the valid bits whatever comes next
+    unsigned _n = 0;
+
+    //at least 56 valid bits unless the data runs out
+    void _refill()
+    {
+        if (_end - _p >= 8)
+        {
+            uint64_t x;
+            memcpy(&x, _p, 8);
+            _bits |= __builtin_bswap64(x) >> _n;
+            _p += (63 - _n) >> 3;
+            _n |= 56;
+            return;
+        }
+
+        for (; _n <= 56 && _p < _end; _n += 8)
+            _bits |= uint64_t(*_p++) << (56 - _n);
+    }
+public:
+    BitReader(const uint8_t *p, size_t n) : _begin(p), _p(p), _end(p + n) { }
+
+    //bytes taken so far, after alignToByte
+    size_t position() const { return _p - _begin - _n / 8; }
+    void alignToByte() { _bits <<= _n % 8, _n -= _n % 8; }
+
+    //n up to 32, the end of the data throws like BitInputStream does
+    uint32_t readUint(unsigned n)
+    {
+        if (n == 0)
+            return 0;
+
+        if (_n < n && (_refill(), _n < n))
+            throw std::exception();
+
+        uint32_t ret = uint32_t(_bits >> (64 - n));
+        _bits <<= n, _n -= n;
+        return ret;
+    }
+
+    int32_t readSigned(unsigned n)
+    { return n == 0 ? 0 : int32_t(readUint(n) << (32 - n)) >> (32 - n); }
+
+    //zeros before the next one, the one is taken too
+    uint32_t readUnary()
+    {
+        uint32_t q = 0;
+        unsigned z;
+
+        while (_bits == 0 || (z = __builtin_clzll(_bits)) >= _n)
+        {
+            q += _n, _bits = 0, _n = 0;
+            _refill();
+
+            if (_n == 0)
+                throw std::exception();
+        }
+
+        _bits <<= z + 1, _n -= z + 1;
+        return q + z;
+    }
+
+    //a partition of Rice coded residuals
+    void readRice(int32_t *dst, uint32_t count, unsigned param)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (_n < 40)
+                _refill();
+
+            uint32_t val;
+
+            if (_bits != 0 && __builtin_clzll(_bits) + 1 + param <= _n)
+            {
+                unsigned z = __builtin_clzll(_bits);
+                _bits <<= z + 1;
+                val = z << param | (param ? uint32_t(_bits >> (64 - param)) : 0);
+                _bits <<= param, _n -= z + 1 + param;
+            }
+            else
+            {
+                uint32_t q = readUnary();
+                val = q << param | readUint(param);
+            }
+
+            dst[i] = int32_t(val >> 1 ^ -(val & 1));
+        }
+    }
+};
+
+//--stats counters, per decoder and added up at the end
+struct DecodeStats
+{
+    enum { CONSTANT, VERBATIM, FIXED, LPC };
+    uint64_t subframes[4] = {};
+    uint64_t residual = 0, prediction = 0, output = 0, md5 = 0;   //nanoseconds
+    uint64_t samples = 0;
+
+    DecodeStats &operator+=(const DecodeStats &s)
+    {
+        for (int i = 0; i < 4; ++i)
+            subframes[i] += s.subframes[i];
+
+        residual += s.residual, prediction += s.prediction;
+        output += s.output, md5 += s.md5, samples += s.samples;
+        return *this;
+    }
+};
+
+//adds the time since the previous lap to a counter, nothing at all when off
+template <bool ON> class Stopwatch
+{
+    std::chrono::steady_clock::time_point _t;
+public:
+    Stopwatch() { if constexpr (ON) _t = std::chrono::steady_clock::now(); }
+
+    void lap(uint64_t &counter)
+    {
+        if constexpr (ON)
+        {
+            auto t = std::chrono::steady_clock::now();
+            counter += std::chrono::duration_cast<std::chrono::nanoseconds>(t - _t).count();
+            _t = t;
+        }
+    }
+};
+
+class FastFrame
+{
+public:
+    static constexpr int MAX_DEPTH = 24;
+private:
+    //planes start this far into their stride, the AVX2 kernel reads up to 7 before x[0]
+    static constexpr uint32_t GUARD = 8;
+    typedef void (*Kernel)(int32_t *x, uint32_t n, const int32_t *coefs, unsigned shift);
+    std::vector<int32_t> _planes;
+    uint32_t _stride = 0;
+    uint32_t _blockSize = 0;
+    int _numChannels;
+    int _sampleDepth;
+
+    template <unsigned ORDER, class ACC> static void _lpc(int32_t *x, uint32_t n, const int32_t *coefs, unsigned shift);
+#ifdef __x86_64__
+    template <unsigned ORDER> __attribute__((target("avx2")))
+    static void _lpcAvx2(int32_t *x, uint32_t n, const int32_t *coefs, unsigned shift);
+#endif
+    template <unsigned ORDER> static void _fixed(int32_t *x, uint32_t n);
+    template <class ACC, unsigned... N> static const Kernel *_table(std::integer_sequence<unsigned, N...>);
+#ifdef __x86_64__
+    template <unsigned... N> static const Kernel *_simdTable(std::integer_sequence<unsigned, N...>);
+#endif
+    static Kernel _kernel(unsigned order, bool wide);
+    int32_t *_plane(int ch) { return _planes.data() + ch * _stride + GUARD; }
+    template <bool STATS> void _decodeSubframe(BitReader &in, unsigned sampleDepth, int32_t *x);
+    void _decodeResiduals(BitReader &in, unsigned warmup, int32_t *x);
+public:
+    DecodeStats stats;
+    FastFrame(int numChannels, int sampleDepth) : _numChannels(numChannels), _sampleDepth(sampleDepth) { }
+
+    //STATS counts subframes and times the stages into stats
+    template <bool STATS = false> void decode(BitReader &in);
+    uint32_t blockSize() const { return _blockSize; }
+    size_t bytes() const { return size_t(_blockSize) * _numChannels * (_sampleDepth / 8); }
+    void write(char *dst) const;
+    void pcm(char *dst) const;
+};
+
+template <unsigned ORDER, class ACC>
+void FastFrame::_lpc(int32_t *x, uint32_t n, const int32_t *coefs, unsigned shift)
+{
+    int32_t c[ORDER ? ORDER : 1];
+    std::copy(coefs, coefs + ORDER, c);
+
+    for (uint32_t i = ORDER; i < n; ++i)
+    {
+        ACC sum = 0;
+#pragma GCC unroll 32
+        for (unsigned j = 0; j < ORDER; ++j)
+            sum += ACC(c[j]) * x[i - 1 - j];
+
+        x[i] += int32_t(sum >> shift);
+    }
+}
+
+#ifdef __x86_64__
+/*
+ * The eight newest taps go through the scalar code, they depend on the
+ * samples just written. The older ones are eight to a multiply, with the
+ * coefficients reversed to line up with the history in memory; that part
+ * does not wait for the previous sample, so it overlaps with the rest.
+ */
+template <unsigned ORDER> __attribute__((target("avx2")))
+void FastFrame::_lpcAvx2(int32_t *x, uint32_t n, const int32_t *coefs, unsigned shift)
+{
+    static constexpr unsigned P = (ORDER - 8 + 7) & ~7U;
+    alignas(32) int32_t c[P] = {};
+    __m256i v[P / 8];
+
+    for (unsigned j = 8; j < ORDER; ++j)
+        c[P + 7 - j] = coefs[j];
+
+    for (unsigned k = 0; k < P / 8; ++k)
+        v[k] = _mm256_load_si256((const __m256i *)(c + 8 * k));
+
+    int32_t near[8];
+    std::copy(coefs, coefs + 8, near);
+
+    for (uint32_t i = ORDER; i < n; ++i)
+    {
+        const int32_t *h = x + i - 8 - P;
+        __m256i acc = _mm256_mullo_epi32(v[0], _mm256_loadu_si256((const __m256i *)h));
+
+        for (unsigned k = 1; k < P / 8; ++k)
+            acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(v[k], _mm256_loadu_si256((const __m256i *)(h + 8 * k))));
+
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+        int32_t sum = _mm_cvtsi128_si32(s);
+#pragma GCC unroll 8
+        for (unsigned j = 0; j < 8; ++j)
+            sum += near[j] * x[i - 1 - j];
+
+        x[i] += sum >> shift;
+    }
+}
+#endif
+
+//the fixed predictors are LPC with small constant coefficients
+template <unsigned ORDER> void FastFrame::_fixed(int32_t *x, uint32_t n)
+{
+    for (uint32_t i = ORDER; i < n; ++i)
+    {
+        if (ORDER == 1)
+            x[i] += x[i - 1];
+        else if (ORDER == 2)
+            x[i] += 2 * x[i - 1] - x[i - 2];
+        else if (ORDER == 3)
+            x[i] += 3 * (x[i - 1] - x[i - 2]) + x[i - 3];
+        else if (ORDER == 4)
+            x[i] += 4 * (x[i - 1] + x[i - 3]) - 6 * x[i - 2] - x[i - 4];
+    }
+}
+
+template <class ACC, unsigned... N>
+const FastFrame::Kernel *FastFrame::_table(std::integer_sequence<unsigned, N...>)
+{
+    static const Kernel table[] = {_lpc<N, ACC>...};
+    return table;
+}
+
+#ifdef __x86_64__
+//orders 9 to 32
+template <unsigned... N>
+const FastFrame::Kernel *FastFrame::_simdTable(std::integer_sequence<unsigned, N...>)
+{
+    static const Kernel table[] = {_lpcAvx2<N + 9>...};
+    return table;
+}
+#endif
+
+//kernel for an LPC order of 1 to 32, wide for 64 bit sums
+FastFrame::Kernel FastFrame::_kernel(unsigned order, bool wide)
+{
+    static const Kernel *narrow = _table<int32_t>(std::make_integer_sequence<unsigned, 33>());
+    static const Kernel *wider = _table<int64_t>(std::make_integer_sequence<unsigned, 33>());
+#ifdef __x86_64__
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    static const Kernel *simd = _simdTable(std::make_integer_sequence<unsigned, 24>());
+
+    if (!wide && avx2 && order > 8)
+        return simd[order - 9];
+#endif
+    return wide ? wider[order] : narrow[order];
+}
+
+void FastFrame::_decodeResiduals(BitReader &in, unsigned warmup, int32_t *x)
+{
+    uint8_t method = in.readUint(2);
+    assert(method < 2);
+    uint8_t paramBits = method == 0 ? 4 : 5;
+    uint8_t escapeParam = method == 0 ? 0xF : 0x1F;
+    uint8_t partitionOrder = in.readUint(4);
+    uint32_t numPartitions = 1 << partitionOrder;
+
+    //Block size must be divisble by number of Rice partitions
+    assert(_blockSize % numPartitions == 0);
+    uint32_t partitionSize = _blockSize / numPartitions;
+
+    for (uint32_t i = 0; i < numPartitions; ++i)
+    {
+        uint32_t start = i * partitionSize + (i == 0 ? warmup : 0);
+        uint32_t end = (i + 1) * partitionSize;
+        uint8_t param = in.readUint(paramBits);
+
+        if (param < escapeParam)
+        {
+            in.readRice(x + start, end - start, param);
+        }
+        else
+        {
+            uint8_t numBits = in.readUint(5);
+
+            for (uint32_t j = start; j < end; ++j)
+                x[j] = in.readSigned(numBits);
+        }
+    }
+}
+
+template <bool STATS> void FastFrame::_decodeSubframe(BitReader &in, unsigned sampleDepth, int32_t *x)
+{
+    Stopwatch<STATS> watch;
+    in.readUint(1);
+    uint8_t type = in.readUint(6);
+    unsigned shift = in.readUint(1);
+
+    if (shift == 1)
+        shift += in.readUnary();
+
+    sampleDepth -= shift;
+
+    if (type == 0)
+    {
+        std::fill(x, x + _blockSize, in.readSigned(sampleDepth));
+
+        if constexpr (STATS)
+            ++stats.subframes[DecodeStats::CONSTANT];
+    }
+    else if (type == 1)
+    {
+        for (uint32_t i = 0; i < _blockSize; ++i)
+            x[i] = in.readSigned(sampleDepth);
+
+        if constexpr (STATS)
+            ++stats.subframes[DecodeStats::VERBATIM];
+    }
+    else if (8 <= type && type <= 12)
+    {
+        const unsigned order = type - 8;
+
+        for (unsigned i = 0; i < order; ++i)
+            x[i] = in.readSigned(sampleDepth);
+
+        _decodeResiduals(in, order, x);
+        watch.lap(stats.residual);
+
+        if constexpr (STATS)
+            ++stats.subframes[DecodeStats::FIXED];
+
+        switch (order)
+        {
+        case 1: _fixed<1>(x, _blockSize); break;
+        case 2: _fixed<2>(x, _blockSize); break;
+        case 3: _fixed<3>(x, _blockSize); break;
+        case 4: _fixed<4>(x, _blockSize); break;
+        }
+    }
+    else if (32 <= type && type <= 63)
+    {
+        const unsigned order = type - 31;
+
+        for (unsigned i = 0; i < order; ++i)
+            x[i] = in.readSigned(sampleDepth);
+
+        uint8_t precision = in.readUint(4) + 1;
+        uint8_t shift2 = in.readUint(5);
+        int32_t coefs[32];
+
+        for (unsigned i = 0; i < order; ++i)
+            coefs[i] = in.readSigned(precision);
+
+        _decodeResiduals(in, order, x);
+        watch.lap(stats.residual);
+
+        if constexpr (STATS)
+            ++stats.subframes[DecodeStats::LPC];
+
+        //the sum is at most order * 2^(depth - 1) * 2^(precision - 1)
+        bool wide = sampleDepth + precision + (32 - __builtin_clz(order)) > 32;
+        _kernel(order, wide)(x, _blockSize, coefs, shift2);
+    }
+    else
+    {
+        throw "Reserved subframe type";
+    }
+
+    //constant and verbatim subframes count as residual, it is all bit reading
+    watch.lap(type < 8 ? stats.residual : stats.prediction);
+
+    if (shift)
+        for (uint32_t i = 0; i < _blockSize; ++i)
+            x[i] = int32_t(uint32_t(x[i]) << shift);
+
+    watch.lap(stats.prediction);
+}
+
+template <bool STATS> void FastFrame::decode(BitReader &in)
+{
+    assert(in.readUint(14) == 0x3ffe);
+    in.readUint(2);
+    uint8_t blockSizeCode = in.readUint(4);
+    uint8_t sampleRateCode = in.readUint(4);
+    uint8_t chanAsgn = in.readUint(4);
+    in.readUint(4);
+
+    for (uint8_t lead = in.readUint(8); lead >= 0b11000000; lead = lead << 1 & 0xff)
+        in.readUint(8);
+
+    if (blockSizeCode == 1)
+        _blockSize = 192;
+    else if (2 <= blockSizeCode && blockSizeCode <= 5)
+        _blockSize = 576 << (blockSizeCode - 2);
+    else if (blockSizeCode == 6)
+        _blockSize = in.readUint(8) + 1;
+    else if (blockSizeCode == 7)
+        _blockSize = in.readUint(16) + 1;
+    else if (8 <= blockSizeCode && blockSizeCode <= 15)
+        _blockSize = 256 << (blockSizeCode - 8);
+    else
+        throw "Reserved block size";
+
+    if (sampleRateCode == 12)
+        in.readUint(8);
+    else if (sampleRateCode == 13 || sampleRateCode == 14)
+        in.readUint(16);
+
+    in.readUint(8);
+
+    if (_blockSize + GUARD > _stride)
+    {
+        _stride = _blockSize + GUARD;
+        _planes.assign(size_t(_stride) * _numChannels, 0);
+    }
+
+    if (chanAsgn <= 7)
+    {
+        for (int ch = 0; ch < _numChannels; ++ch)
+            _decodeSubframe<STATS>(in, _sampleDepth, _plane(ch));
+    }
+    else if (8 <= chanAsgn && chanAsgn <= 10)
+    {
+        int32_t *x0 = _plane(0), *x1 = _plane(1);
+        _decodeSubframe<STATS>(in, _sampleDepth + (chanAsgn == 9 ? 1 : 0), x0);
+        _decodeSubframe<STATS>(in, _sampleDepth + (chanAsgn == 9 ? 0 : 1), x1);
+        Stopwatch<STATS> watch;
+
+        if (chanAsgn == 8)
+        {
+            for (uint32_t i = 0; i < _blockSize; ++i)
+                x1[i] = x0[i] - x1[i];
+        }
+        else if (chanAsgn == 9)
+        {
+            for (uint32_t i = 0; i < _blockSize; ++i)
+                x0[i] += x1[i];
+        }
+        else
+        {
+            for (uint32_t i = 0; i < _blockSize; ++i)
+            {
+                int32_t side = x1[i];
+                int32_t right = x0[i] - (side >> 1);
+                x1[i] = right;
+                x0[i] = right + side;
+            }
+        }
+
+        watch.lap(stats.prediction);
+    }
+    else
+    {
+        throw "Reserved channel assignment";
+    }
+
+    in.alignToByte();
+    in.readUint(16);
+
+    if constexpr (STATS)
+        stats.samples += _blockSize;
+}
+
+//interleaved, the same bytes FlacFrame::write puts out
+void FastFrame::write(char *dst) const
+{
+    const int32_t *x = _planes.data() + GUARD;
+
+    if (_sampleDepth == 16)
+    {
+        for (uint32_t i = 0; i < _blockSize; ++i)
+        {
+            for (int ch = 0; ch < _numChannels; ++ch)
+            {
+                uint16_t w = uint16_t(x[ch * _stride + i]);
+                memcpy(dst, &w, 2);
+                dst += 2;
+            }
+        }
+    }
+    else if (_sampleDepth == 8)
+    {
+        for (uint32_t i = 0; i < _blockSize; ++i)
+            for (int ch = 0; ch < _numChannels; ++ch)
+                *dst++ = char((x[ch * _stride + i] + 128) % 0xff);
+    }
+    else if (_sampleDepth == 24)
+    {
+        pcm(dst);
+    }
+    else
+    {
+        throw "Unsupported sample depth";
+    }
+}
+
+//interleaved signed little endian, what the STREAMINFO MD5 is taken over
+void FastFrame::pcm(char *dst) const
+{
+    const int32_t *x = _planes.data() + GUARD;
+    const int bytes = _sampleDepth / 8;
+
+    for (uint32_t i = 0; i < _blockSize; ++i)
+        for (int ch = 0; ch < _numChannels; ++ch)
+            for (int b = 0; b < bytes; ++b)
+                *dst++ = char(x[ch * _stride + i] >> 8 * b);
+}
+
+//RFC 1321, for --verify
+class MD5
+{
+    uint32_t _h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    uint8_t _buf[64];
+    uint64_t _size = 0;
+    void _block(const uint8_t *p);
+public:
+    void update(const char *data, size_t n);
+    void finish(uint8_t digest[16]);
+};
+
+void MD5::_block(const uint8_t *p)
+{
+    //floor(abs(sin(i + 1)) * 2^32)
+    static constexpr uint32_t K[64] = {
+     0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+     0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+     0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+     0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+     0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+     0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+     0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+     0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+    static constexpr uint8_t R[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+    uint32_t w[16];
+    memcpy(w, p, 64);
+    uint32_t a = _h[0], b = _h[1], c = _h[2], d = _h[3];
+
+    for (unsigned i = 0; i < 64; ++i)
+    {
+        uint32_t f;
+        unsigned g;
+
+        if (i < 16)
+            f = b & c | ~b & d, g = i;
+        else if (i < 32)
+            f = d & b | ~d & c, g = (5 * i + 1) % 16;
+        else if (i < 48)
+            f = b ^ c ^ d, g = (3 * i + 5) % 16;
+        else
+            f = c ^ (b | ~d), g = 7 * i % 16;
+
+        uint32_t x = a + f + K[i] + w[g];
+        unsigned r = R[i / 16 * 4 + i % 4];
+        a = d, d = c, c = b;
+        b += x << r | x >> (32 - r);
+    }
+
+    _h[0] += a, _h[1] += b, _h[2] += c, _h[3] += d;
+}
+
+void MD5::update(const char *data, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    size_t used = _size % 64;
+    _size += n;
+
+    if (used)
+    {
+        size_t len = std::min(n, 64 - used);
+        memcpy(_buf + used, p, len);
+        p += len, n -= len;
+
+        if (used + len < 64)
+            return;
+
+        _block(_buf);
+    }
+
+    for (; n >= 64; p += 64, n -= 64)
+        _block(p);
+
+    memcpy(_buf, p, n);
+}
+
+void MD5::finish(uint8_t digest[16])
+{
+    const uint64_t bits = _size * 8;
+    char pad[72] = {char(0x80)};
+    update(pad, 1 + (119 - _size % 64) % 64);
+    char len[8];
+    memcpy(len, &bits, 8);
+    update(len, 8);
+    memcpy(digest, _h, 16);
+}
+
+//what comes before the first frame
+struct StreamInfo
 {
-    BitInputStream in(&cin);
-    ostream &os = cout;
-    uint32_t magic = in.readUint(32);
-    assert(magic == 0x664c6143);
     int sampleRate = -1;
     int numChannels = -1;
     uint8_t sampleDepth = 0;
     uint64_t numSamples = 0;
+    uint8_t md5[16] = {};
+    size_t length = 4;                  //bytes up to the first frame
+    std::vector<uint64_t> seekPoints;   //SEEKTABLE frame offsets, from the first frame
+
+    //FLAC has anything from 4 to 32 bit, the WAV output whole bytes up to
+    //what the fast decoder takes: 8, 16 and 24
+    bool wavDepth() const { return sampleDepth % 8 == 0 && sampleDepth <= FastFrame::MAX_DEPTH; }
+};
+
+static StreamInfo readMetadata(BitInputStream &in)
+{
+    StreamInfo info;
+    uint32_t magic = in.readUint(32);
+    assert(magic == 0x664c6143);
 
     for (bool last = false; !last;)
     {
         last = in.readUint(1) != 0;
         uint8_t type = in.readUint(7);
         uint32_t length = in.readUint(24);
+        info.length += 4 + length;
 
         if (type == 0)
         {
@@ -425,12 +1085,35 @@ int main()
             in.readUint(16);
             in.readUint(24);
             in.readUint(24);
-            sampleRate = in.readUint(20);
-            numChannels = in.readUint(3) + 1;
-            sampleDepth = in.readUint(5) + 1;
-            numSamples = in.readUint(18) << 18 | in.readUint(18);
+            info.sampleRate = in.readUint(20);
+            info.numChannels = in.readUint(3) + 1;
+            info.sampleDepth = in.readUint(5) + 1;
+            info.numSamples = in.readUint(18) << 18 | in.readUint(18);
 
             for (int i = 0; i < 16; i++)
+                info.md5[i] = in.readUint(8);
+        }
+        else if (type == 3)
+        {
+            //sample number, offset and frame samples; readUint does not go past 32 bits
+            for (uint32_t i = 0; i + 18 <= length; i += 18)
+            {
+                uint64_t sample = 0, offset = 0;
+
+                for (int j = 0; j < 4; ++j)
+                    sample = sample << 16 | in.readUint(16);
+
+                for (int j = 0; j < 4; ++j)
+                    offset = offset << 16 | in.readUint(16);
+
+                in.readUint(16);
+
+                //placeholder points have all ones for the sample number
+                if (sample != ~uint64_t(0))
+                    info.seekPoints.push_back(offset);
+            }
+
+            for (uint32_t i = length - length % 18; i < length; ++i)
                 in.readUint(8);
         }
         else
@@ -440,31 +1123,559 @@ int main()
         }
     }
 
-    assert(sampleRate != -1);   //Stream info metadata block absent
-    assert(sampleDepth % 8 == 0);
-    uint64_t sampleDataLen = numSamples * numChannels * (sampleDepth / 8);
+    assert(info.sampleRate != -1);   //Stream info metadata block absent
+    return info;
+}
+
+static void writeHeader(ostream &os, const StreamInfo &info)
+{
+    uint64_t sampleDataLen = info.numSamples * info.numChannels * (info.sampleDepth / 8);
     os << "RIFF";
     Toolbox::writeDwLE(os, sampleDataLen + 36);
     os << "WAVE";
     os << "fmt ";
     Toolbox::writeDwLE(os, 16);
     Toolbox::writeWLE(os, 1);
-    Toolbox::writeWLE(os, numChannels);
-    Toolbox::writeDwLE(os, sampleRate);
-    Toolbox::writeDwLE(os, sampleRate * numChannels * (sampleDepth / 8));
-    Toolbox::writeWLE(os, numChannels * (sampleDepth / 8));
-    Toolbox::writeWLE(os, sampleDepth);
+    Toolbox::writeWLE(os, info.numChannels);
+    Toolbox::writeDwLE(os, info.sampleRate);
+    Toolbox::writeDwLE(os, info.sampleRate * info.numChannels * (info.sampleDepth / 8));
+    Toolbox::writeWLE(os, info.numChannels * (info.sampleDepth / 8));
+    Toolbox::writeWLE(os, info.sampleDepth);
     os << "data";
     Toolbox::writeDwLE(os, sampleDataLen);
-    Matrix<int64_t> mat(numChannels, 1);
+}
+
+//memory as a streambuf, so that a frame can be decoded from and written to it
+class MemBuf : public std::streambuf
+{
+public:
+    MemBuf(char *p, size_t n) { setg(p, p, p + n); setp(p, p + n); }
+};
+
+/*
+ * Frame boundaries in a mapped file, found without decoding. A frame
+ * starts with a sync code and a header that passes its CRC-8, and ends
+ * where the CRC-16 over everything from its sync code comes to zero,
+ * because the footer is that CRC. Only where both hold at once does the
+ * next frame start, a sync pattern inside the audio data is passed over.
+ * SEEKTABLE points are known frame starts; the stretches between them
+ * are scanned on separate threads.
+ */
+class FrameIndex
+{
+public:
+    struct Frame
+    {
+        size_t offset, length;
+        uint32_t blockSize;
+    };
+private:
+    struct Tables
+    {
+        uint8_t crc8[256];
+        uint16_t crc16[256];
+
+        Tables()
+        {
+            for (unsigned i = 0; i < 256; ++i)
+            {
+                uint8_t c8 = i;
+                uint16_t c16 = i << 8;
+
+                for (int j = 0; j < 8; ++j)
+                {
+                    c8 = c8 & 0x80 ? c8 << 1 ^ 0x07 : c8 << 1;
+                    c16 = c16 & 0x8000 ? c16 << 1 ^ 0x8005 : c16 << 1;
+                }
+
+                crc8[i] = c8, crc16[i] = c16;
+            }
+        }
+    };
+
+    static const Tables &_tables() { static const Tables tables; return tables; }
+    const uint8_t *_data;
+    size_t _len;
+    bool _scan(size_t begin, size_t end, std::vector<Frame> &frames) const;
+public:
+    FrameIndex(const uint8_t *data, size_t len) : _data(data), _len(len) { }
+    uint32_t header(size_t pos) const;
+    bool build(const std::vector<size_t> &starts, unsigned nThreads, std::vector<Frame> &frames) const;
+};
+
+//block size of the frame header at pos, 0 if there is no valid one
+uint32_t FrameIndex::header(size_t pos) const
+{
+    const uint8_t *p = _data + pos;
+    const size_t n = _len - pos;
+
+    if (pos >= _len || n < 6 || p[0] != 0xff || (p[1] & 0xfe) != 0xf8)
+        return 0;
+
+    uint8_t blockSizeCode = p[2] >> 4, sampleRateCode = p[2] & 0xf, chanAsgn = p[3] >> 4;
+
+    if (blockSizeCode == 0 || sampleRateCode == 15 || chanAsgn > 10 || (p[3] >> 1 & 7) == 3 || p[3] & 1)
+        return 0;
+
+    //frame or sample number, skipped the way FlacFrame::decode does
+    size_t i = 5;
+
+    for (uint8_t lead = p[4]; lead >= 0b11000000; lead = lead << 1 & 0xff)
+        if (i >= n || (p[i++] & 0xc0) != 0x80)
+            return 0;
+
+    uint32_t blockSize = 0;
+
+    if (blockSizeCode == 1)
+        blockSize = 192;
+    else if (2 <= blockSizeCode && blockSizeCode <= 5)
+        blockSize = 576 << (blockSizeCode - 2);
+    else if (8 <= blockSizeCode)
+        blockSize = 256 << (blockSizeCode - 8);
+
+    if (blockSizeCode == 6 || blockSizeCode == 7)
+    {
+        if (i + blockSizeCode - 5 > n)
+            return 0;
+
+        blockSize = (blockSizeCode == 6 ? p[i] : p[i] << 8 | p[i + 1]) + 1;
+        i += blockSizeCode - 5;
+    }
+
+    i += sampleRateCode == 12 ? 1 : sampleRateCode == 13 || sampleRateCode == 14 ? 2 : 0;
+
+    if (i >= n)
+        return 0;
+
+    const uint8_t *crc8 = _tables().crc8;
+    uint8_t crc = 0;
+
+    for (size_t j = 0; j < i; ++j)
+        crc = crc8[crc ^ p[j]];
+
+    return crc == p[i] ? blockSize : 0;
+}
+
+//frames from a known frame start up to end, false unless the last one ends there
+bool FrameIndex::_scan(size_t begin, size_t end, std::vector<Frame> &frames) const
+{
+    const uint16_t *crc16 = _tables().crc16;
+    uint32_t blockSize = header(begin);
+    uint16_t crc = 0;
+    size_t start = begin;
+
+    if (blockSize == 0)
+        return false;
+
+    for (size_t p = begin; p < end;)
+    {
+        crc = crc << 8 ^ crc16[crc >> 8 ^ _data[p++]];
+
+        if (crc != 0)
+            continue;
+
+        uint32_t next = p < end ? header(p) : 0;
+
+        if (p < end && next == 0)
+            continue;
+
+        frames.push_back({start, p - start, blockSize});
+        start = p, blockSize = next;
+    }
+
+    return start == end;
+}
+
+//starts are ascending frame offsets, the first one that of the first frame
+bool FrameIndex::build(const std::vector<size_t> &starts, unsigned nThreads, std::vector<Frame> &frames) const
+{
+    std::vector<std::vector<Frame>> parts(starts.size());
+    std::vector<char> ok(starts.size());
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> threads;
+
+    auto work = [&]
+    {
+        for (size_t i; (i = next++) < starts.size();)
+            ok[i] = _scan(starts[i], i + 1 < starts.size() ? starts[i + 1] : _len, parts[i]);
+    };
+
+    for (unsigned i = 1; i < std::min<size_t>(nThreads, starts.size()); ++i)
+        threads.emplace_back(work);
+
+    work();
+
+    for (std::thread &t : threads)
+        t.join();
+
+    frames.clear();
+
+    for (size_t i = 0; i < starts.size(); ++i)
+    {
+        if (!ok[i])
+            return false;
+
+        frames.insert(frames.end(), parts[i].begin(), parts[i].end());
+    }
+
+    return true;
+}
 
-    while (in.peek())
+//--verify and --stats
+struct Report
+{
+    bool verify = false, stats = false, ok = true;
+    unsigned threads = 1;
+    MD5 md5;
+    DecodeStats totals;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    void finish(const StreamInfo &info);
+};
+
+static std::string hex(const uint8_t *p, size_t n)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string ret;
+
+    for (size_t i = 0; i < n; ++i)
+        ret.push_back(digits[p[i] >> 4]), ret.push_back(digits[p[i] & 0xf]);
+
+    return ret;
+}
+
+//on stderr, ok is false when the MD5 does not match
+void Report::finish(const StreamInfo &info)
+{
+    if (verify)
     {
-        FlacFrame frame(&mat, numChannels, sampleDepth);
-        frame.decode(in);
-        frame.write(os);
+        static const uint8_t zero[16] = {};
+        uint8_t digest[16];
+        md5.finish(digest);
+        ok = memcmp(digest, info.md5, 16) == 0;
+
+        if (memcmp(info.md5, zero, 16) == 0)
+            std::cerr << "MD5: " << hex(digest, 16) << ", none in STREAMINFO\n", ok = true;
+        else if (ok)
+            std::cerr << "MD5: " << hex(digest, 16) << " OK\n";
+        else
+            std::cerr << "MD5: " << hex(digest, 16) << " MISMATCH, STREAMINFO has " << hex(info.md5, 16) << "\n";
     }
 
-    return 0;
+    if (stats)
+    {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << std::fixed << std::setprecision(3) << "subframes: " << totals.subframes[DecodeStats::CONSTANT] << " constant, "
+                  << totals.subframes[DecodeStats::VERBATIM] << " verbatim, "
+                  << totals.subframes[DecodeStats::FIXED] << " fixed, "
+                  << totals.subframes[DecodeStats::LPC] << " lpc\n";
+
+        std::cerr << "residual " << totals.residual / 1e9 << " s, prediction " << totals.prediction / 1e9
+                  << " s, output " << totals.output / 1e9 << " s";
+
+        if (verify)
+            std::cerr << ", md5 " << totals.md5 / 1e9 << " s";
+
+        if (threads > 1)
+            std::cerr << " (summed over " << threads << " threads)";
+
+        std::cerr << "\n" << totals.samples << " samples in " << seconds << " s, "
+                  << uint64_t(totals.samples / seconds) << " samples/s\n";
+    }
+}
+
+//one frame of -p into its slot
+template <bool STATS> static void decodeSlot(FastFrame &frame, const uint8_t *p, size_t n, char *dst)
+{
+    BitReader in(p, n);
+    frame.decode<STATS>(in);
+    Stopwatch<STATS> watch;
+    frame.write(dst);
+    watch.lap(frame.stats.output);
 }
 
+/*
+ * flac2wav -p file. The file is mapped and indexed, then the frames are
+ * decoded on all cores straight into their place in the output, a window
+ * of up to 16 MiB at a time. The previous window is written out while
+ * the next one is being decoded, and hashed then for --verify: 16 and 24
+ * bit output is the same bytes as the MD5 is over, 8 bit WAV is unsigned
+ * and takes the sequential path. False if the file could not be indexed
+ * or its sample depth is not supported, before anything is written.
+ */
+static bool parallel(const char *fn, ostream &os, Report &report)
+{
+    static constexpr size_t WINDOW = 1 << 24;
+    int fd = open(fn, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    const size_t len = st.st_size;
+    void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED)
+        return false;
+
+    madvise(p, len, MADV_SEQUENTIAL);
+    char *data = (char *)p;
+    MemBuf metaBuf(data, len);
+    istream metaStream(&metaBuf);
+    BitInputStream meta(&metaStream);
+    StreamInfo info = readMetadata(meta);
+
+    //8 bit WAV is unsigned, the MD5 is over signed samples
+    if (!info.wavDepth() || report.verify && info.sampleDepth == 8)
+    {
+        munmap(p, len);
+        return false;
+    }
+
+    const unsigned nThreads = std::max(1U, std::thread::hardware_concurrency());
+    FrameIndex index((const uint8_t *)data, len);
+    std::vector<size_t> starts = {info.length};
+
+    for (uint64_t point : info.seekPoints)
+        if (point < len - info.length && info.length + point > starts.back() && index.header(info.length + point))
+            starts.push_back(info.length + point);
+
+    std::vector<FrameIndex::Frame> frames;
+
+    //a seek table that does not fit the frames is ignored
+    if (!index.build(starts, nThreads, frames) && (starts.size() == 1 || !index.build({info.length}, 1, frames)))
+    {
+        munmap(p, len);
+        return false;
+    }
+
+    writeHeader(os, info);
+    const size_t frameBytes = info.numChannels * (info.sampleDepth / 8);
+    std::vector<char> window[2];
+    std::vector<DecodeStats> stats(nThreads);
+    size_t pending = 0;
+    int w = 0;
+    report.threads = nThreads;
+
+    //the previous window goes out while the workers are busy
+    auto flush = [&]
+    {
+        auto t = std::chrono::steady_clock::now();
+        os.write(window[w ^ 1].data(), pending);
+        auto t2 = std::chrono::steady_clock::now();
+
+        if (report.verify)
+            report.md5.update(window[w ^ 1].data(), pending);
+
+        if (report.stats)
+        {
+            report.totals.output += std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t).count();
+            report.totals.md5 += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - t2).count();
+        }
+    };
+
+    for (size_t i = 0; i < frames.size(); w ^= 1)
+    {
+        //slot offsets in this window
+        std::vector<size_t> at;
+        const size_t first = i;
+        size_t bytes = 0;
+
+        for (; i < frames.size() && (i == first || bytes + frames[i].blockSize * frameBytes <= WINDOW); ++i)
+            at.push_back(bytes), bytes += frames[i].blockSize * frameBytes;
+
+        window[w].resize(bytes);
+        std::atomic<size_t> next = 0;
+        std::vector<std::thread> threads;
+
+        for (unsigned t = 0; t < nThreads; ++t)
+        {
+            threads.emplace_back([&, w, t]
+            {
+                FastFrame frame(info.numChannels, info.sampleDepth);
+
+                for (size_t k; (k = next++) < at.size();)
+                {
+                    const FrameIndex::Frame &f = frames[first + k];
+                    const uint8_t *src = (const uint8_t *)data + f.offset;
+
+                    if (report.stats)
+                        decodeSlot<true>(frame, src, f.length, window[w].data() + at[k]);
+                    else
+                        decodeSlot<false>(frame, src, f.length, window[w].data() + at[k]);
+
+                    assert(frame.blockSize() == f.blockSize);
+                }
+
+                stats[t] += frame.stats;
+            });
+        }
+
+        flush();
+
+        for (std::thread &t : threads)
+            t.join();
+
+        pending = bytes;
+    }
+
+    flush();
+    munmap(p, len);
+
+    for (const DecodeStats &s : stats)
+        report.totals += s;
+
+    report.finish(info);
+    return true;
+}
+
+//stdin for the fast engine, which decodes from memory: unless the input
+//ends first there is always more buffered than the largest possible frame
+class FrameBuffer
+{
+    static constexpr size_t LOOKAHEAD = 1 << 22;
+    istream &_is;
+    std::vector<uint8_t> _buf;
+    size_t _pos = 0, _len = 0;
+public:
+    FrameBuffer(istream &is) : _is(is), _buf(LOOKAHEAD * 2) { }
+    const uint8_t *data() const { return _buf.data() + _pos; }
+    size_t size() const { return _len - _pos; }
+    void skip(size_t n) { _pos += n; }
+
+    //false at the end of the input
+    bool fill()
+    {
+        if (_len - _pos < LOOKAHEAD && _is)
+        {
+            memmove(_buf.data(), _buf.data() + _pos, _len - _pos);
+            _len -= _pos, _pos = 0;
+            _is.read((char *)_buf.data() + _len, _buf.size() - _len);
+            _len += _is.gcount();
+        }
+
+        return _pos < _len;
+    }
+};
+
+//the sequential fast path
+template <bool STATS> static void decodeStream(FrameBuffer &buf, FastFrame &frame, ostream &os,
+                                               const StreamInfo &info, Report &report)
+{
+    std::vector<char> out, pcm;
+
+    while (buf.fill())
+    {
+        BitReader in(buf.data(), buf.size());
+        frame.decode<STATS>(in);
+        buf.skip(in.position());
+        Stopwatch<STATS> watch;
+        out.resize(frame.bytes());
+        frame.write(out.data());
+        os.write(out.data(), out.size());
+        watch.lap(frame.stats.output);
+
+        if (!report.verify)
+            continue;
+
+        //16 and 24 bit output already is what the MD5 is over
+        if (info.sampleDepth != 8)
+        {
+            report.md5.update(out.data(), out.size());
+        }
+        else
+        {
+            pcm.resize(frame.bytes());
+            frame.pcm(pcm.data());
+            report.md5.update(pcm.data(), pcm.size());
+        }
+
+        watch.lap(frame.stats.md5);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool simple = false, par = false;
+    Report report;
+    int i = 1;
+
+    //-s for the simple decoder, -p file to decode frames in parallel,
+    //--verify checks the STREAMINFO MD5, --stats reports where time goes
+    for (; i < argc && argv[i][0] == '-'; ++i)
+    {
+        if (strcmp(argv[i], "-s") == 0)
+            simple = true;
+        else if (strcmp(argv[i], "-p") == 0)
+            par = true;
+        else if (strcmp(argv[i], "--verify") == 0)
+            report.verify = true;
+        else if (strcmp(argv[i], "--stats") == 0)
+            report.stats = true;
+    }
+
+    const char *fn = i < argc ? argv[i] : nullptr;
+
+    if (simple && (report.verify || report.stats))
+    {
+        std::cerr << "flac2wav: --verify and --stats are not available with -s\n";
+        return 1;
+    }
+
+    if (par && !simple && fn && parallel(fn, cout, report))
+        return report.ok ? 0 : 1;
+
+    std::ifstream ifs;
+
+    if (fn)
+        ifs.open(fn, std::ios::binary);
+
+    istream &is = fn ? ifs : cin;
+    BitInputStream in(&is);
+    ostream &os = cout;
+    StreamInfo info = readMetadata(in);
+
+    if (!info.wavDepth())
+    {
+        std::cerr << "flac2wav: " << int(info.sampleDepth) << " bit samples are not supported, only 8, 16 and 24\n";
+        return 1;
+    }
+
+    writeHeader(os, info);
+
+    if (simple)
+    {
+        Matrix<int64_t> mat(info.numChannels, 1);
+
+        while (in.peek())
+        {
+            FlacFrame frame(&mat, info.numChannels, info.sampleDepth);
+            frame.decode(in);
+            frame.write(os);
+        }
+
+        return 0;
+    }
+
+    //the metadata ends on a byte boundary, so BitInputStream holds nothing back
+    FrameBuffer buf(is);
+    FastFrame frame(info.numChannels, info.sampleDepth);
+
+    if (report.stats)
+        decodeStream<true>(buf, frame, os, info, report);
+    else
+        decodeStream<false>(buf, frame, os, info, report);
+
+    os.flush();
+    report.totals += frame.stats;
+    report.finish(info);
+    return report.ok ? 0 : 1;
+}
@@ -0,0 +1,498 @@
+//DEFLATE compressor, shared by gzip and the index of gzcat
+//
+//LZ77 with hash chains and lazy matching, dynamic Huffman blocks
+//(falling back to fixed or stored blocks when those are smaller),
+//levels 1 to 9 like zlib.
+
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <algorithm>
+#include <vector>
+#include <queue>
+#include <cstring>
+#include <cstdint>
+
+//LSB first, like BitInputStream in gzcat
+class BitOutputStream
+{
+    std::vector<uint8_t> &_out;
+    uint64_t _window = 0;
+    uint32_t _bits = 0;
+public:
+    BitOutputStream(std::vector<uint8_t> &out) : _out(out) { }
+
+    void writeBits(uint32_t value, uint8_t n)
+    {
+        _window |= uint64_t(value) << _bits, _bits += n;
+
+        for (; _bits >= 8; _bits -= 8, _window >>= 8)
+            _out.push_back(_window & 0xff);
+    }
+
+    void align() { if (_bits % 8) writeBits(0, 8 - _bits % 8); }
+    void writeBytes(const uint8_t *buf, size_t n) { _out.insert(_out.end(), buf, buf + n); }
+};
+
+class Huffman
+{
+public:
+    static uint32_t reverse(uint32_t code, uint8_t len)
+    {
+        uint32_t ret = 0;
+        for (uint8_t i = 0; i < len; ++i, code >>= 1)
+            ret = ret << 1 | code & 1;
+        return ret;
+    }
+
+    //Huffman code lengths no longer than limit, frequencies are halved until they fit
+    static void codeLengths(const uint32_t *freq, uint32_t n, uint8_t limit, uint8_t *lengths)
+    {
+        std::vector<uint32_t> f(freq, freq + n);
+
+        //a complete code needs two symbols at least
+        for (uint32_t i = 0, used = std::count_if(f.begin(), f.end(), [](uint32_t x) { return x; }); used < 2; ++i)
+            if (f[i] == 0)
+                f[i] = 1, ++used;
+
+        while (true)
+        {
+            using Node = std::pair<uint64_t, uint32_t>;
+            std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap;
+            std::vector<uint32_t> parent(2 * n, 0);
+
+            for (uint32_t i = 0; i < n; ++i)
+                if (f[i])
+                    heap.push({f[i], i});
+
+            for (uint32_t next = n; heap.size() > 1; ++next)
+            {
+                Node a = heap.top(); heap.pop();
+                Node b = heap.top(); heap.pop();
+                parent[a.second] = parent[b.second] = next;
+                heap.push({a.first + b.first, next});
+            }
+
+            uint32_t root = heap.top().second;
+            uint8_t maxLen = 0;
+
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                uint8_t len = 0;
+                for (uint32_t j = i; f[i] && j != root; j = parent[j])
+                    ++len;
+                lengths[i] = len, maxLen = std::max(maxLen, len);
+            }
+
+            if (maxLen <= limit)
+                return;
+
+            for (uint32_t &x : f)
+                x = x ? x >> 1 | 1 : 0;
+        }
+    }
+
+    //canonical codes, bit reversed for LSB first output
+    static void codes(const uint8_t *lengths, uint32_t n, uint16_t *codes)
+    {
+        for (uint32_t len = 1, next = 0; len <= 15; ++len, next <<= 1)
+            for (uint32_t i = 0; i < n; ++i)
+                if (lengths[i] == len)
+                    codes[i] = reverse(next++, len);
+    }
+};
+
+//zlib's configuration table
+struct Level
+{
+    uint16_t good, lazy, nice, chain;
+};
+
+static constexpr Level levels[10] = {
+    {0, 0, 0, 0}, {4, 0, 8, 4}, {4, 0, 16, 8}, {4, 0, 32, 32}, {4, 4, 16, 16},
+    {8, 16, 32, 32}, {8, 16, 128, 128}, {8, 32, 128, 256}, {32, 128, 258, 1024},
+    {32, 258, 258, 4096}
+};
+
+/*
+ * Compresses one chunk. The buffer holds up to 32 KB of preceding input
+ * as dictionary followed by the chunk itself. Every chunk ends on a byte
+ * boundary, with an empty stored block unless it is the final one, so
+ * chunk outputs can simply be concatenated.
+ */
+class Deflater
+{
+    static constexpr uint32_t WINDOW = 32 * 1024, HASH_BITS = 15, MAX_TOKENS = 16 * 1024;
+    static constexpr uint32_t MIN_MATCH = 3, MAX_MATCH = 258, TOO_FAR = 4096;
+    const Level &_level;
+    const uint8_t *_buf = nullptr;
+    uint32_t _len = 0;
+    std::vector<int32_t> _head, _prev;
+    std::vector<uint32_t> _tokens;
+    uint8_t _lengthCode[MAX_MATCH + 1];
+    uint16_t _lengthBase[29], _distBase[30];
+    uint8_t _lengthExtra[29], _distExtra[30];
+    uint8_t _fixedLitLen[288], _fixedDist[30];
+
+    static uint32_t _hash(const uint8_t *p)
+    { return (p[0] << 16 | p[1] << 8 | p[2]) * 2654435761U >> 32 - HASH_BITS; }
+
+    void _insert(uint32_t pos);
+    uint32_t _match(uint32_t pos, uint32_t prevLen, uint32_t &dist);
+    uint8_t _distCode(uint32_t dist) const;
+    void _flushBlock(BitOutputStream &bos, uint32_t start, uint32_t end, bool final);
+    void _writeTokens(BitOutputStream &bos, const uint8_t *litLenLengths, const uint8_t *distLengths);
+public:
+    Deflater(const Level &level);
+    void compress(const uint8_t *buf, uint32_t dictLen, uint32_t len, bool final, std::vector<uint8_t> &out);
+};
+
+Deflater::Deflater(const Level &level) : _level(level)
+{
+    for (uint32_t code = 0, len = 3; code < 28; ++code)
+    {
+        _lengthExtra[code] = code < 8 ? 0 : (code - 4) / 4;
+        _lengthBase[code] = len;
+        for (uint32_t i = 0; i < 1U << _lengthExtra[code]; ++i)
+            _lengthCode[len++] = code;
+    }
+
+    _lengthExtra[28] = 0, _lengthBase[28] = 258, _lengthCode[258] = 28;
+
+    for (uint32_t code = 0, dist = 1; code < 30; ++code)
+    {
+        _distExtra[code] = code < 4 ? 0 : code / 2 - 1;
+        _distBase[code] = dist;
+        dist += 1 << _distExtra[code];
+    }
+
+    std::fill(_fixedLitLen,       _fixedLitLen + 144, 8);
+    std::fill(_fixedLitLen + 144, _fixedLitLen + 256, 9);
+    std::fill(_fixedLitLen + 256, _fixedLitLen + 280, 7);
+    std::fill(_fixedLitLen + 280, _fixedLitLen + 288, 8);
+    std::fill(_fixedDist, _fixedDist + 30, 5);
+}
+
+uint8_t Deflater::_distCode(uint32_t dist) const
+{
+    uint32_t d = dist - 1;
+
+    if (d < 4)
+        return d;
+
+    uint32_t n = 31 - __builtin_clz(d);
+    return 2 * n + (d >> n - 1 & 1);
+}
+
+void Deflater::_insert(uint32_t pos)
+{
+    if (pos + MIN_MATCH > _len)
+        return;
+
+    int32_t &head = _head[_hash(_buf + pos)];
+    _prev[pos] = head;
+    head = pos;
+}
+
+//longest match for pos among earlier positions with the same hash
+uint32_t Deflater::_match(uint32_t pos, uint32_t prevLen, uint32_t &dist)
+{
+    uint32_t maxLen = std::min(MAX_MATCH, _len - pos), bestLen = prevLen;
+    uint32_t chain = prevLen >= _level.good ? _level.chain >> 2 : _level.chain;
+
+    if (maxLen < MIN_MATCH || bestLen >= maxLen)
+        return 0;
+
+    const uint8_t *cur = _buf + pos;
+
+    for (int32_t cand = _prev[pos]; cand >= 0 && pos - cand <= WINDOW && chain--; cand = _prev[cand])
+    {
+        const uint8_t *p = _buf + cand;
+
+        if (p[bestLen] != cur[bestLen] || p[0] != cur[0] || p[1] != cur[1])
+            continue;
+
+        uint32_t len = 0;
+
+        while (len + 8 <= maxLen)
+        {
+            uint64_t a, b;
+            memcpy(&a, p + len, 8), memcpy(&b, cur + len, 8);
+
+            if (a != b)
+            {
+                len += __builtin_ctzll(a ^ b) / 8;
+                break;
+            }
+
+            len += 8;
+        }
+
+        if (len + 8 > maxLen)
+            while (len < maxLen && p[len] == cur[len])
+                ++len;
+
+        if (len > bestLen)
+        {
+            bestLen = len, dist = pos - cand;
+
+            if (len >= _level.nice || len == maxLen)
+                break;
+        }
+    }
+
+    if (bestLen == prevLen)
+        return 0;
+
+    if (bestLen == MIN_MATCH && dist > TOO_FAR)
+        return 0;
+
+    return bestLen;
+}
+
+void Deflater::_writeTokens(BitOutputStream &bos, const uint8_t *litLenLengths, const uint8_t *distLengths)
+{
+    uint16_t litLenCodes[288], distCodes[30];
+    Huffman::codes(litLenLengths, 288, litLenCodes);
+    Huffman::codes(distLengths, 30, distCodes);
+
+    for (uint32_t token : _tokens)
+    {
+        if ((token & 0x80000000) == 0)
+        {
+            bos.writeBits(litLenCodes[token], litLenLengths[token]);
+            continue;
+        }
+
+        uint32_t len = (token >> 16 & 0x1ff) + MIN_MATCH, dist = (token & 0xffff) + 1;
+        uint8_t lc = _lengthCode[len], dc = _distCode(dist);
+        bos.writeBits(litLenCodes[257 + lc], litLenLengths[257 + lc]);
+        bos.writeBits(len - _lengthBase[lc], _lengthExtra[lc]);
+        bos.writeBits(distCodes[dc], distLengths[dc]);
+        bos.writeBits(dist - _distBase[dc], _distExtra[dc]);
+    }
+
+    bos.writeBits(litLenCodes[256], litLenLengths[256]);
+}
+
+//emit the pending tokens as whichever block type is smallest
+void Deflater::_flushBlock(BitOutputStream &bos, uint32_t start, uint32_t end, bool final)
+{
+    uint32_t litLenFreq[286] = {0}, distFreq[30] = {0};
+    uint64_t extraBits = 0;
+
+    for (uint32_t token : _tokens)
+    {
+        if ((token & 0x80000000) == 0)
+        {
+            ++litLenFreq[token];
+            continue;
+        }
+
+        uint32_t len = (token >> 16 & 0x1ff) + MIN_MATCH, dist = (token & 0xffff) + 1;
+        uint8_t lc = _lengthCode[len], dc = _distCode(dist);
+        ++litLenFreq[257 + lc], ++distFreq[dc];
+        extraBits += _lengthExtra[lc] + _distExtra[dc];
+    }
+
+    litLenFreq[256] = 1;
+    uint8_t litLenLengths[288] = {0}, distLengths[30] = {0};
+    Huffman::codeLengths(litLenFreq, 286, 15, litLenLengths);
+    Huffman::codeLengths(distFreq, 30, 15, distLengths);
+    uint32_t hlit = 286, hdist = 30;
+
+    while (hlit > 257 && litLenLengths[hlit - 1] == 0)
+        --hlit;
+
+    while (hdist > 1 && distLengths[hdist - 1] == 0)
+        --hdist;
+
+    //run length encode the code lengths, symbol | extra value << 8
+    uint8_t all[286 + 30];
+    std::copy(litLenLengths, litLenLengths + hlit, all);
+    std::copy(distLengths, distLengths + hdist, all + hlit);
+    std::vector<uint32_t> rle;
+    uint32_t codeLenFreq[19] = {0};
+
+    for (uint32_t i = 0, n = hlit + hdist; i < n;)
+    {
+        uint32_t run = 1;
+
+        while (i + run < n && all[i + run] == all[i])
+            ++run;
+
+        if (all[i] == 0 && run >= 11)
+            run = std::min(run, 138U), rle.push_back(18 | run - 11 << 8);
+        else if (all[i] == 0 && run >= 3)
+            rle.push_back(17 | run - 3 << 8);
+        else if (all[i] != 0 && run >= 4)
+            run = std::min(run, 7U), rle.push_back(all[i]), rle.push_back(16 | run - 4 << 8);
+        else
+            run = 1, rle.push_back(all[i]);
+
+        i += run;
+    }
+
+    for (uint32_t r : rle)
+        ++codeLenFreq[r & 0xff];
+
+    uint8_t codeLenLengths[19] = {0};
+    Huffman::codeLengths(codeLenFreq, 19, 7, codeLenLengths);
+    static constexpr uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    uint32_t hclen = 19;
+
+    while (hclen > 4 && codeLenLengths[order[hclen - 1]] == 0)
+        --hclen;
+
+    uint64_t dynamicBits = 17 + 3 * hclen + extraBits, fixedBits = 3 + extraBits;
+
+    for (uint32_t r : rle)
+    {
+        uint32_t sym = r & 0xff;
+        dynamicBits += codeLenLengths[sym] + (sym == 16 ? 2 : sym == 17 ? 3 : sym == 18 ? 7 : 0);
+    }
+
+    for (uint32_t i = 0; i < 286; ++i)
+        dynamicBits += uint64_t(litLenFreq[i]) * litLenLengths[i], fixedBits += uint64_t(litLenFreq[i]) * _fixedLitLen[i];
+
+    for (uint32_t i = 0; i < 30; ++i)
+        dynamicBits += uint64_t(distFreq[i]) * distLengths[i], fixedBits += uint64_t(distFreq[i]) * _fixedDist[i];
+
+    uint64_t storedBits = (end - start + 5 * ((end - start) / 65535 + 1)) * 8 + 10;
+
+    if (storedBits < dynamicBits && storedBits < fixedBits)
+    {
+        for (uint32_t pos = start; true;)
+        {
+            uint32_t n = std::min(end - pos, 65535U);
+            bool last = pos + n == end;
+            bos.writeBits(final && last, 1);
+            bos.writeBits(0, 2);
+            bos.align();
+            bos.writeBits(n, 16);
+            bos.writeBits(n ^ 0xffff, 16);
+            bos.writeBytes(_buf + pos, n);
+            pos += n;
+
+            if (last)
+                break;
+        }
+    }
+    else if (fixedBits <= dynamicBits)
+    {
+        bos.writeBits(final, 1);
+        bos.writeBits(1, 2);
+        _writeTokens(bos, _fixedLitLen, _fixedDist);
+    }
+    else
+    {
+        bos.writeBits(final, 1);
+        bos.writeBits(2, 2);
+        bos.writeBits(hlit - 257, 5);
+        bos.writeBits(hdist - 1, 5);
+        bos.writeBits(hclen - 4, 4);
+
+        for (uint32_t i = 0; i < hclen; ++i)
+            bos.writeBits(codeLenLengths[order[i]], 3);
+
+        uint16_t codeLenCodes[19];
+        Huffman::codes(codeLenLengths, 19, codeLenCodes);
+
+        for (uint32_t r : rle)
+        {
+            uint32_t sym = r & 0xff;
+            bos.writeBits(codeLenCodes[sym], codeLenLengths[sym]);
+
+            if (sym >= 16)
+                bos.writeBits(r >> 8, sym == 16 ? 2 : sym == 17 ? 3 : 7);
+        }
+
+        _writeTokens(bos, litLenLengths, distLengths);
+    }
+
+    _tokens.clear();
+}
+
+void Deflater::compress(const uint8_t *buf, uint32_t dictLen, uint32_t len, bool final, std::vector<uint8_t> &out)
+{
+    _buf = buf, _len = dictLen + len;
+    _head.assign(1 << HASH_BITS, -1);
+    _prev.resize(_len);
+    BitOutputStream bos(out);
+
+    for (uint32_t pos = 0; pos < dictLen; ++pos)
+        _insert(pos);
+
+    uint32_t blockStart = dictLen, prevLen = 0, prevDist = 0;
+    bool pending = false;
+
+    for (uint32_t pos = dictLen; pos < _len;)
+    {
+        if (_tokens.size() >= MAX_TOKENS)
+        {
+            uint32_t end = pending ? pos - 1 : pos;
+            _flushBlock(bos, blockStart, end, false);
+            blockStart = end;
+        }
+
+        _insert(pos);
+        uint32_t dist = 0, curLen = 0;
+
+        //without lazy matching the match search starts from scratch
+        if (_level.lazy == 0)
+        {
+            curLen = _match(pos, MIN_MATCH - 1, dist);
+
+            if (curLen)
+            {
+                _tokens.push_back(0x80000000 | curLen - MIN_MATCH << 16 | dist - 1);
+                for (uint32_t i = 1; i < curLen; ++i)
+                    _insert(pos + i);
+                pos += curLen;
+            }
+            else
+            {
+                _tokens.push_back(_buf[pos++]);
+            }
+
+            continue;
+        }
+
+        if (prevLen < _level.lazy)
+            curLen = _match(pos, std::max(prevLen, MIN_MATCH - 1), dist);
+
+        //the match at pos - 1 wins, emit it and skip over it
+        if (prevLen >= MIN_MATCH && curLen <= prevLen)
+        {
+            _tokens.push_back(0x80000000 | prevLen - MIN_MATCH << 16 | prevDist - 1);
+
+            for (uint32_t i = pos + 1; i < pos - 1 + prevLen; ++i)
+                _insert(i);
+
+            pos += prevLen - 1, prevLen = 0, pending = false;
+            continue;
+        }
+
+        if (pending)
+            _tokens.push_back(_buf[pos - 1]);
+
+        pending = true, prevLen = curLen, prevDist = dist, ++pos;
+    }
+
+    if (pending)
+        _tokens.push_back(_buf[_len - 1]);
+
+    _flushBlock(bos, blockStart, _len, final);
+
+    if (!final)
+    {
+        bos.writeBits(0, 3);
+        bos.align();
+        bos.writeBits(0, 16);
+        bos.writeBits(0xffff, 16);
+    }
+
+    bos.align();
+}
+
+#endif
@@ -8,11 +8,24 @@
 
 // adapted by Jasper ter Weeme
 
+#include "crc32.h"
+#include "deflate.h"
 #include <bitset>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <cstring>
 #include <cstdint>
-#include <cassert>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 class Toolbox
 {
@@ -33,145 +46,304 @@ public:
 
 class BitInputStream
 {
+    static constexpr size_t BUFSIZE = 64 * 1024;
     std::istream &_is;
-    uint32_t _bits = 0, _window = 0;
+    uint8_t _buf[BUFSIZE];
+    size_t _pos = 0, _len = 0;
+    uint64_t _window = 0, _total = 0;
+    uint32_t _bits = 0, _padded = 0;
+
+    void _read(size_t offset)
+    {
+        _is.read((char *)_buf + offset, BUFSIZE - offset);
+        _len = offset + _is.gcount();
+        _total += _is.gcount();
+    }
+
+    //keep the window at 56 bits or more, past the end of input zeros are fed,
+    //for peeking only, skipBits throws when any of them are consumed
+    void _fill()
+    {
+        _window &= (uint64_t(1) << _bits) - 1;
+
+        if (_len - _pos < 8)
+        {
+            std::copy(_buf + _pos, _buf + _len, _buf);
+            _len -= _pos, _pos = 0;
+            _read(_len);
+        }
+
+        if (_len - _pos >= 8)
+        {
+            uint64_t word = 0;
+            for (int i = 7; i >= 0; --i)
+                word = word << 8 | _buf[_pos + i];
+            _window |= word << _bits;
+            _pos += 63 - _bits >> 3;
+            _bits |= 56;
+            return;
+        }
+
+        for (; _bits <= 56; _bits += 8)
+            if (_pos < _len)
+                _window |= uint64_t(_buf[_pos++]) << _bits;
+            else
+                _padded += 8;
+    }
 public:
     BitInputStream(std::istream &is) : _is(is) { }
 
-    uint32_t readBits(uint8_t n)
+    uint32_t peekBits(uint8_t n)
     {
-        for (; _bits < n; _bits += 8)
-            _window = _window | _is.get() << _bits;
-
-        uint32_t ret = _window & (1 << n) - 1;
-        _window = _window >> n, _bits -= n;
-        return ret;
+        if (_bits < n)
+            _fill();
+        return _window & (uint64_t(1) << n) - 1;
     }
 
-    void align() { readBits(_bits); }
+    void skipBits(uint8_t n)
+    {
+        _window >>= n, _bits -= n;
 
-    std::string readNullTerminatedString()
+        if (_bits < _padded)
+            throw std::runtime_error("Unexpected end of input");
+    }
+
+    uint32_t readBits(uint8_t n)
     {
-        std::string ret;
-        for (char c; (c = readBits(8)) != 0;)
-            ret.push_back(c);
+        uint32_t ret = peekBits(n);
+        skipBits(n);
         return ret;
     }
-};
 
-class CRC32
-{
-    uint32_t _table[256];
-    uint32_t _crc = 0xffffffff;
-public:
-    void update(char c) { _crc = _table[(_crc ^ c) & 0xff] ^ _crc >> 8; }
-    uint32_t crc() const { return ~_crc; }
+    void align() { skipBits(_bits % 8); }
+
+    //bit offset in the input of the next unread bit
+    uint64_t tellBits() const { return (_total - (_len - _pos)) * 8 - (_bits - std::min(_bits, _padded)); }
+
+    //byte offset in the input of the next unread byte, the stream must be aligned
+    uint64_t tell() const { return tellBits() / 8; }
+
+    //true when nothing but padding is left, the stream must be aligned
+    bool atEnd()
+    {
+        if (_bits > _padded || _pos < _len)
+            return false;
 
-    CRC32()
+        _pos = 0;
+        _read(0);
+        return _len == 0;
+    }
+
+    //copy whole bytes, the stream must be aligned
+    void readBytes(uint8_t *dst, size_t n)
     {
-        for (uint32_t n = 0; n < 256; ++n)
+        for (; n && _bits; --n)
+            *dst++ = readBits(8);
+
+        for (size_t len; n; n -= len, dst += len)
         {
-            uint32_t c = n;
-            for (uint32_t k = 0; k < 8; ++k)
-                c = c & 1 ? 0xedb88320 ^ c >> 1 : c >> 1;
-            _table[n] = c;
+            if (_pos == _len)
+            {
+                _pos = 0;
+                _read(0);
+
+                if (_len == 0)
+                    throw std::runtime_error("Unexpected end of input");
+            }
+
+            len = std::min(n, _len - _pos);
+            std::copy(_buf + _pos, _buf + _pos + len, dst);
+            _pos += len;
         }
     }
+
+    std::string readNullTerminatedString()
+    {
+        std::string ret;
+        for (char c; (c = readBits(8)) != 0;)
+            ret.push_back(c);
+        return ret;
+    }
 };
 
 class CRCOutputStream
 {
     std::ostream &_os;
     CRC32 _crc;
-    uint32_t _cnt = 0;
+    uint64_t _cnt = 0;
 public:
     CRCOutputStream(std::ostream &os) : _os(os) { }
+    void reset() { _crc = CRC32(), _cnt = 0; }
     uint32_t crc() const { return _crc.crc(); }
-    uint32_t cnt() const { return _cnt; }
-    void put(uint8_t b) { _os.put(b); ++_cnt; _crc.update(b); }
+    uint64_t cnt() const { return _cnt; }
+
+    void write(const uint8_t *buf, size_t n)
+    {
+        _os.write((const char *)buf, n);
+        _cnt += n;
+        _crc.update(buf, n);
+    }
 };
 
+/*
+ * Two level decoding table, indexed by the next bits of the (LSB first) stream.
+ * An entry is symbol << 8 | code length, or offset << 8 | 0x80 | bits for
+ * codes longer than PRIMARY_BITS, pointing at a second level table.
+ * Zero marks a bit pattern that is not a code.
+ */
 class CanonicalCode final
 {
-    uint32_t *_symbolCodeBits = nullptr, *_symbolValues = nullptr;
-    uint32_t _numSymbolsAllocated = 0;
+    static constexpr uint32_t PRIMARY_BITS = 9;
+    std::vector<uint32_t> _table = std::vector<uint32_t>(1 << PRIMARY_BITS);
 public:
-    ~CanonicalCode();
-    void init(uint32_t *codeLengths, uint32_t n);
+    void init(const uint32_t *codeLengths, uint32_t n);
     uint32_t decodeNextSymbol(BitInputStream &in) const;
 };
 
-CanonicalCode::~CanonicalCode()
+void CanonicalCode::init(const uint32_t *codeLengths, uint32_t n)
 {
-    if (_symbolCodeBits)
-        delete[] _symbolCodeBits;
-    
-    if (_symbolValues)
-        delete[] _symbolValues;
-}
-
-void CanonicalCode::init(uint32_t *codeLengths, uint32_t n)
-{
-    _symbolCodeBits = new uint32_t[n];
-    _symbolValues = new uint32_t[n];
+    uint32_t maxLen = *std::max_element(codeLengths, codeLengths + n);
+    uint32_t subBits = maxLen > PRIMARY_BITS ? maxLen - PRIMARY_BITS : 0;
+    _table.assign(1 << PRIMARY_BITS, 0);
 
     for (uint32_t codeLength = 1, nextCode = 0; codeLength <= 15; ++codeLength)
     {
         nextCode <<= 1;
-        uint32_t startBit = 1 << codeLength;
+
         for (uint32_t symbol = 0; symbol < n; ++symbol)
         {
             if (codeLengths[symbol] != codeLength)
                 continue;
-            _symbolCodeBits[_numSymbolsAllocated] = startBit | nextCode;
-            _symbolValues[_numSymbolsAllocated] = symbol;
-            ++_numSymbolsAllocated;
-            ++nextCode;
+
+            uint32_t rev = 0;
+            for (uint32_t i = 0, code = nextCode++; i < codeLength; ++i, code >>= 1)
+                rev = rev << 1 | code & 1;
+
+            if (codeLength <= PRIMARY_BITS)
+            {
+                for (uint32_t k = rev; k < 1 << PRIMARY_BITS; k += 1 << codeLength)
+                    _table[k] = symbol << 8 | codeLength;
+                continue;
+            }
+
+            uint32_t primary = rev & (1 << PRIMARY_BITS) - 1;
+
+            if (_table[primary] == 0)
+            {
+                _table[primary] = _table.size() << 8 | 0x80 | subBits;
+                _table.resize(_table.size() + (1 << subBits));
+            }
+
+            uint32_t offset = _table[primary] >> 8;
+            for (uint32_t k = rev >> PRIMARY_BITS; k < 1U << subBits; k += 1 << codeLength - PRIMARY_BITS)
+                _table[offset + k] = symbol << 8 | codeLength;
         }
     }
 }
 
 uint32_t CanonicalCode::decodeNextSymbol(BitInputStream &in) const
 {
-    for (uint32_t code = 1; true;)
-    {
-        code = code << 1 | in.readBits(1);
-        auto x = std::lower_bound(_symbolCodeBits, _symbolCodeBits + _numSymbolsAllocated, code);
+    uint32_t bits = in.peekBits(15);
+    uint32_t entry = _table[bits & (1 << PRIMARY_BITS) - 1];
 
-        if (*x == code)
-            return _symbolValues[std::distance(_symbolCodeBits, x)];
-    }
+    if (entry & 0x80)
+        entry = _table[(entry >> 8) + (bits >> PRIMARY_BITS & (1 << (entry & 0x7f)) - 1)];
+
+    if (entry == 0)
+        throw std::domain_error("Invalid Huffman code");
+
+    in.skipBits(entry & 0x7f);
+    return entry >> 8;
 }
 
+/*
+ * Flat output window: the last 32 KB always sit directly in front of the
+ * write position, so back references never wrap. Output is passed on to
+ * the CRC stream in blocks of BLOCK bytes.
+ */
 class ByteHistory
 {
+    static constexpr size_t WINDOW = 32 * 1024, BLOCK = 256 * 1024, SLACK = 8;
     uint8_t *_data;
-    size_t _index = 0, _length = 0, _size;
+    size_t _pos = 0, _flushed = 0;
+    CRCOutputStream &_out;
+
+    void _slide()
+    {
+        flush();
+        std::copy(_data + _pos - WINDOW, _data + _pos, _data);
+        _pos = _flushed = WINDOW;
+    }
 public:
-    ByteHistory(size_t size) : _size(size) { _data = new uint8_t[size]; }
+    ByteHistory(CRCOutputStream &out) : _data(new uint8_t[WINDOW + BLOCK + SLACK]), _out(out) { }
     ~ByteHistory() { delete[] _data; }
 
-    void append(uint8_t b)
+    //make room for at least n more bytes
+    uint8_t *reserve(size_t n)
     {
-        _data[_index] = b;
-        _index = (_index + 1) % _size;
-        if (_length < _size)
-            ++_length;
+        if (_pos + n > WINDOW + BLOCK)
+            _slide();
+        return _data + _pos;
     }
 
-    void copy(int dist, int len, CRCOutputStream &out)
+    void commit(size_t n) { _pos += n; }
+    void append(uint8_t b) { *reserve(1) = b; ++_pos; }
+
+    void copy(uint32_t dist, uint32_t len)
     {
-        size_t readIndex = (_index - dist + _size) % _size;
-        for (int i = 0; i < len; ++i)
-        {
-            uint8_t b = _data[readIndex];
-            readIndex = (readIndex + 1) % _size;
-            out.put(char(b));
-            append(b);
-        }
+        uint8_t *dst = reserve(len);
+
+        if (dist > _pos)
+            throw std::domain_error("Distance too far back");
+
+        const uint8_t *src = dst - dist;
+        _pos += len;
+
+        //words may run up to 7 bytes past the end, into the slack
+        if (dist >= 8)
+            for (uint32_t i = 0; i < len; i += 8)
+                memcpy(dst + i, src + i, 8);
+        else if (dist == 1)
+            memset(dst, *src, len);
+        else
+            for (uint32_t i = 0; i < len; ++i)
+                dst[i] = src[i];
+    }
+
+    void flush()
+    {
+        _out.write(_data + _flushed, _pos - _flushed);
+        _flushed = _pos;
+    }
+
+    //start a new member, back references cannot reach into the previous one
+    void reset() { flush(); _pos = _flushed = 0; }
+
+    size_t pending() const { return _pos - _flushed; }
+
+    //the history that back references can currently reach
+    std::vector<uint8_t> window() const
+    {
+        size_t n = std::min(_pos, WINDOW);
+        return std::vector<uint8_t>(_data + _pos - n, _data + _pos);
+    }
+
+    //restore a saved window, none of it is output again
+    void prime(const std::vector<uint8_t> &window)
+    {
+        reset();
+        std::copy(window.begin(), window.end(), _data);
+        _pos = _flushed = window.size();
     }
 };
 
+//a point where decoding can resume: the start of a deflate block
+struct Checkpoint
+{
+    uint64_t out, bits;
+    std::vector<uint8_t> window;
+};
+
 class Inflater
 {
     BitInputStream _bis;
@@ -180,17 +352,27 @@ class Inflater
     ByteHistory _dictionary;
     CanonicalCode _fixedLiteralLengthCode;
     CanonicalCode _fixedDistanceCode;
+    std::vector<Checkpoint> *_index = nullptr;
+    uint64_t _span = 0, _base = 0, _limit = UINT64_MAX;
+    uint64_t _produced() const { return _base + _os.cnt() + _dictionary.pending(); }
     void decodeHuffmanCodes(CanonicalCode &litLenCode, CanonicalCode &distCode);
     void inflateUncompressedBlock();
     void inflateHuffmanBlock(const CanonicalCode &litLenCode, const CanonicalCode &distCode);
+    void inflateBlocks();
+    bool _nextMember();
 public:
     Inflater(std::istream &is, std::ostream &os, std::ostream &msg);
+    uint64_t tell() const { return _bis.tell(); }
+    void inflateMember();
+    void inflateRaw();
     void inflate();
+    void buildIndex(std::vector<Checkpoint> &index, uint64_t span);
+    void resume(const Checkpoint &checkpoint, uint64_t limit);
 };
 
 Inflater::Inflater(std::istream &is, std::ostream &os, std::ostream &msg)
   :
-    _bis(is), _os(os), _msg(msg), _dictionary(32 * 1024)
+    _bis(is), _os(os), _msg(msg), _dictionary(_os)
 {
     uint32_t llcodelens[288], distcodelens[32];
     std::fill(llcodelens,       llcodelens + 144, 8);
@@ -229,9 +411,14 @@ void Inflater::decodeHuffmanCodes(CanonicalCode &litLenCode, CanonicalCode &dist
             codeLens[i++] = sym;
             continue;
         }
-        int runLen, runVal = 0;
+        uint32_t runLen;
+        int runVal = 0;
         if (sym == 16)
+        {
+            if (i == 0)
+                throw std::domain_error("No code length value to copy");
             runLen = _bis.readBits(2) + 3, runVal = codeLens[i - 1];
+        }
         else if (sym == 17)
             runLen = _bis.readBits(3) + 3;
         else if (sym == 18)
@@ -239,6 +426,9 @@ void Inflater::decodeHuffmanCodes(CanonicalCode &litLenCode, CanonicalCode &dist
         else
             throw std::logic_error("Symbol out of range");
 
+        if (runLen > nCodeLens - i)
+            throw std::domain_error("Run exceeds number of codes");
+
         std::fill(codeLens + i, codeLens + i + runLen, runVal);
         i += runLen;
     }
@@ -277,15 +467,11 @@ void Inflater::inflateUncompressedBlock()
     _bis.align();
     const uint16_t len = _bis.readBits(16);
     const uint16_t nlen = _bis.readBits(16);
-    assert(len ^ 0xffff == nlen);
+    if ((len ^ 0xffff) != nlen)
+        throw std::domain_error("Stored block length mismatch");
     
-    // Copy bytes
-    for (uint16_t i = 0; i < len; ++i)
-    {
-        uint8_t b = _bis.readBits(8);  // Byte is aligned
-        _os.put(b);
-        _dictionary.append(b);
-    }
+    _bis.readBytes(_dictionary.reserve(len), len);
+    _dictionary.commit(len);
 }
 
 void Inflater::inflateHuffmanBlock(const CanonicalCode &litLenCode, const CanonicalCode &distCode)
@@ -294,7 +480,6 @@ void Inflater::inflateHuffmanBlock(const CanonicalCode &litLenCode, const Canoni
     {
         if (sym < 256)
         {
-            _os.put(sym);
             _dictionary.append(sym);
             continue;
         }
@@ -325,14 +510,57 @@ void Inflater::inflateHuffmanBlock(const CanonicalCode &litLenCode, const Canoni
         else
             throw std::domain_error("Reserved distance symbol");
 
-        _dictionary.copy(dist, run, _os);
+        _dictionary.copy(dist, run);
     }
 }
 
-void Inflater::inflate()
+//record a checkpoint at the first block after every span bytes of output
+void Inflater::inflateBlocks()
 {
-    assert(_bis.readBits(16) == 0x8b1f);
-    assert(_bis.readBits(8) == 8);  //only support method 8
+    for (bool isFinal = false; !isFinal && _produced() < _limit;)
+    {
+        if (_index && (_index->empty() || _produced() - _index->back().out >= _span))
+            _index->push_back({_produced(), _bis.tellBits(), _dictionary.window()});
+
+        isFinal = _bis.readBits(1) != 0;
+
+        switch (_bis.readBits(2))
+        {
+        case 0:
+            inflateUncompressedBlock();
+            break;
+        case 1:
+            inflateHuffmanBlock(_fixedLiteralLengthCode, _fixedDistanceCode);
+            break;
+        case 2:
+        {
+            CanonicalCode litLen, dist;
+            decodeHuffmanCodes(litLen, dist);
+            inflateHuffmanBlock(litLen, dist);
+        }
+            break;
+        case 3:
+            throw std::domain_error("Reserved block type");
+        default:
+            throw std::logic_error("Unreachable value");
+        }
+    }
+
+    _dictionary.flush();
+}
+
+void Inflater::inflateMember()
+{
+    _base = _produced();
+    _os.reset();
+    _dictionary.reset();
+
+    if (_bis.readBits(16) != 0x8b1f)
+        throw std::runtime_error("Not in gzip format");
+
+    if (_bis.readBits(8) != 8)  //only support method 8
+        throw std::runtime_error("Unknown compression method");
+
     std::bitset<8> flags = _bis.readBits(8);
     uint32_t mtime = _bis.readBits(32);
 
@@ -364,45 +592,604 @@ void Inflater::inflate()
         _msg << "16bit CRC present\r\n";
     }
 
-    for (bool isFinal = false; !isFinal;)
+    inflateBlocks();
+
+    if (_produced() >= _limit)
+        return;
+
+    _bis.align();
+    uint32_t crc = _bis.readBits(32);
+    uint32_t size = _bis.readBits(32);
+    _msg << "CRC: 0x" << Toolbox::hex32(crc) << " 0x" << Toolbox::hex32(_os.crc()) << "\r\n";
+    _msg << "size: " << size << " " << _os.cnt() << "\r\n";
+
+    if (crc != _os.crc() || size != uint32_t(_os.cnt()))
+        throw std::runtime_error("CRC or size mismatch");
+}
+
+//a bare deflate stream without gzip framing, as the index stores windows
+void Inflater::inflateRaw()
+{
+    _base = _produced();
+    _os.reset();
+    _dictionary.reset();
+    inflateBlocks();
+}
+
+//whether another member follows, like gzip whatever else follows the last
+//member is ignored, with the same warning as -p
+bool Inflater::_nextMember()
+{
+    if (_bis.atEnd() || _produced() >= _limit)
+        return false;
+
+    if (_bis.peekBits(16) == 0x8b1f)
+        return true;
+
+    std::cerr << "gzcat: trailing garbage ignored\n";
+    return false;
+}
+
+//a gzip file may hold several concatenated members
+void Inflater::inflate()
+{
+    do
+        inflateMember();
+    while (_nextMember());
+}
+
+void Inflater::buildIndex(std::vector<Checkpoint> &index, uint64_t span)
+{
+    _index = &index, _span = span;
+    inflate();
+    _index = nullptr;
+}
+
+/*
+ * Continue from a checkpoint until at least limit bytes of total output are
+ * produced. The input stream must be positioned at the byte holding the
+ * checkpoint bit. The CRC of the member we start in cannot be checked.
+ */
+void Inflater::resume(const Checkpoint &checkpoint, uint64_t limit)
+{
+    _bis.readBits(checkpoint.bits % 8);
+    _dictionary.prime(checkpoint.window);
+    _os.reset();
+    _base = checkpoint.out, _limit = limit;
+    inflateBlocks();
+
+    if (_produced() >= _limit)
+        return;
+
+    _bis.align();
+    _bis.readBits(32);
+    _bis.readBits(32);
+
+    while (_nextMember())
+        inflateMember();
+}
+
+class NullBuf : public std::streambuf { public: int overflow(int c) override { return c; } };
+
+//read straight from memory without copying
+class MemoryBuf : public std::streambuf
+{
+public:
+    MemoryBuf(const uint8_t *buf, size_t len) { char *p = (char *)buf; setg(p, p, p + len); }
+};
+
+//thrown by SpeculativeBuf to give up on a member
+struct Abandoned { };
+
+//collects the output of a member decoded ahead of the writer, up to a limit,
+//and gives up once the writer has moved past the start of the member
+class SpeculativeBuf : public std::streambuf
+{
+    std::vector<uint8_t> _data;
+    const std::atomic<uint64_t> &_head;
+    uint64_t _pos;
+    size_t _limit;
+
+    void _check()
+    {
+        if (_data.size() > _limit || _head.load(std::memory_order_relaxed) > _pos)
+            throw Abandoned();
+    }
+public:
+    SpeculativeBuf(const std::atomic<uint64_t> &head, uint64_t pos, size_t limit)
+      : _head(head), _pos(pos), _limit(limit) { }
+
+    std::vector<uint8_t> &data() { return _data; }
+
+    int overflow(int c) override
     {
-        isFinal = _bis.readBits(1) != 0;
+        if (c != EOF)
+            _data.push_back(c), _check();
+        return c;
+    }
 
-        switch (_bis.readBits(2))
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        _data.insert(_data.end(), s, s + n);
+        _check();
+        return n;
+    }
+};
+
+//passes the member the writer inflates itself straight on, and tells the
+//workers how far its input has got
+class HeadBuf : public std::streambuf
+{
+    std::ostream &_os;
+    std::atomic<uint64_t> &_head;
+    uint64_t _pos;
+    const Inflater *_inflater = nullptr;
+
+    void _publish()
+    {
+        if (_inflater)
+            _head.store(_pos + _inflater->tell(), std::memory_order_relaxed);
+    }
+public:
+    HeadBuf(std::ostream &os, std::atomic<uint64_t> &head, uint64_t pos) : _os(os), _head(head), _pos(pos) { }
+    void follow(const Inflater &inflater) { _inflater = &inflater; }
+
+    int overflow(int c) override
+    {
+        if (c != EOF)
+            _os.put(c), _publish();
+        return c;
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        _os.write(s, n);
+        _publish();
+        return n;
+    }
+};
+
+/*
+ * Inflates the members of a memory mapped file on a pool of worker threads.
+ * BGZF files give the member sizes in the header, otherwise every gzip
+ * header is a candidate and candidates that start inside an earlier member
+ * are dropped. The writer inflates the member at the current position
+ * straight into the output, so a single member file streams like the
+ * sequential path; the workers decode the members after it into memory.
+ * A worker gives up on a member past SPECULATIVE bytes of output or once
+ * the writer has passed its start, the writer then inflates it itself
+ * when it gets there, or knows it for a false start.
+ */
+class ParallelInflater
+{
+    static constexpr size_t SPECULATIVE = 16 * 1024 * 1024;
+
+    struct Job
+    {
+        uint64_t pos, end = 0;
+        bool claimed = false, done = false, valid = false, abandoned = false;
+        std::vector<uint8_t> out;
+        Job(uint64_t pos) : pos(pos) { }
+    };
+
+    const uint8_t *_buf;
+    size_t _len;
+    unsigned _nThreads, _window;
+    std::vector<Job> _jobs;
+    size_t _next = 0, _written = 0;
+    std::atomic<uint64_t> _head = 0;
+    bool _stop = false;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _bgzf();
+    void _scan();
+    void _work();
+    uint64_t _inflate(uint64_t pos, std::ostream &os);
+    void _write(std::ostream &os);
+public:
+    ParallelInflater(const uint8_t *buf, size_t len, unsigned nThreads);
+    void run(std::ostream &os);
+};
+
+ParallelInflater::ParallelInflater(const uint8_t *buf, size_t len, unsigned nThreads)
+  : _buf(buf), _len(len), _nThreads(nThreads), _window(nThreads * 2)
+{
+    if (!_bgzf())
+        _scan();
+}
+
+//walk the BSIZE fields of a BGZF file, false if it is not one
+bool ParallelInflater::_bgzf()
+{
+    std::vector<Job> jobs;
+
+    for (size_t pos = 0; pos < _len;)
+    {
+        const uint8_t *p = _buf + pos;
+
+        if (_len - pos < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || (p[3] & 4) == 0)
+            return false;
+
+        size_t xlen = p[10] | p[11] << 8, bsize = 0;
+
+        for (size_t i = 12; i + 4 <= 12 + xlen && pos + i + 4 <= _len;)
         {
-        case 0:
-            inflateUncompressedBlock();
-            break;
-        case 1:
-            inflateHuffmanBlock(_fixedLiteralLengthCode, _fixedDistanceCode);
-            break;
-        case 2:
+            size_t slen = p[i + 2] | p[i + 3] << 8;
+
+            if (p[i] == 'B' && p[i + 1] == 'C' && slen == 2 && pos + i + 6 <= _len)
+                bsize = (p[i + 4] | p[i + 5] << 8) + 1;
+
+            i += 4 + slen;
+        }
+
+        if (bsize == 0)
+            return false;
+
+        jobs.emplace_back(pos);
+        pos += bsize;
+    }
+
+    _jobs.swap(jobs);
+    return true;
+}
+
+//the magic, deflate, no reserved flags, and XFL and OS values that gzip
+//writers use; what still passes is mostly a real header
+void ParallelInflater::_scan()
+{
+    for (size_t i = 0; i + 10 <= _len; ++i)
+    {
+        const uint8_t *p = _buf + i;
+
+        if (p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && (p[3] & 0xe0) == 0 &&
+            (p[8] == 0 || p[8] == 2 || p[8] == 4) && (p[9] <= 13 || p[9] == 255))
         {
-            CanonicalCode litLen, dist;
-            decodeHuffmanCodes(litLen, dist);
-            inflateHuffmanBlock(litLen, dist);
+            _jobs.emplace_back(i);
         }
+    }
+}
+
+void ParallelInflater::_work()
+{
+    NullBuf nb;
+    std::ostream nullStream(&nb);
+
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        //the job at _written belongs to the writer unless claimed earlier
+        for (;; _cv.wait(lock))
+        {
+            _next = std::max(_next, _written + 1);
+
+            if (_stop || _next >= _jobs.size() || _next < _written + _window)
+                break;
+        }
+
+        if (_stop || _next >= _jobs.size())
+            return;
+
+        Job &job = _jobs[_next++];
+        job.claimed = true;
+        lock.unlock();
+        MemoryBuf in(_buf + job.pos, _len - job.pos);
+        SpeculativeBuf out(_head, job.pos, SPECULATIVE);
+        std::istream is(&in);
+        std::ostream os(&out);
+        os.exceptions(std::ios::badbit);
+        bool valid = true, abandoned = false;
+        uint64_t end = 0;
+
+        try
+        {
+            Inflater inflater(is, os, nullStream);
+            inflater.inflateMember();
+            end = job.pos + inflater.tell();
+        }
+        catch (Abandoned &)
+        {
+            valid = false, abandoned = true;
+        }
+        catch (std::exception &)
+        {
+            valid = false;
+        }
+
+        if (!valid)
+            out.data() = std::vector<uint8_t>();
+
+        lock.lock();
+        job.valid = valid, job.abandoned = abandoned, job.end = end, job.out.swap(out.data());
+        job.done = true;
+        _cv.notify_all();
+    }
+}
+
+//the member at pos straight into os, returns where it ends
+uint64_t ParallelInflater::_inflate(uint64_t pos, std::ostream &os)
+{
+    NullBuf nb;
+    std::ostream nullStream(&nb);
+    MemoryBuf in(_buf + pos, _len - pos);
+    std::istream is(&in);
+    HeadBuf head(os, _head, pos);
+    std::ostream hos(&head);
+    hos.exceptions(std::ios::badbit);
+    Inflater inflater(is, hos, nullStream);
+    head.follow(inflater);
+    inflater.inflateMember();
+    return pos + inflater.tell();
+}
+
+void ParallelInflater::_write(std::ostream &os)
+{
+    uint64_t pos = 0;
+
+    for (size_t i = 0; i < _jobs.size() && pos < _len; ++i)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        Job &job = _jobs[i];
+        _written = i;
+        _cv.notify_all();
+
+        //nothing starts here, what is left is not gzip
+        if (job.pos > pos)
             break;
-        case 3:
-            throw std::domain_error("Reserved block type");
-        default:
-            throw std::logic_error("Unreachable value");
+
+        if (job.pos < pos)
+            continue;
+
+        bool mine = !job.claimed;
+        job.claimed = true;
+        _cv.wait(lock, [&job, mine] { return mine || job.done; });
+        std::vector<uint8_t> out;
+        out.swap(job.out);
+        lock.unlock();
+
+        if (mine || job.abandoned)
+        {
+            pos = _inflate(pos, os);
         }
+        else if (job.valid)
+        {
+            os.write((const char *)out.data(), out.size());
+            pos = job.end;
+        }
+        else
+        {
+            throw std::runtime_error("Invalid gzip member");
+        }
+
+        _head.store(pos, std::memory_order_relaxed);
     }
 
-    _bis.align();
-    uint32_t crc = _bis.readBits(32);
-    uint32_t size = _bis.readBits(32);
-    assert(crc == _os.crc());
-    assert(size == _os.cnt());
-    _msg << "CRC: 0x" << Toolbox::hex32(crc) << " 0x" << Toolbox::hex32(_os.crc()) << "\r\n";
-    _msg << "size: " << size << " " << _os.cnt() << "\r\n";
+    if (pos == 0 && _len > 0)
+        throw std::runtime_error("Not in gzip format");
+
+    //like gzip, whatever follows the last member is ignored
+    if (pos < _len)
+        std::cerr << "gzcat: trailing garbage ignored\n";
+
+    os.flush();
 }
 
-int main(int argc, char *argv[])
+void ParallelInflater::run(std::ostream &os)
+{
+    std::vector<std::thread> workers;
+
+    for (unsigned i = 0; i < _nThreads; ++i)
+        workers.emplace_back(&ParallelInflater::_work, this);
+
+    auto stop = [&]
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _cv.notify_all();
+        }
+
+        for (auto &worker : workers)
+            worker.join();
+    };
+
+    try
+    {
+        _write(os);
+    }
+    catch (...)
+    {
+        stop();
+        throw;
+    }
+
+    stop();
+}
+
+//passes on only the bytes in [skip, skip + length)
+class RangeBuf : public std::streambuf
+{
+    std::ostream &_os;
+    uint64_t _skip, _length;
+public:
+    RangeBuf(std::ostream &os, uint64_t skip, uint64_t length) : _os(os), _skip(skip), _length(length) { }
+
+    int overflow(int c) override
+    {
+        char b = c;
+        xsputn(&b, 1);
+        return c;
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        uint64_t skip = std::min<uint64_t>(_skip, n);
+        uint64_t len = std::min<uint64_t>(_length, n - skip);
+        _os.write(s + skip, len);
+        _skip -= skip, _length -= len;
+        return n;
+    }
+};
+
+/*
+ * Index file: span, checkpoint count, then per checkpoint the output offset,
+ * the input bit offset, the window length, and the window deflated, its
+ * length first. Like zran, the windows are compressed, raw they would make
+ * up nearly all of the index.
+ */
+template <class T> static void writeRaw(std::ostream &os, T v) { os.write((const char *)&v, sizeof(v)); }
+template <class T> static T readRaw(std::istream &is) { T v = 0; is.read((char *)&v, sizeof(v)); return v; }
+
+static void writeWindow(std::ostream &os, Deflater &deflater, const std::vector<uint8_t> &window)
+{
+    std::vector<uint8_t> packed;
+    deflater.compress(window.data(), 0, window.size(), true, packed);
+    writeRaw<uint32_t>(os, window.size());
+    writeRaw<uint32_t>(os, packed.size());
+    os.write((const char *)packed.data(), packed.size());
+}
+
+static std::vector<uint8_t> readWindow(std::istream &is)
+{
+    uint32_t size = readRaw<uint32_t>(is);
+    std::vector<uint8_t> packed(readRaw<uint32_t>(is));
+    is.read((char *)packed.data(), packed.size());
+
+    if (!is || size > 32 * 1024)
+        throw std::runtime_error("Corrupt index");
+
+    MemoryBuf in(packed.data(), packed.size());
+    std::istream pis(&in);
+    std::ostringstream window;
+    NullBuf nb;
+    std::ostream nullStream(&nb);
+    Inflater inflater(pis, window, nullStream);
+    inflater.inflateRaw();
+
+    if (window.str().size() != size)
+        throw std::runtime_error("Corrupt index");
+
+    const std::string &str = window.str();
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+//skips a window without inflating it
+static void skipWindow(std::istream &is)
+{
+    readRaw<uint32_t>(is);
+    is.seekg(readRaw<uint32_t>(is), std::ios::cur);
+}
+
+static void buildIndex(const char *fn, const char *indexFn, uint64_t span)
+{
+    std::ifstream ifs(fn, std::ios::binary);
+    NullBuf nb;
+    std::ostream nullStream(&nb);
+    std::vector<Checkpoint> index;
+    Inflater inflater(ifs, nullStream, nullStream);
+    inflater.buildIndex(index, span);
+    std::ofstream ofs(indexFn, std::ios::binary);
+    Deflater deflater(levels[6]);
+    writeRaw<uint64_t>(ofs, span);
+    writeRaw<uint64_t>(ofs, index.size());
+
+    for (const Checkpoint &cp : index)
+    {
+        writeRaw<uint64_t>(ofs, cp.out);
+        writeRaw<uint64_t>(ofs, cp.bits);
+        writeWindow(ofs, deflater, cp.window);
+    }
+}
+
+//inflate only from the last checkpoint at or before offset
+static void extract(const char *fn, const char *indexFn, uint64_t offset, uint64_t length, std::ostream &os)
+{
+    std::ifstream idx(indexFn, std::ios::binary);
+    readRaw<uint64_t>(idx);
+    uint64_t n = readRaw<uint64_t>(idx);
+    Checkpoint best{0, 0, {}};
+    std::streampos window = -1;
+
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        uint64_t out = readRaw<uint64_t>(idx), bits = readRaw<uint64_t>(idx);
+
+        if (!idx)
+            throw std::runtime_error("Corrupt index");
+
+        if (out > offset)
+            break;
+
+        best.out = out, best.bits = bits, window = idx.tellg();
+        skipWindow(idx);
+    }
+
+    if (window == std::streampos(-1))
+        throw std::runtime_error("No checkpoint before offset");
+
+    //only the window of the checkpoint used is inflated
+    idx.clear();
+    idx.seekg(window);
+    best.window = readWindow(idx);
+
+    std::ifstream ifs(fn, std::ios::binary);
+    ifs.seekg(best.bits / 8);
+    RangeBuf rb(os, offset - best.out, length);
+    std::ostream ros(&rb);
+    NullBuf nb;
+    std::ostream nullStream(&nb);
+    Inflater inflater(ifs, ros, nullStream);
+    inflater.resume(best, offset + length);
+    os.flush();
+}
+
+static void parallel(const char *fn, std::ostream &os)
+{
+    int fd = ::open(fn, O_RDONLY);
+
+    if (fd < 0)
+        throw std::runtime_error("Cannot open file");
+
+    struct stat st;
+    fstat(fd, &st);
+    void *buf = st.st_size ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+
+    if (buf == MAP_FAILED)
+        throw std::runtime_error("Cannot map file");
+
+    madvise(buf, st.st_size, MADV_SEQUENTIAL);
+    unsigned nThreads = std::max(1U, std::thread::hardware_concurrency());
+    ParallelInflater inflater((const uint8_t *)buf, st.st_size, nThreads);
+    inflater.run(os);
+    munmap(buf, st.st_size);
+    ::close(fd);
+}
+
+static void run(int argc, char *argv[])
 {
     std::istream *is = &std::cin;
     std::ifstream ifs;
+
+    //gzcat -p file inflates the members in parallel
+    if (argc == 3 && strcmp(argv[1], "-p") == 0)
+    {
+        parallel(argv[2], std::cout);
+        return;
+    }
+
+    //gzcat -i file index [span] writes a random access index
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "-i") == 0)
+    {
+        buildIndex(argv[2], argv[3], argc == 5 ? std::stoull(argv[4]) : 1024 * 1024);
+        return;
+    }
+
+    //gzcat -x file index offset length extracts a range using the index
+    if (argc == 6 && strcmp(argv[1], "-x") == 0)
+    {
+        extract(argv[2], argv[3], std::stoull(argv[4]), std::stoull(argv[5]), std::cout);
+        return;
+    }
     
     if (argc == 2)
     {
@@ -410,13 +1197,26 @@ int main(int argc, char *argv[])
         is = &ifs;
     }
 
-    class NullBuf : public std::streambuf { public: int overflow(int c) override { return c; } };
     NullBuf nb;
     std::ostream nullStream(&nb);
 
     Inflater inflater(*is, std::cout, nullStream);
     inflater.inflate();
-    return 0;
 }
 
+int main(int argc, char *argv[])
+{
+    //what was inflated before an error still goes out
+    try
+    {
+        run(argc, argv);
+    }
+    catch (std::exception &e)
+    {
+        std::cout.flush();
+        std::cerr << "gzcat: " << e.what() << "\n";
+        return 1;
+    }
 
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Simple DEFLATE compressor with gzip framing, the counterpart of gzcat.cpp
+ *
+ * The compressor itself lives in deflate.h, this adds the gzip header and
+ * trailer and a pigz style multithreaded mode.
+ */
+
+#include "crc32.h"
+#include "deflate.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Splits the input into chunks and compresses them on a pool of worker
+ * threads, each primed with the last 32 KB of the chunk before it.
+ * With one thread this is the plain sequential compressor.
+ */
+class ParallelDeflater
+{
+    static constexpr uint32_t CHUNK = 128 * 1024, DICT = 32 * 1024;
+
+    struct Job
+    {
+        std::vector<uint8_t> in, out;
+        uint32_t dictLen = 0;
+        bool final = false, done = false;
+    };
+
+    const Level &_level;
+    unsigned _nThreads;
+    std::deque<Job *> _todo;
+    bool _stop = false;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    void _work();
+public:
+    ParallelDeflater(const Level &level, unsigned nThreads) : _level(level), _nThreads(nThreads) { }
+    void run(std::istream &is, std::ostream &os);
+};
+
+void ParallelDeflater::_work()
+{
+    Deflater deflater(_level);
+
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this] { return _stop || !_todo.empty(); });
+
+        if (_todo.empty())
+            return;
+
+        Job *job = _todo.front();
+        _todo.pop_front();
+        lock.unlock();
+        deflater.compress(job->in.data(), job->dictLen, job->in.size() - job->dictLen, job->final, job->out);
+        lock.lock();
+        job->done = true;
+        _cv.notify_all();
+    }
+}
+
+void ParallelDeflater::run(std::istream &is, std::ostream &os)
+{
+    static constexpr uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255};
+    os.write((const char *)header, sizeof(header));
+    std::vector<std::thread> workers;
+
+    for (unsigned i = 0; i < _nThreads; ++i)
+        workers.emplace_back(&ParallelDeflater::_work, this);
+
+    CRC32 crc;
+    uint64_t size = 0;
+    std::deque<std::unique_ptr<Job>> inflight;
+    std::vector<uint8_t> next(CHUNK), dict;
+    is.read((char *)next.data(), CHUNK);
+    next.resize(is.gcount());
+
+    for (bool final = false; !final;)
+    {
+        auto job = std::make_unique<Job>();
+        job->in = dict;
+        job->dictLen = dict.size();
+        job->in.insert(job->in.end(), next.begin(), next.end());
+        crc.update(next.data(), next.size());
+        size += next.size();
+        dict.assign(job->in.end() - std::min<size_t>(DICT, job->in.size()), job->in.end());
+        next.resize(CHUNK);
+        is.read((char *)next.data(), CHUNK);
+        next.resize(is.gcount());
+        final = job->final = next.empty();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _todo.push_back(job.get());
+            _cv.notify_all();
+        }
+
+        inflight.push_back(std::move(job));
+
+        while (inflight.size() > _nThreads * 2 || final && !inflight.empty())
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [&inflight] { return inflight.front()->done; });
+            lock.unlock();
+            const std::vector<uint8_t> &out = inflight.front()->out;
+            os.write((const char *)out.data(), out.size());
+            inflight.pop_front();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _cv.notify_all();
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+
+    uint8_t trailer[8];
+
+    for (int i = 0; i < 4; ++i)
+        trailer[i] = crc.crc() >> 8 * i, trailer[i + 4] = size >> 8 * i;
+
+    os.write((const char *)trailer, sizeof(trailer));
+    os.flush();
+}
+
+//gzip [-1 .. -9] [-p] [file]
+int main(int argc, char *argv[])
+{
+    std::istream *is = &std::cin;
+    std::ifstream ifs;
+    unsigned level = 6, nThreads = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] == '-' && argv[i][1] >= '1' && argv[i][1] <= '9' && argv[i][2] == 0)
+            level = argv[i][1] - '0';
+        else if (strcmp(argv[i], "-p") == 0)
+            nThreads = std::max(1U, std::thread::hardware_concurrency());
+        else
+            ifs.open(argv[i], std::ios::binary), is = &ifs;
+    }
+
+    ParallelDeflater deflater(levels[level], nThreads);
+    deflater.run(*is, std::cout);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Throughput of md5sumpp against coreutils md5sum on one large file,
+# mapped, redirected and through a pipe. The file is generated once.
+# Usage: ./bench.sh [size] [file], default 8G in /tmp/md5bench.bin
+set -e
+SIZE=${1:-8G}
+FILE=${2:-/tmp/md5bench.bin}
+
+[ -f "$FILE" ] || head -c "$SIZE" /dev/urandom > "$FILE"
+BYTES=$(stat -c %s "$FILE")
+cat "$FILE" > /dev/null
+
+run()
+{
+    start=$(date +%s.%N)
+    sum=$(sh -c "$1" | cut -c1-32)
+    end=$(date +%s.%N)
+    awk -v b="$BYTES" -v s="$start" -v e="$end" -v sum="$sum" -v cmd="$1" \
+        'BEGIN { printf "%s %8.1f MB/s  %s\n", sum, b / (e - s) / 1048576, cmd }'
+}
+
+run "md5sum $FILE"
+run "./md5sumpp $FILE"
+run "md5sum < $FILE"
+run "./md5sumpp < $FILE"
+run "cat $FILE | md5sum"
+run "cat $FILE | ./md5sumpp"
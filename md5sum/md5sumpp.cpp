@@ -1,25 +1,91 @@
 //Usage: ./md5sumpp < file
+//       ./md5sumpp file...
+//       ./md5sumpp -c sums
 
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <utility>
 #include <cstdint>
+#include <cstring>
+#include <cstdlib>
 #include <cassert>
-#include <cmath>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef WIN32
 #include <io.h>
 #include <fcntl.h>
 #endif
 
-using std::istream;
-using std::cin;
 using std::cout;
+using std::cerr;
 using std::endl;
-using std::fabs;
-using std::sin;
 
 static constexpr char nibble(uint8_t n)
 { return n <= 9 ? '0' + char(n) : 'a' + char(n - 10); }
 
+//floor(abs(sin(i + 1)) * 2^32), fixed so it isn't recomputed per chunk
+static constexpr uint32_t K[64] = {
+ 0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+ 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+ 0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+ 0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+ 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+ 0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+ 0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+ 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+static constexpr uint32_t R[64] = {
+ 7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,
+ 5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,
+ 4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,
+ 6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21};
+
+/*
+ * One MD5 step with the round function, message index and constants
+ * resolved at compile time. T is uint32_t for a single stream or a GCC
+ * vector of uint32_t that runs one independent stream per lane.
+ */
+template <unsigned i, class T> static inline __attribute__((always_inline))
+void step(T &a, const T &b, const T &c, const T &d, const T *w)
+{
+    constexpr unsigned g = i < 16 ? i : i < 32 ? (5 * i + 1) % 16 : i < 48 ? (3 * i + 5) % 16 : 7 * i % 16;
+    T f;
+
+    if constexpr (i < 16)
+        f = b & c | ~b & d;
+    else if constexpr (i < 32)
+        f = d & b | ~d & c;
+    else if constexpr (i < 48)
+        f = b ^ c ^ d;
+    else
+        f = c ^ (b | ~d);
+
+    T x = a + f + K[i] + w[g];
+    a = b + (x << R[i] | x >> 32 - R[i]);
+}
+
+template <class T, size_t... I> static inline __attribute__((always_inline))
+void rounds(T &a, T &b, T &c, T &d, const T *w, std::index_sequence<I...>)
+{
+    ((step<I * 4>(a, b, c, d, w), step<I * 4 + 1>(d, a, b, c, w),
+      step<I * 4 + 2>(c, d, a, b, w), step<I * 4 + 3>(b, c, d, a, w)), ...);
+}
+
+template <class T> static inline __attribute__((always_inline))
+void transform(T *h, const T *w)
+{
+    T a = h[0], b = h[1], c = h[2], d = h[3];
+    rounds(a, b, c, d, w, std::make_index_sequence<16>());
+    h[0] += a, h[1] += b, h[2] += c, h[3] += d;
+}
+
 struct Hash
 {
     uint32_t _h[4];
@@ -32,83 +98,451 @@ struct Hash
     { _h[0] += h[0], _h[1] += h[1], _h[2] += h[2], _h[3] += h[3]; return *this; }
 };
 
-class Chunk
+//last one or two blocks: rest of the data, stop bit, zeros, length in bits
+static unsigned padTail(uint8_t *tail, const uint8_t *rest, unsigned n, uint64_t size)
+{
+    const unsigned blocks = n >= 56 ? 2 : 1;
+    memset(tail, 0, blocks * 64);
+    memcpy(tail, rest, n);
+    tail[n] = 0x80;
+    const uint64_t bits = size << 3;
+    memcpy(tail + blocks * 64 - 8, &bits, 8);
+    return blocks;
+}
+
+//one stream, fed whole blocks straight from the caller's memory
+class Digest
 {
-    uint32_t _w[16];
-    uint32_t _k[64];
-    static const uint32_t _r[64];
+    uint32_t _h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    uint64_t _size = 0;
 public:
-    Chunk()
-    { for (unsigned i = 0; i < 64; ++i) _k[i] = uint32_t(fabs(sin(i + 1)) * double(1UL << 32)); }
-
-    void fillTail(uint32_t size) { _w[14] = size << 3, _w[15] = size >> 29; }
-    Hash calc(const Hash &hash) const;
-    void clear() { for (int i = 0; i < 16; ++i) _w[i] = 0; }
-    void stopBit(unsigned gc) { ((char *)_w)[gc] = 0x80; }
-    auto read(istream &is) { clear(); is.read((char *)_w, 64); return is.gcount(); }
+    void blocks(const uint8_t *p, size_t n);
+    Hash finish(const uint8_t *rest, unsigned n);
 };
 
-const uint32_t Chunk::_r[64] = {
- 7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,
- 5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,
- 4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,
- 6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21};
+void Digest::blocks(const uint8_t *p, size_t n)
+{
+    uint32_t w[16];
+
+    for (const uint8_t *end = p + n; p < end; p += 64)
+        memcpy(w, p, 64), transform(_h, w);
+
+    _size += n;
+}
 
-Hash Chunk::calc(const Hash &h) const
+Hash Digest::finish(const uint8_t *rest, unsigned n)
 {
-    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    uint8_t tail[128];
+    _size += n;
+    const unsigned blocks = padTail(tail, rest, n, _size);
+    uint32_t w[16];
 
-    for (unsigned i = 0, f, g; i < 64; ++i)
+    for (unsigned i = 0; i < blocks; ++i)
+        memcpy(w, tail + 64 * i, 64), transform(_h, w);
+
+    return Hash(_h[0], _h[1], _h[2], _h[3]);
+}
+
+/*
+ * Regular files are mapped and hashed in place from the current offset,
+ * anything else is read into a large aligned buffer. For a pipe we ask
+ * for a bigger pipe buffer so the writer can run further ahead.
+ */
+static bool hashFd(int fd, Hash &hash)
+{
+    static constexpr size_t BUFSIZE = 1 << 20;
+    Digest digest;
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
     {
-        if (i < 16) {
-            f = b & c | ~b & d;
-            g = i;
-        } else if (i < 32) {
-            f = d & b | ~d & c;
-            g = (5 * i + 1) % 16;
-        } else if (i < 48) {
-            f = b ^ c ^ d;
-            g = (3 * i + 5) % 16;
-        } else {
-            f = c ^ (b | ~d);
-            g = (7 * i) % 16;
+        const off_t offset = lseek(fd, 0, SEEK_CUR);
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (offset >= 0 && offset <= st.st_size && p != MAP_FAILED)
+        {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            const uint8_t *data = (const uint8_t *)p + offset;
+            const uint64_t size = st.st_size - offset;
+            digest.blocks(data, size & ~uint64_t(63));
+            hash = digest.finish(data + (size & ~uint64_t(63)), size & 63);
+            munmap(p, st.st_size);
+            return true;
         }
-        uint32_t temp = d;
-        d = c;
-        c = b;
-        uint32_t x = a + f + _k[i] + _w[g];
-        b += x << _r[i] | x >> 32 - _r[i];
-        a = temp;
+
+        if (p != MAP_FAILED)
+            munmap(p, st.st_size);
+    }
+
+#ifdef F_SETPIPE_SZ
+    if (S_ISFIFO(st.st_mode))
+        fcntl(fd, F_SETPIPE_SZ, BUFSIZE);
+#endif
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    void *buf;
+
+    if (posix_memalign(&buf, 4096, BUFSIZE) != 0)
+        return false;
+
+    uint8_t *p = (uint8_t *)buf;
+    size_t have = 0;
+    ssize_t r;
+
+    while ((r = read(fd, p + have, BUFSIZE - have)) > 0)
+    {
+        have += r;
+        const size_t whole = have & ~size_t(63);
+        digest.blocks(p, whole);
+        memmove(p, p + whole, have - whole);
+        have -= whole;
     }
 
-    return Hash(a, b, c, d);
+    if (r == 0)
+        hash = digest.finish(p, have);
+
+    free(buf);
+    return r == 0;
 }
 
-static Hash stream(istream &is)
+/*
+ * Multi-buffer engine. State is kept as h[word][lane] and every call runs
+ * one 64 byte block for each lane. The blocks are copied side by side and
+ * transposed so that message word j of every lane lands in vector w[j].
+ */
+static constexpr unsigned MAXLANES = 16;
+typedef void (*LanesFn)(uint32_t h[4][MAXLANES], const uint8_t *const *blocks);
+
+template <class V, unsigned N> static inline __attribute__((always_inline))
+void lanes(uint32_t h[4][MAXLANES], const uint8_t *const *blocks)
 {
-    Hash hash(0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476);
-    Chunk chunk;
-    unsigned sz = 0, gc = 0;
+    V w[16], s[4];
+    uint32_t rows[N][16], cols[16][N];
+
+    for (unsigned l = 0; l < N; ++l)
+        memcpy(rows[l], blocks[l], 64);
+
+    for (unsigned j = 0; j < 16; ++j)
+        for (unsigned l = 0; l < N; ++l)
+            cols[j][l] = rows[l][j];
+
+    memcpy(w, cols, sizeof(cols));
+
+    for (unsigned k = 0; k < 4; ++k)
+        memcpy(s + k, h[k], sizeof(V));
+
+    transform(s, w);
+
+    for (unsigned k = 0; k < 4; ++k)
+        memcpy(h[k], s + k, sizeof(V));
+}
+
+static void lanes1(uint32_t h[4][MAXLANES], const uint8_t *const *blocks)
+{ lanes<uint32_t, 1>(h, blocks); }
+
+#if defined(__x86_64__) || defined(__i386__)
+typedef uint32_t V4 __attribute__((vector_size(16)));
+typedef uint32_t V8 __attribute__((vector_size(32)));
+typedef uint32_t V16 __attribute__((vector_size(64)));
+
+__attribute__((target("sse2")))
+static void lanes4(uint32_t h[4][MAXLANES], const uint8_t *const *blocks)
+{ lanes<V4, 4>(h, blocks); }
+
+__attribute__((target("avx2")))
+static void lanes8(uint32_t h[4][MAXLANES], const uint8_t *const *blocks)
+{ lanes<V8, 8>(h, blocks); }
+
+__attribute__((target("avx512f")))
+static void lanes16(uint32_t h[4][MAXLANES], const uint8_t *const *blocks)
+{ lanes<V16, 16>(h, blocks); }
+#endif
 
-    while ((gc = chunk.read(is)) == 64)
-        hash += chunk.calc(hash), sz += gc;
+static LanesFn pickLanes(unsigned &n)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
 
-    sz += gc;
-    chunk.stopBit(gc);
+    if (__builtin_cpu_supports("avx512f"))
+        return n = 16, lanes16;
 
-    if (gc >= 56)
-        hash += chunk.calc(hash), chunk.clear();
+    if (__builtin_cpu_supports("avx2"))
+        return n = 8, lanes8;
 
-    chunk.fillTail(sz);
-    return hash += chunk.calc(hash);
+    if (__builtin_cpu_supports("sse2"))
+        return n = 4, lanes4;
+#endif
+    return n = 1, lanes1;
 }
 
-int main()
+struct Job
+{
+    std::string fn;
+    uint8_t digest[16];
+    bool ok = false;
+};
+
+/*
+ * Feeds whole files through the lanes. Each file is mapped and its last
+ * one or two padded blocks are built in tail, files that can't be mapped
+ * are streamed by hashFd before the lane moves on.
+ * A lane that finishes takes the next job from the shared counter, lanes
+ * without work hash a zero block that nobody looks at.
+ */
+class MultiBuffer
+{
+    struct Lane
+    {
+        Job *job = nullptr;
+        const uint8_t *data;
+        uint64_t size, block, full, blocks;
+        uint8_t tail[128];
+    };
+
+    std::vector<Job> &_jobs;
+    std::atomic<size_t> &_next;
+    LanesFn _fn;
+    unsigned _n;
+    bool _open(Lane &lane, Job &job);
+    void _close(Lane &lane);
+public:
+    MultiBuffer(std::vector<Job> &jobs, std::atomic<size_t> &next, LanesFn fn, unsigned n)
+      : _jobs(jobs), _next(next), _fn(fn), _n(n) { }
+
+    void run();
+};
+
+bool MultiBuffer::_open(Lane &lane, Job &job)
+{
+    int fd = open(job.fn.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void *p = MAP_FAILED;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    //not mappable, hash it right here as a stream
+    if (p == MAP_FAILED)
+    {
+        Hash hash(0, 0, 0, 0);
+
+        if (hashFd(fd, hash))
+            memcpy(job.digest, hash._h, 16), job.ok = true;
+
+        close(fd);
+        return false;
+    }
+
+    close(fd);
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    lane.data = (const uint8_t *)p, lane.size = st.st_size;
+    lane.full = lane.size / 64;
+    lane.blocks = lane.full + padTail(lane.tail, lane.data + lane.full * 64, lane.size % 64, lane.size);
+    lane.block = 0;
+    lane.job = &job;
+    return true;
+}
+
+void MultiBuffer::_close(Lane &lane)
+{
+    munmap((void *)lane.data, lane.size);
+    lane.job = nullptr;
+}
+
+void MultiBuffer::run()
+{
+    static const uint8_t zero[64] = {0};
+    Lane lanes[MAXLANES];
+    uint32_t h[4][MAXLANES];
+    const uint8_t *blocks[MAXLANES];
+    bool drained = false;
+
+    while (true)
+    {
+        unsigned active = 0;
+
+        for (unsigned l = 0; l < _n; ++l)
+        {
+            while (!lanes[l].job && !drained)
+            {
+                size_t i = _next++;
+
+                if (i >= _jobs.size())
+                {
+                    drained = true;
+                    break;
+                }
+
+                if (_open(lanes[l], _jobs[i]))
+                {
+                    h[0][l] = 0x67452301, h[1][l] = 0xefcdab89;
+                    h[2][l] = 0x98badcfe, h[3][l] = 0x10325476;
+                }
+            }
+
+            Lane &lane = lanes[l];
+
+            if (!lane.job)
+            {
+                blocks[l] = zero;
+                continue;
+            }
+
+            ++active;
+            blocks[l] = lane.block < lane.full ? lane.data + lane.block * 64
+                                               : lane.tail + (lane.block - lane.full) * 64;
+        }
+
+        if (active == 0)
+            return;
+
+        //a lone big file goes faster through the scalar code
+        if (active == 1 && drained && _n > 1)
+        {
+            unsigned l = 0;
+
+            while (!lanes[l].job)
+                ++l;
+
+            Lane &lane = lanes[l];
+            uint32_t s[4] = {h[0][l], h[1][l], h[2][l], h[3][l]}, w[16];
+
+            for (; lane.block < lane.blocks; ++lane.block)
+            {
+                memcpy(w, lane.block < lane.full ? lane.data + lane.block * 64
+                                                 : lane.tail + (lane.block - lane.full) * 64, 64);
+                transform(s, w);
+            }
+
+            memcpy(lane.job->digest, s, 16);
+            lane.job->ok = true;
+            _close(lane);
+            return;
+        }
+
+        _fn(h, blocks);
+
+        for (unsigned l = 0; l < _n; ++l)
+        {
+            Lane &lane = lanes[l];
+
+            if (!lane.job || ++lane.block < lane.blocks)
+                continue;
+
+            for (unsigned k = 0; k < 4; ++k)
+                memcpy(lane.job->digest + 4 * k, &h[k][l], 4);
+
+            lane.job->ok = true;
+            _close(lane);
+        }
+    }
+}
+
+static void hashFiles(std::vector<Job> &jobs)
+{
+    unsigned n;
+    LanesFn fn = pickLanes(n);
+    std::atomic<size_t> next(0);
+    unsigned nThreads = std::max(1U, std::min<unsigned>(std::thread::hardware_concurrency(), jobs.size() / n + 1));
+    std::vector<std::thread> workers;
+
+    for (unsigned i = 0; i < nThreads; ++i)
+        workers.emplace_back([&jobs, &next, fn, n] { MultiBuffer(jobs, next, fn, n).run(); });
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+static std::string hex(const uint8_t *digest)
+{
+    std::string s;
+
+    for (unsigned i = 0; i < 16; ++i)
+        s += nibble(digest[i] >> 4), s += nibble(digest[i] & 0xf);
+
+    return s;
+}
+
+//lines as written by md5sum: 32 hex digits, two spaces or " *", file name
+static int check(const char *listFn)
+{
+    std::ifstream list(listFn);
+    std::vector<Job> jobs;
+    std::vector<std::string> expected;
+
+    for (std::string line; std::getline(list, line);)
+    {
+        if (line.size() < 35 || line[32] != ' ' || line[33] != ' ' && line[33] != '*')
+            continue;
+
+        expected.push_back(line.substr(0, 32));
+        jobs.emplace_back();
+        jobs.back().fn = line.substr(34);
+    }
+
+    hashFiles(jobs);
+    unsigned failed = 0, unreadable = 0;
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (!jobs[i].ok)
+            cout << jobs[i].fn << ": FAILED open or read\n", ++unreadable;
+        else if (hex(jobs[i].digest) != expected[i])
+            cout << jobs[i].fn << ": FAILED\n", ++failed;
+        else
+            cout << jobs[i].fn << ": OK\n";
+    }
+
+    cout.flush();
+
+    if (unreadable)
+        cerr << "md5sumpp: WARNING: " << unreadable << " listed files could not be read" << endl;
+
+    if (failed)
+        cerr << "md5sumpp: WARNING: " << failed << " computed checksums did NOT match" << endl;
+
+    return failed || unreadable ? 1 : 0;
+}
+
+int main(int argc, char **argv)
 {
 #ifdef WIN32
     _setmode(_fileno(stdin), _O_BINARY);
 #endif
-    Hash hash = ::stream(cin);
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
+        return check(argv[2]);
+
+    if (argc > 1)
+    {
+        std::vector<Job> jobs(argc - 1);
+
+        for (int i = 1; i < argc; ++i)
+            jobs[i - 1].fn = argv[i];
+
+        hashFiles(jobs);
+        int ret = 0;
+
+        for (const Job &job : jobs)
+        {
+            if (job.ok)
+                cout << hex(job.digest) << "  " << job.fn << "\n";
+            else
+                cerr << "md5sumpp: " << job.fn << ": cannot read" << endl, ret = 1;
+        }
+
+        return ret;
+    }
+
+    Hash hash(0, 0, 0, 0);
+
+    if (!hashFd(0, hash))
+    {
+        cerr << "md5sumpp: read error" << endl;
+        return 1;
+    }
 
     uint8_t *a = (uint8_t *)hash._h;
     for (unsigned i = 0; i < 16; ++i)
@@ -117,5 +551,3 @@ int main()
     cout << endl;
     return 0;
 }
-
-
@@ -27,6 +27,9 @@
 #include <cstring>
 #include <math.h>
 #include "minimp3.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 #define INLINE inline
 
@@ -72,7 +75,7 @@
 
 #define VLC_TYPE int16_t
 
-struct _granule;
+struct _mp3_tables;
 
 typedef struct _bitstream {
     const uint8_t *buffer, *buffer_end;
@@ -86,6 +89,25 @@ typedef struct _vlc {
     int table_size, table_allocated;
 } vlc_t;
 
+typedef struct _granule {
+    uint8_t scfsi;
+    int part2_3_length;
+    int big_values;
+    int global_gain;
+    int scalefac_compress;
+    uint8_t block_type;
+    uint8_t switch_point;
+    int table_select[3];
+    int subblock_gain[3];
+    uint8_t scalefac_scale;
+    uint8_t count1table_select;
+    int region_size[3];
+    int preflag;
+    int short_start, long_end;
+    uint8_t scale_factors[40];
+    int32_t sb_hybrid[SBLIMIT * 18];
+} granule_t;
+
 typedef struct _mp3_context {
     uint8_t last_buf[2*BACKSTEP_SIZE + EXTRABYTES];
     int last_buf_size;
@@ -104,49 +126,43 @@ typedef struct _mp3_context {
     int16_t synth_buf[MP3_MAX_CHANNELS][512 * 2];
     int synth_buf_offset[MP3_MAX_CHANNELS];
     int32_t sb_samples[MP3_MAX_CHANNELS][36][SBLIMIT];
-    int32_t mdct_buf[MP3_MAX_CHANNELS][SBLIMIT * 18];
+    int32_t mdct_buf[MP3_MAX_CHANNELS][18 * SBLIMIT]; /* time major, like sb_samples */
     int dither_state;
+    granule_t granules[MP3_MAX_CHANNELS][2];
+    int16_t exponents[576];
+    const struct _mp3_tables *tab;
 } mp3_context_t;
 
-typedef struct _granule {
-    uint8_t scfsi;
-    int part2_3_length;
-    int big_values;
-    int global_gain;
-    int scalefac_compress;
-    uint8_t block_type;
-    uint8_t switch_point;
-    int table_select[3];
-    int subblock_gain[3];
-    uint8_t scalefac_scale;
-    uint8_t count1table_select;
-    int region_size[3];
-    int preflag;
-    int short_start, long_end;
-    uint8_t scale_factors[40];
-    int32_t sb_hybrid[SBLIMIT * 18];
-} granule_t;
-
 typedef struct _huff_table {
     int xsize;
     const uint8_t *bits;
     const uint16_t *codes;
 } huff_table_t;
 
-static vlc_t huff_vlc[16];
-static vlc_t huff_quad_vlc[2];
-static uint16_t band_index_long[9][23];
 #define TABLE_4_3_SIZE (8191 + 16)*4
-static int8_t  *table_4_3_exp;
-static uint32_t *table_4_3_value;
-static uint32_t exp_table[512];
-static uint32_t expval_table[512][16];
-static int32_t is_table[2][16];
-static int32_t is_table_lsf[2][2][16];
-static int32_t csa_table[8][4];
-static float csa_table_float[8][4];
-static int32_t mdct_win[8][36];
-static int16_t window[512];
+
+/* computed once, on first use, and shared read-only by all decoders */
+typedef struct _mp3_tables {
+    vlc_t huff_vlc[16] = {};
+    vlc_t huff_quad_vlc[2] = {};
+    uint16_t band_index_long[9][23];
+    int8_t table_4_3_exp[TABLE_4_3_SIZE];
+    uint32_t table_4_3_value[TABLE_4_3_SIZE];
+    uint32_t exp_table[512];
+    uint32_t expval_table[512][16];
+    int32_t is_table[2][16];
+    int32_t is_table_lsf[2][2][16];
+    int32_t csa_table[8][4];
+    float csa_table_float[8][4];
+    int32_t mdct_win[8][36];
+    int16_t window[512];
+    /* 0 scalar, 1 SSE2, 2 AVX2, and the tables of the vector versions */
+    int simd;
+    int32_t csa_lanes[3][8];
+    int32_t mdct_win_lanes[4][2][36][8];
+    int16_t synth_win[8][2][32];
+    _mp3_tables();
+} mp3_tables_t;
 
 static constexpr uint16_t mp3_bitrate_tab[2][15] = {
     {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
@@ -1097,13 +1113,13 @@ static void lsf_sf_expand(
     slen[0] = sf;
 }
 
-static INLINE int l3_unscale(int value, int exponent)
+static INLINE int l3_unscale(const mp3_tables_t *t, int value, int exponent)
 {
     unsigned int m;
     int e;
 
-    e = table_4_3_exp  [4*value + (exponent&3)];
-    m = table_4_3_value[4*value + (exponent&3)];
+    e = t->table_4_3_exp  [4*value + (exponent&3)];
+    m = t->table_4_3_value[4*value + (exponent&3)];
     e -= (exponent >> 2);
     if (e > 31)
         return 0;
@@ -1196,8 +1212,116 @@ static void reorder_block(mp3_context_t *s, granule_t *g)
 
 #define MULH(a,b) (((int64_t)(a) * (int64_t)(b)) >> 32)
 
+#ifdef __SSE2__
+namespace sse2 {
+
+typedef __m128i vec;
+enum { W = 4 };
+
+static INLINE vec vset1(int32_t x) { return _mm_set1_epi32(x); }
+static INLINE vec vload(const int32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static INLINE void vstore(int32_t *p, vec x) { _mm_storeu_si128((__m128i *)p, x); }
+static INLINE vec vadd(vec a, vec b) { return _mm_add_epi32(a, b); }
+static INLINE vec vsub(vec a, vec b) { return _mm_sub_epi32(a, b); }
+static INLINE vec vsra(vec a, int n) { return _mm_srai_epi32(a, n); }
+static INLINE vec vsll(vec a, int n) { return _mm_slli_epi32(a, n); }
+static INLINE vec vreverse(vec a) { return _mm_shuffle_epi32(a, 0x1b); }
+
+static INLINE vec vcolumn(const int32_t *p)
+{
+    return _mm_setr_epi32(p[0], p[18], p[36], p[54]);
+}
+
+/* pmuludq is unsigned, a negative factor adds the other one times 2^32 */
+static INLINE vec vsign(vec a, vec b)
+{
+    return _mm_add_epi32(_mm_and_si128(_mm_srai_epi32(a, 31), b),
+                         _mm_and_si128(_mm_srai_epi32(b, 31), a));
+}
+
+/* (a * b) >> n in 64 bits, n from FRAC_BITS to 32 */
+static INLINE vec vmuls(vec a, vec b, int n)
+{
+    vec even = _mm_srli_epi64(_mm_mul_epu32(a, b), n);
+    vec odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)), n);
+    vec lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, 0x8), _mm_shuffle_epi32(odd, 0x8));
+    return _mm_sub_epi32(lo, _mm_slli_epi32(vsign(a, b), 32 - n));
+}
+
+static INLINE vec vload16(const int16_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static INLINE vec vmadd16(vec a, vec b) { return _mm_madd_epi16(a, b); }
+
+/* x[m] holds the pairs (p[j], p2[-j]) for j = 4m ... 4m + 3 */
+static INLINE void vpairs(vec *x, const int16_t *p, const int16_t *p2)
+{
+    for (int h = 0; h < 2; h++) {
+        vec a = vload16(p + 8 * h), b = vload16(p2 - 8 * h - 7);
+        b = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(b, 0x1b), 0x1b), 0x4e);
+        x[2 * h] = _mm_unpacklo_epi16(a, b);
+        x[2 * h + 1] = _mm_unpackhi_epi16(a, b);
+    }
+}
+
+#include "minimp3_simd.h"
+
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+
+typedef __m256i vec;
+enum { W = 8 };
+
+static INLINE vec vset1(int32_t x) { return _mm256_set1_epi32(x); }
+static INLINE vec vload(const int32_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static INLINE void vstore(int32_t *p, vec x) { _mm256_storeu_si256((__m256i *)p, x); }
+static INLINE vec vadd(vec a, vec b) { return _mm256_add_epi32(a, b); }
+static INLINE vec vsub(vec a, vec b) { return _mm256_sub_epi32(a, b); }
+static INLINE vec vsra(vec a, int n) { return _mm256_srai_epi32(a, n); }
+static INLINE vec vsll(vec a, int n) { return _mm256_slli_epi32(a, n); }
+
+static INLINE vec vreverse(vec a)
+{
+    return _mm256_permutevar8x32_epi32(a, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+static INLINE vec vcolumn(const int32_t *p)
+{
+    return _mm256_i32gather_epi32(p, _mm256_setr_epi32(0, 18, 36, 54, 72, 90, 108, 126), 4);
+}
+
+static INLINE vec vmuls(vec a, vec b, int n)
+{
+    vec even = _mm256_mul_epi32(a, b);
+    vec odd = _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+    return _mm256_blend_epi32(_mm256_srli_epi64(even, n), _mm256_slli_epi64(odd, 32 - n), 0xaa);
+}
+
+static INLINE vec vload16(const int16_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static INLINE vec vmadd16(vec a, vec b) { return _mm256_madd_epi16(a, b); }
+
+/* unpack works within 128 bit lanes, so both halves go in with their
+   quarters in the order 0 2 1 3, p2 after reversing it */
+static INLINE void vpairs(vec *x, const int16_t *p, const int16_t *p2)
+{
+    const vec rev = _mm256_setr_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+                                     14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    vec a = _mm256_permute4x64_epi64(vload16(p), 0xd8);
+    vec b = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(vload16(p2 - 15), rev), 0x72);
+    x[0] = _mm256_unpacklo_epi16(a, b);
+    x[1] = _mm256_unpackhi_epi16(a, b);
+}
+
+#include "minimp3_simd.h"
+
+}
+#pragma GCC pop_options
+#endif
+
 static void compute_antialias(mp3_context_t *s, granule_t *g) {
-    int32_t *ptr, *csa;
+    int32_t *ptr;
+    const int32_t *csa;
     int n, i;
 
     /* we antialias only "long" bands */
@@ -1211,9 +1335,15 @@ static void compute_antialias(mp3_context_t *s, granule_t *g) {
     }
 
     ptr = g->sb_hybrid + 18;
+#ifdef __SSE2__
+    if (s->tab->simd == 2)
+        return avx2::antialias(ptr, n, s->tab->csa_lanes);
+    if (s->tab->simd == 1)
+        return sse2::antialias(ptr, n, s->tab->csa_lanes);
+#endif
     for(i = n;i > 0;i--) {
         int tmp0, tmp1, tmp2;
-        csa = &csa_table[0][0];
+        csa = &s->tab->csa_table[0][0];
 #define INT_AA(j) \
             tmp0 = ptr[-1-j];\
             tmp1 = ptr[   j];\
@@ -1242,16 +1372,16 @@ static void compute_stereo(
     int i, j, k, l;
     int32_t v1, v2;
     int sf_max, tmp0, tmp1, sf, len, non_zero_found;
-    int32_t (*is_tab)[16];
+    const int32_t (*is_tab)[16];
     int32_t *tab0, *tab1;
     int non_zero_found_short[3];
 
     if (s->mode_ext & MODE_EXT_I_STEREO) {
         if (!s->lsf) {
-            is_tab = is_table;
+            is_tab = s->tab->is_table;
             sf_max = 7;
         } else {
-            is_tab = is_table_lsf[g1->scalefac_compress & 1];
+            is_tab = s->tab->is_table_lsf[g1->scalefac_compress & 1];
             sf_max = 16;
         }
 
@@ -1368,7 +1498,7 @@ static int huffman_decode(
     int s_index;
     int i;
     int last_pos, bits_left;
-    vlc_t *vlc;
+    const vlc_t *vlc;
     int end_pos= s->gb.size_in_bits;
     if (end_pos2 < end_pos) end_pos = end_pos2;
 
@@ -1383,7 +1513,7 @@ static int huffman_decode(
         k = g->table_select[i];
         l = mp3_huff_data[k][0];
         linbits = mp3_huff_data[k][1];
-        vlc = &huff_vlc[l];
+        vlc = &s->tab->huff_vlc[l];
 
         if(!l){
             memset(&g->sb_hybrid[s_index], 0, sizeof(*g->sb_hybrid)*2*j);
@@ -1416,19 +1546,19 @@ static int huffman_decode(
                 x = y >> 5;
                 y = y & 0x0f;
                 if (x < 15){
-                    v = expval_table[ exponent ][ x ];
+                    v = s->tab->expval_table[ exponent ][ x ];
                 }else{
                     x += get_bitsz(&s->gb, linbits);
-                    v = l3_unscale(x, exponent);
+                    v = l3_unscale(s->tab, x, exponent);
                 }
                 if (get_bits1(&s->gb))
                     v = -v;
                 g->sb_hybrid[s_index] = v;
                 if (y < 15){
-                    v = expval_table[ exponent ][ y ];
+                    v = s->tab->expval_table[ exponent ][ y ];
                 }else{
                     y += get_bitsz(&s->gb, linbits);
-                    v = l3_unscale(y, exponent);
+                    v = l3_unscale(s->tab, y, exponent);
                 }
                 if (get_bits1(&s->gb))
                     v = -v;
@@ -1438,10 +1568,10 @@ static int huffman_decode(
                 y = y & 0x0f;
                 x += y;
                 if (x < 15){
-                    v = expval_table[ exponent ][ x ];
+                    v = s->tab->expval_table[ exponent ][ x ];
                 }else{
                     x += get_bitsz(&s->gb, linbits);
-                    v = l3_unscale(x, exponent);
+                    v = l3_unscale(s->tab, x, exponent);
                 }
                 if (get_bits1(&s->gb))
                     v = -v;
@@ -1453,7 +1583,7 @@ static int huffman_decode(
     }
 
     /* high frequencies */
-    vlc = &huff_quad_vlc[g->count1table_select];
+    vlc = &s->tab->huff_quad_vlc[g->count1table_select];
     last_pos=0;
     while (s_index <= 572) {
         int pos, code;
@@ -1482,7 +1612,7 @@ static int huffman_decode(
             int v;
             int pos= s_index+idxtab[code];
             code ^= 8>>idxtab[code];
-            v = exp_table[ exponents[pos] ];
+            v = s->tab->exp_table[ exponents[pos] ];
             if(get_bits1(&s->gb))
                 v = -v;
             g->sb_hybrid[pos] = v;
@@ -1519,11 +1649,11 @@ static void imdct12(int *out, int *in)
     in5 += in3;
     in3 += in1;
 
-    in2= MULH(2*in2, C3);
-    in3= MULH(4*in3, C3);
+    in2= MULH(2*(int64_t)in2, C3);
+    in3= MULH(4*(int64_t)in3, C3);
 
     t1 = in0 - in4;
-    t2 = MULH(2*(in1 - in5), icos36h[4]);
+    t2 = MULH(2*(int64_t)(in1 - in5), icos36h[4]);
 
     out[ 7]=
     out[10]= t1 + t2;
@@ -1540,14 +1670,14 @@ static void imdct12(int *out, int *in)
     out[ 3]= in4 - in1;
 
     in0 -= in2;
-    in5 = MULH(2*(in5 - in3), icos36h[7]);
+    in5 = MULH(2*(int64_t)(in5 - in3), icos36h[7]);
     out[ 0]=
     out[ 5]= in0 - in5;
     out[ 6]=
     out[11]= in0 + in5;
 }
 
-static void imdct36(int *out, int *buf, int *in, int *win)
+static void imdct36(int *out, int *buf, int *in, const int *win)
 {
     int i, j, t0, t1, t2, t3, s0, s1, s2, s3;
     int tmp[18], *tmp1, *in1;
@@ -1567,20 +1697,20 @@ static void imdct36(int *out, int *buf, int *in, int *win)
         tmp1[ 6] = t1 - (t2>>1);
         tmp1[16] = t1 + t2;
 
-        t0 = MULH(2*(in1[2*2] + in1[2*4]),    C2);
+        t0 = MULH(2*(int64_t)(in1[2*2] + in1[2*4]),    C2);
         t1 = MULH(   in1[2*4] - in1[2*8] , -2*C8);
-        t2 = MULH(2*(in1[2*2] + in1[2*8]),   -C4);
+        t2 = MULH(2*(int64_t)(in1[2*2] + in1[2*8]),   -C4);
 
         tmp1[10] = t3 - t0 - t2;
         tmp1[ 2] = t3 + t0 + t1;
         tmp1[14] = t3 + t2 - t1;
 
-        tmp1[ 4] = MULH(2*(in1[2*5] + in1[2*7] - in1[2*1]), -C3);
-        t2 = MULH(2*(in1[2*1] + in1[2*5]),    C1);
+        tmp1[ 4] = MULH(2*(int64_t)(in1[2*5] + in1[2*7] - in1[2*1]), -C3);
+        t2 = MULH(2*(int64_t)(in1[2*1] + in1[2*5]),    C1);
         t3 = MULH(   in1[2*5] - in1[2*7] , -2*C7);
-        t0 = MULH(2*in1[2*3], C3);
+        t0 = MULH(2*(int64_t)in1[2*3], C3);
 
-        t1 = MULH(2*(in1[2*1] + in1[2*7]),   -C5);
+        t1 = MULH(2*(int64_t)(in1[2*1] + in1[2*7]),   -C5);
 
         tmp1[ 0] = t2 + t3 + t0;
         tmp1[12] = t2 + t1 - t0;
@@ -1596,41 +1726,42 @@ static void imdct36(int *out, int *buf, int *in, int *win)
 
         t2 = tmp[i + 1];
         t3 = tmp[i + 3];
-        s1 = MULH(2*(t3 + t2), icos36h[j]);
+        s1 = MULH(2*(int64_t)(t3 + t2), icos36h[j]);
         s3 = MULL(t3 - t2, icos36[8 - j]);
 
         t0 = s0 + s1;
         t1 = s0 - s1;
-        out[(9 + j)*SBLIMIT] =  MULH(t1, win[9 + j]) + buf[9 + j];
-        out[(8 - j)*SBLIMIT] =  MULH(t1, win[8 - j]) + buf[8 - j];
-        buf[9 + j] = MULH(t0, win[18 + 9 + j]);
-        buf[8 - j] = MULH(t0, win[18 + 8 - j]);
+        out[(9 + j)*SBLIMIT] =  MULH(t1, win[9 + j]) + buf[(9 + j)*SBLIMIT];
+        out[(8 - j)*SBLIMIT] =  MULH(t1, win[8 - j]) + buf[(8 - j)*SBLIMIT];
+        buf[(9 + j)*SBLIMIT] = MULH(t0, win[18 + 9 + j]);
+        buf[(8 - j)*SBLIMIT] = MULH(t0, win[18 + 8 - j]);
 
         t0 = s2 + s3;
         t1 = s2 - s3;
-        out[(9 + 8 - j)*SBLIMIT] =  MULH(t1, win[9 + 8 - j]) + buf[9 + 8 - j];
-        out[(        j)*SBLIMIT] =  MULH(t1, win[        j]) + buf[        j];
-        buf[9 + 8 - j] = MULH(t0, win[18 + 9 + 8 - j]);
-        buf[      + j] = MULH(t0, win[18         + j]);
+        out[(9 + 8 - j)*SBLIMIT] =  MULH(t1, win[9 + 8 - j]) + buf[(9 + 8 - j)*SBLIMIT];
+        out[(        j)*SBLIMIT] =  MULH(t1, win[        j]) + buf[(        j)*SBLIMIT];
+        buf[(9 + 8 - j)*SBLIMIT] = MULH(t0, win[18 + 9 + 8 - j]);
+        buf[(      + j)*SBLIMIT] = MULH(t0, win[18         + j]);
         i += 4;
     }
 
     s0 = tmp[16];
-    s1 = MULH(2*tmp[17], icos36h[4]);
+    s1 = MULH(2*(int64_t)tmp[17], icos36h[4]);
     t0 = s0 + s1;
     t1 = s0 - s1;
-    out[(9 + 4)*SBLIMIT] =  MULH(t1, win[9 + 4]) + buf[9 + 4];
-    out[(8 - 4)*SBLIMIT] =  MULH(t1, win[8 - 4]) + buf[8 - 4];
-    buf[9 + 4] = MULH(t0, win[18 + 9 + 4]);
-    buf[8 - 4] = MULH(t0, win[18 + 8 - 4]);
+    out[(9 + 4)*SBLIMIT] =  MULH(t1, win[9 + 4]) + buf[(9 + 4)*SBLIMIT];
+    out[(8 - 4)*SBLIMIT] =  MULH(t1, win[8 - 4]) + buf[(8 - 4)*SBLIMIT];
+    buf[(9 + 4)*SBLIMIT] = MULH(t0, win[18 + 9 + 4]);
+    buf[(8 - 4)*SBLIMIT] = MULH(t0, win[18 + 8 - 4]);
 }
 
 static void compute_imdct(
     mp3_context_t *s, granule_t *g, int32_t *sb_samples, int32_t *mdct_buf
 ) {
-    int32_t *ptr, *win, *win1, *buf, *out_ptr, *ptr1;
+    int32_t *ptr, *buf, *out_ptr, *ptr1;
+    const int32_t *win, *win1;
     int32_t out2[12];
-    int i, j, mdct_long_end, v, sblimit;
+    int i, j, mdct_long_end, v, sblimit, n36 = 0, n12 = 0;
 
     /* find last non zero block */
     ptr = g->sb_hybrid + 576;
@@ -1653,63 +1784,83 @@ static void compute_imdct(
         mdct_long_end = sblimit;
     }
 
+    /* the vector versions take the last n36 long and the last n12 short
+       subbands, whole vectors of them, and the scalar loops the rest;
+       the two long subbands of a mixed block have a window of their own */
+#ifdef __SSE2__
+    if (s->tab->simd == 2) {
+        n36 = avx2::imdct36_bands(sb_samples, mdct_buf, g->sb_hybrid,
+                  s->tab->mdct_win_lanes[g->block_type], 2 * g->switch_point, mdct_long_end);
+        n12 = avx2::imdct12_bands(sb_samples, mdct_buf, g->sb_hybrid,
+                  s->tab->mdct_win_lanes[2], mdct_long_end, sblimit);
+    } else if (s->tab->simd == 1) {
+        n36 = sse2::imdct36_bands(sb_samples, mdct_buf, g->sb_hybrid,
+                  s->tab->mdct_win_lanes[g->block_type], 2 * g->switch_point, mdct_long_end);
+        n12 = sse2::imdct12_bands(sb_samples, mdct_buf, g->sb_hybrid,
+                  s->tab->mdct_win_lanes[2], mdct_long_end, sblimit);
+    }
+#endif
+
     buf = mdct_buf;
     ptr = g->sb_hybrid;
-    for(j=0;j<mdct_long_end;j++) {
+    for(j=0;j<mdct_long_end - n36;j++) {
         /* apply window & overlap with previous buffer */
         out_ptr = sb_samples + j;
         /* select window */
         if (g->switch_point && j < 2)
-            win1 = mdct_win[0];
+            win1 = s->tab->mdct_win[0];
         else
-            win1 = mdct_win[g->block_type];
+            win1 = s->tab->mdct_win[g->block_type];
         /* select frequency inversion */
         win = win1 + ((4 * 36) & -(j & 1));
         imdct36(out_ptr, buf, ptr, win);
         out_ptr += 18*SBLIMIT;
         ptr += 18;
-        buf += 18;
+        buf++;
     }
-    for(j=mdct_long_end;j<sblimit;j++) {
+    buf = mdct_buf + mdct_long_end;
+    ptr = g->sb_hybrid + 18 * mdct_long_end;
+    for(j=mdct_long_end;j<sblimit - n12;j++) {
         /* select frequency inversion */
-        win = mdct_win[2] + ((4 * 36) & -(j & 1));
+        win = s->tab->mdct_win[2] + ((4 * 36) & -(j & 1));
         out_ptr = sb_samples + j;
 
         for(i=0; i<6; i++){
-            *out_ptr = buf[i];
+            *out_ptr = buf[i*SBLIMIT];
             out_ptr += SBLIMIT;
         }
         imdct12(out2, ptr + 0);
         for(i=0;i<6;i++) {
-            *out_ptr = MULH(out2[i], win[i]) + buf[i + 6*1];
-            buf[i + 6*2] = MULH(out2[i + 6], win[i + 6]);
+            *out_ptr = MULH(out2[i], win[i]) + buf[(i + 6*1)*SBLIMIT];
+            buf[(i + 6*2)*SBLIMIT] = MULH(out2[i + 6], win[i + 6]);
             out_ptr += SBLIMIT;
         }
         imdct12(out2, ptr + 1);
         for(i=0;i<6;i++) {
-            *out_ptr = MULH(out2[i], win[i]) + buf[i + 6*2];
-            buf[i + 6*0] = MULH(out2[i + 6], win[i + 6]);
+            *out_ptr = MULH(out2[i], win[i]) + buf[(i + 6*2)*SBLIMIT];
+            buf[(i + 6*0)*SBLIMIT] = MULH(out2[i + 6], win[i + 6]);
             out_ptr += SBLIMIT;
         }
         imdct12(out2, ptr + 2);
         for(i=0;i<6;i++) {
-            buf[i + 6*0] = MULH(out2[i], win[i]) + buf[i + 6*0];
-            buf[i + 6*1] = MULH(out2[i + 6], win[i + 6]);
-            buf[i + 6*2] = 0;
+            buf[(i + 6*0)*SBLIMIT] = MULH(out2[i], win[i]) + buf[(i + 6*0)*SBLIMIT];
+            buf[(i + 6*1)*SBLIMIT] = MULH(out2[i + 6], win[i + 6]);
+            buf[(i + 6*2)*SBLIMIT] = 0;
         }
         ptr += 18;
-        buf += 18;
+        buf++;
     }
+    buf = mdct_buf + sblimit;
     /* zero bands */
     for(j=sblimit;j<SBLIMIT;j++) {
         /* overlap */
         out_ptr = sb_samples + j;
         for(i=0;i<18;i++) {
-            *out_ptr = buf[i];
-            buf[i] = 0;
+            *out_ptr = buf[i*SBLIMIT];
+            buf[i*SBLIMIT] = 0;
             out_ptr += SBLIMIT;
         }
-        buf += 18;
+        buf++;
     }
 }
 
@@ -1977,13 +2128,14 @@ static void dct32(int32_t *out, int32_t *tab)
 
 static void mp3_synth_filter(
     int16_t *synth_buf_ptr, int *synth_buf_offset,
-    int16_t *window, int *dither_state,
+    const mp3_tables_t *t, int *dither_state,
     int16_t *samples, int incr,
     int32_t sb_samples[SBLIMIT]
 ) {
     int32_t tmp[32];
     register int16_t *synth_buf;
     register const int16_t *w, *w2, *p;
+    const int16_t *window = t->window;
     int j, offset, v;
     int16_t *samples2;
     int sum, sum2;
@@ -2007,6 +2159,40 @@ static void mp3_synth_filter(
     memcpy(synth_buf + 512, synth_buf, 32 * sizeof(int16_t));
 
     samples2 = samples + 31 * incr;
+
+#ifdef __SSE2__
+    if (t->simd) {
+        /* the same products, summed in another order; the sums wrap the
+           same way, so only the rounding has to stay in sequence */
+        int32_t sums[32];
+        if (t->simd == 2)
+            avx2::synth_window(synth_buf, t->synth_win, sums);
+        else
+            sse2::synth_window(synth_buf, t->synth_win, sums);
+
+        sum = *dither_state + sums[0];
+        *samples = round_sample(&sum);
+        samples += incr;
+        for(j=1;j<16;j++) {
+            sum += sums[j];
+            *samples = round_sample(&sum);
+            samples += incr;
+            sum += sums[16 + j];
+            *samples2 = round_sample(&sum);
+            samples2 -= incr;
+        }
+
+        p = synth_buf + 32;
+        SUM8(sum, -=, window + 48, p);
+        *samples = round_sample(&sum);
+        *dither_state= sum;
+
+        offset = (offset - 32) & 511;
+        *synth_buf_offset = offset;
+        return;
+    }
+#endif
+
     w = window;
     w2 = window + 31;
 
@@ -2087,8 +2273,8 @@ static int mp_decode_layer3(mp3_context_t *s) {
     int nb_granules, main_data_begin, private_bits;
     int gr, ch, blocksplit_flag, i, j, k, n, bits_pos;
     granule_t *g;
-    static granule_t granules[2][2];
-    static int16_t exponents[576];
+    granule_t (*granules)[2] = s->granules;
+    int16_t *exponents = s->exponents;
     const uint8_t *ptr;
 
     if (s->lsf) {
@@ -2155,13 +2341,13 @@ static int mp_decode_layer3(mp3_context_t *s) {
                 region_address1 = get_bits(&s->gb, 4);
                 region_address2 = get_bits(&s->gb, 3);
                 g->region_size[0] =
-                    band_index_long[s->sample_rate_index][region_address1 + 1] >> 1;
+                    s->tab->band_index_long[s->sample_rate_index][region_address1 + 1] >> 1;
                 l = region_address1 + region_address2 + 2;
                 /* should not overflow */
                 if (l > 22)
                     l = 22;
                 g->region_size[1] =
-                    band_index_long[s->sample_rate_index][l] >> 1;
+                    s->tab->band_index_long[s->sample_rate_index][l] >> 1;
             }
             /* convert region offsets to region sizes and truncate
                size to big_values */
@@ -2395,7 +2581,7 @@ static int mp3_decode_main(
         for(i=0;i<nb_frames;i++) {
             mp3_synth_filter(
                 s->synth_buf[ch], &(s->synth_buf_offset[ch]),
-                window, &s->dither_state,
+                s->tab, &s->dither_state,
                 samples_ptr, s->nb_channels,
                 s->sb_samples[ch][i]
             );
@@ -2407,166 +2593,197 @@ static int mp3_decode_main(
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static int mp3_decode_init(mp3_context_t *s) {
-    static int init=0;
-    int i, j, k;
+_mp3_tables::_mp3_tables() {
+    int i, j, k, l;
 
-    if (!init) {
-        /* synth init */
-        for(i=0;i<257;i++) {
-            int v;
-            v = mp3_enwindow[i];
-            #if WFRAC_BITS < 16
-                v = (v + (1 << (16 - WFRAC_BITS - 1))) >> (16 - WFRAC_BITS);
-            #endif
-            window[i] = v;
-            if ((i & 63) != 0)
-                v = -v;
-            if (i != 0)
-                window[512 - i] = v;
-        }
+    /* synth init */
+    for(i=0;i<257;i++) {
+        int v;
+        v = mp3_enwindow[i];
+        #if WFRAC_BITS < 16
+            v = (v + (1 << (16 - WFRAC_BITS - 1))) >> (16 - WFRAC_BITS);
+        #endif
+        window[i] = v;
+        if ((i & 63) != 0)
+            v = -v;
+        if (i != 0)
+            window[512 - i] = v;
+    }
 
-        /* huffman decode tables */
-        for(i=1;i<16;i++) {
-            const huff_table_t *h = &mp3_huff_tables[i];
-            int xsize, x, y;
-            unsigned int n;
-            uint8_t  tmp_bits [512];
-            uint16_t tmp_codes[512];
+    /* huffman decode tables */
+    for(i=1;i<16;i++) {
+        const huff_table_t *h = &mp3_huff_tables[i];
+        int xsize, x, y;
+        unsigned int n;
+        uint8_t  tmp_bits [512];
+        uint16_t tmp_codes[512];
+
+        memset(tmp_bits , 0, sizeof(tmp_bits ));
+        memset(tmp_codes, 0, sizeof(tmp_codes));
+
+        xsize = h->xsize;
+        n = xsize * xsize;
+
+        j = 0;
+        for(x=0;x<xsize;x++) {
+            for(y=0;y<xsize;y++){
+                tmp_bits [(x << 5) | y | ((x&&y)<<4)]= h->bits [j  ];
+                tmp_codes[(x << 5) | y | ((x&&y)<<4)]= h->codes[j++];
+            }
+        }
 
-            memset(tmp_bits , 0, sizeof(tmp_bits ));
-            memset(tmp_codes, 0, sizeof(tmp_codes));
+        init_vlc(&huff_vlc[i], 7, 512,
+                 tmp_bits, 1, 1, tmp_codes, 2, 2);
+    }
+    for(i=0;i<2;i++) {
+        init_vlc(&huff_quad_vlc[i], i == 0 ? 7 : 4, 16,
+                 mp3_quad_bits[i], 1, 1, mp3_quad_codes[i], 1, 1);
+    }
 
-            xsize = h->xsize;
-            n = xsize * xsize;
+    for(i=0;i<9;i++) {
+        k = 0;
+        for(j=0;j<22;j++) {
+            band_index_long[i][j] = k;
+            k += band_size_long[i][j];
+        }
+        band_index_long[i][22] = k;
+    }
 
-            j = 0;
-            for(x=0;x<xsize;x++) {
-                for(y=0;y<xsize;y++){
-                    tmp_bits [(x << 5) | y | ((x&&y)<<4)]= h->bits [j  ];
-                    tmp_codes[(x << 5) | y | ((x&&y)<<4)]= h->codes[j++];
-                }
-            }
+    /* compute n ^ (4/3) and store it in mantissa/exp format */
+    for(i=1;i<TABLE_4_3_SIZE;i++) {
+        double f, fm;
+        int e, m;
+        f = pow((double)(i/4), 4.0 / 3.0) * pow(2, (i&3)*0.25);
+        fm = frexp(f, &e);
+        m = (uint32_t)(fm*(1LL<<31) + 0.5);
+        e+= FRAC_BITS - 31 + 5 - 100;
+        table_4_3_value[i] = m;
+        table_4_3_exp[i] = -e;
+    }
+    for(i=0; i<512*16; i++){
+        int exponent= (i>>4);
+        double f= pow(i&15, 4.0 / 3.0) * pow(2, (exponent-400)*0.25 + FRAC_BITS + 5);
+        expval_table[exponent][i&15]= f;
+        if((i&15)==1)
+            exp_table[exponent]= f;
+    }
 
-            init_vlc(&huff_vlc[i], 7, 512,
-                     tmp_bits, 1, 1, tmp_codes, 2, 2);
+    for(i=0;i<7;i++) {
+        float f;
+        int v;
+        if (i != 6) {
+            f = tan((double)i * M_PI / 12.0);
+            v = FIXR(f / (1.0 + f));
+        } else {
+            v = FIXR(1.0);
         }
-        for(i=0;i<2;i++) {
-            init_vlc(&huff_quad_vlc[i], i == 0 ? 7 : 4, 16,
-                     mp3_quad_bits[i], 1, 1, mp3_quad_codes[i], 1, 1);
+        is_table[0][i] = v;
+        is_table[1][6 - i] = v;
+    }
+    for(i=7;i<16;i++)
+        is_table[0][i] = is_table[1][i] = 0.0;
+
+    for(i=0;i<16;i++) {
+        double f;
+        int e, k;
+
+        for(j=0;j<2;j++) {
+            e = -(j + 1) * ((i + 1) >> 1);
+            f = pow(2.0, e / 4.0);
+            k = i & 1;
+            is_table_lsf[j][k ^ 1][i] = FIXR(f);
+            is_table_lsf[j][k][i] = FIXR(1.0);
         }
+    }
 
-        for(i=0;i<9;i++) {
-            k = 0;
-            for(j=0;j<22;j++) {
-                band_index_long[i][j] = k;
-                k += band_size_long[i][j];
-            }
-            band_index_long[i][22] = k;
-        }
+    for(i=0;i<8;i++) {
+        float ci, cs, ca;
+        ci = ci_table[i];
+        cs = 1.0 / sqrt(1.0 + ci * ci);
+        ca = cs * ci;
+        csa_table[i][0] = FIXHR(cs/4);
+        csa_table[i][1] = FIXHR(ca/4);
+        csa_table[i][2] = FIXHR(ca/4) + FIXHR(cs/4);
+        csa_table[i][3] = FIXHR(ca/4) - FIXHR(cs/4);
+        csa_table_float[i][0] = cs;
+        csa_table_float[i][1] = ca;
+        csa_table_float[i][2] = ca + cs;
+        csa_table_float[i][3] = ca - cs;
+    }
 
-        /* compute n ^ (4/3) and store it in mantissa/exp format */
-        table_4_3_exp= (int8_t *)(malloc(TABLE_4_3_SIZE * sizeof(table_4_3_exp[0])));
-        if(!table_4_3_exp)
-            return -1;
-        table_4_3_value= (uint32_t *)(malloc(TABLE_4_3_SIZE * sizeof(table_4_3_value[0])));
-        if(!table_4_3_value)
-            return -1;
+    /* compute mdct windows */
+    for(i=0;i<36;i++) {
+        for(j=0; j<4; j++){
+            double d;
 
-        for(i=1;i<TABLE_4_3_SIZE;i++) {
-            double f, fm;
-            int e, m;
-            f = pow((double)(i/4), 4.0 / 3.0) * pow(2, (i&3)*0.25);
-            fm = frexp(f, &e);
-            m = (uint32_t)(fm*(1LL<<31) + 0.5);
-            e+= FRAC_BITS - 31 + 5 - 100;
-            table_4_3_value[i] = m;
-            table_4_3_exp[i] = -e;
-        }
-        for(i=0; i<512*16; i++){
-            int exponent= (i>>4);
-            double f= pow(i&15, 4.0 / 3.0) * pow(2, (exponent-400)*0.25 + FRAC_BITS + 5);
-            expval_table[exponent][i&15]= f;
-            if((i&15)==1)
-                exp_table[exponent]= f;
-        }
+            if(j==2 && i%3 != 1)
+                continue;
 
-        for(i=0;i<7;i++) {
-            float f;
-            int v;
-            if (i != 6) {
-                f = tan((double)i * M_PI / 12.0);
-                v = FIXR(f / (1.0 + f));
-            } else {
-                v = FIXR(1.0);
-            }
-            is_table[0][i] = v;
-            is_table[1][6 - i] = v;
-        }
-        for(i=7;i<16;i++)
-            is_table[0][i] = is_table[1][i] = 0.0;
-
-        for(i=0;i<16;i++) {
-            double f;
-            int e, k;
-
-            for(j=0;j<2;j++) {
-                e = -(j + 1) * ((i + 1) >> 1);
-                f = pow(2.0, e / 4.0);
-                k = i & 1;
-                is_table_lsf[j][k ^ 1][i] = FIXR(f);
-                is_table_lsf[j][k][i] = FIXR(1.0);
+            d= sin(M_PI * (i + 0.5) / 36.0);
+            if(j==1){
+                if     (i>=30) d= 0;
+                else if(i>=24) d= sin(M_PI * (i - 18 + 0.5) / 12.0);
+                else if(i>=18) d= 1;
+            }else if(j==3){
+                if     (i<  6) d= 0;
+                else if(i< 12) d= sin(M_PI * (i -  6 + 0.5) / 12.0);
+                else if(i< 18) d= 1;
             }
+            d*= 0.5 / cos(M_PI*(2*i + 19)/72);
+            if(j==2)
+                mdct_win[j][i/3] = FIXHR((d / (1<<5)));
+            else
+                mdct_win[j][i  ] = FIXHR((d / (1<<5)));
         }
-
-        for(i=0;i<8;i++) {
-            float ci, cs, ca;
-            ci = ci_table[i];
-            cs = 1.0 / sqrt(1.0 + ci * ci);
-            ca = cs * ci;
-            csa_table[i][0] = FIXHR(cs/4);
-            csa_table[i][1] = FIXHR(ca/4);
-            csa_table[i][2] = FIXHR(ca/4) + FIXHR(cs/4);
-            csa_table[i][3] = FIXHR(ca/4) - FIXHR(cs/4);
-            csa_table_float[i][0] = cs;
-            csa_table_float[i][1] = ca;
-            csa_table_float[i][2] = ca + cs;
-            csa_table_float[i][3] = ca - cs;
+    }
+    for(j=0;j<4;j++) {
+        for(i=0;i<36;i+=2) {
+            mdct_win[j + 4][i] = mdct_win[j][i];
+            mdct_win[j + 4][i + 1] = -mdct_win[j][i + 1];
         }
+    }
 
-        /* compute mdct windows */
-        for(i=0;i<36;i++) {
-            for(j=0; j<4; j++){
-                double d;
-
-                if(j==2 && i%3 != 1)
-                    continue;
-
-                d= sin(M_PI * (i + 0.5) / 36.0);
-                if(j==1){
-                    if     (i>=30) d= 0;
-                    else if(i>=24) d= sin(M_PI * (i - 18 + 0.5) / 12.0);
-                    else if(i>=18) d= 1;
-                }else if(j==3){
-                    if     (i<  6) d= 0;
-                    else if(i< 12) d= sin(M_PI * (i -  6 + 0.5) / 12.0);
-                    else if(i< 18) d= 1;
-                }
-                d*= 0.5 / cos(M_PI*(2*i + 19)/72);
-                if(j==2)
-                    mdct_win[j][i/3] = FIXHR((d / (1<<5)));
-                else
-                    mdct_win[j][i  ] = FIXHR((d / (1<<5)));
-            }
-        }
-        for(j=0;j<4;j++) {
-            for(i=0;i<36;i+=2) {
-                mdct_win[j + 4][i] = mdct_win[j][i];
-                mdct_win[j + 4][i + 1] = -mdct_win[j][i + 1];
-            }
+    /* the same for the vector versions: lane by lane, so that odd
+       subbands get the inverted windows, and the synthesis window in
+       pairs for two sums at a time */
+    for(i=0;i<8;i++) {
+        csa_lanes[0][i] = csa_table[i][0];
+        csa_lanes[1][i] = csa_table[i][2];
+        csa_lanes[2][i] = csa_table[i][3];
+    }
+    for(j=0;j<4;j++)
+        for(k=0;k<2;k++)
+            for(i=0;i<36;i++)
+                for(l=0;l<8;l++)
+                    mdct_win_lanes[j][k][i][l] = mdct_win[j + 4 * ((k + l) & 1)][i];
+    for(k=0;k<8;k++) {
+        for(j=0;j<16;j++) {
+            synth_win[k][0][2*j    ] =  window[j      + 64*k];
+            synth_win[k][0][2*j + 1] = -window[j + 32 + 64*k];
+            synth_win[k][1][2*j    ] = j ? -window[32 - j + 64*k] : 0;
+            synth_win[k][1][2*j + 1] = j ? -window[64 - j + 64*k] : 0;
         }
-        init = 1;
     }
+
+#ifdef __SSE2__
+    /* MP3_SIMD=0 or 1 in the environment holds it down, for comparing */
+    simd = __builtin_cpu_supports("avx2") ? 2 : 1;
+    if (getenv("MP3_SIMD") && atoi(getenv("MP3_SIMD")) < simd)
+        simd = atoi(getenv("MP3_SIMD"));
+#else
+    simd = 0;
+#endif
+}
+
+/* a function local static is constructed exactly once, even when several
+   threads create their first decoder at the same time */
+static const mp3_tables_t &mp3_tables() {
+    static const mp3_tables_t tables;
+    return tables;
+}
+
+static int mp3_decode_init(mp3_context_t *s) {
+    s->tab = &mp3_tables();
     return 0;
 }
 
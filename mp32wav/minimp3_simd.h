@@ -0,0 +1,242 @@
+/*
+ * Vector versions of the layer 3 antialias butterflies, IMDCTs and
+ * synthesis window. minimp3.cpp includes this file once per instruction
+ * set, inside a namespace that provides the vector type vec, its width W
+ * in 32 bit lanes and the operations on it. Every operation wraps like
+ * the scalar int arithmetic, which the Makefile builds with -fwrapv, so
+ * the results are bit exact. Where the scalar code doubles a factor of a
+ * constant product it widens first, MULH(2*(int64_t)x, C3), because on
+ * loud streams 2*x no longer fits in 32 bits; vmuls(x, C3, 31) takes the
+ * same bits of the same 64 bit product.
+ *
+ * The IMDCTs run W subbands side by side, lane l on subband start + l.
+ * The overlap buffer and the output are time major, so a time slot of W
+ * neighbouring subbands is one load or store.
+ */
+
+/* MULH and MULL */
+static INLINE vec vmulh(vec a, vec b) { return vmuls(a, b, 32); }
+static INLINE vec vmull(vec a, vec b) { return vmuls(a, b, FRAC_BITS); }
+
+/* x[i] = in[i] of the W subbands from in on */
+static INLINE void load_columns(vec *x, const int32_t *in)
+{
+    for (int i = 0; i < 18; i++)
+        x[i] = vcolumn(in + i);
+}
+
+/* output i from v, the overlap for the next granule from v2 */
+static INLINE void overlap_add(
+    int32_t *out, int32_t *buf, const int32_t (*win)[8], int i, vec v, vec v2
+) {
+    vstore(out + i * SBLIMIT, vadd(vmulh(v, vload(win[i])), vload(buf + i * SBLIMIT)));
+    vstore(buf + i * SBLIMIT, vmulh(v2, vload(win[i + 18])));
+}
+
+/* compute_antialias over n subband boundaries, csa[0..2] are the
+   coefficients 0, 2 and 3 of csa_table, by butterfly */
+static void antialias(int32_t *ptr, int n, const int32_t (*csa)[8])
+{
+    for (; n > 0; n--, ptr += 18) {
+        for (int h = 0; h < 8; h += W) {
+            vec tmp0 = vreverse(vload(ptr - h - W));
+            vec tmp1 = vload(ptr + h);
+            vec tmp2 = vmulh(vadd(tmp0, tmp1), vload(csa[0] + h));
+            vstore(ptr - h - W, vreverse(vsll(vsub(tmp2, vmulh(tmp1, vload(csa[1] + h))), 2)));
+            vstore(ptr + h, vsll(vadd(tmp2, vmulh(tmp0, vload(csa[2] + h))), 2));
+        }
+    }
+}
+
+/* imdct36 on the last subbands of [begin, end), as many as fill whole
+   vectors; returns how many */
+static int imdct36_bands(
+    int32_t *out, int32_t *buf, const int32_t *in,
+    const int32_t (*win_lanes)[36][8], int begin, int end
+) {
+    int n = end - begin < 0 ? 0 : (end - begin) / W * W;
+    int start = end - n;
+    const int32_t (*win)[8] = win_lanes[start & 1];
+
+    out += start;
+    buf += start;
+    in += 18 * start;
+
+    for (int b = 0; b < n; b += W, out += W, buf += W, in += 18 * W) {
+        vec x[18], tmp[18], t0, t1, t2, t3, s0, s1, s2, s3;
+        load_columns(x, in);
+
+        for (int i = 17; i >= 1; i--)
+            x[i] = vadd(x[i], x[i - 1]);
+        for (int i = 17; i >= 3; i -= 2)
+            x[i] = vadd(x[i], x[i - 2]);
+
+        for (int j = 0; j < 2; j++) {
+            const vec *in1 = x + j;
+            vec *tmp1 = tmp + j;
+            t2 = vsub(vadd(in1[2*4], in1[2*8]), in1[2*2]);
+
+            t3 = vadd(in1[2*0], vsra(in1[2*6], 1));
+            t1 = vsub(in1[2*0], in1[2*6]);
+            tmp1[ 6] = vsub(t1, vsra(t2, 1));
+            tmp1[16] = vadd(t1, t2);
+
+            t0 = vmuls(vadd(in1[2*2], in1[2*4]), vset1(C2), 31);
+            t1 = vmulh(vsub(in1[2*4], in1[2*8]), vset1(-2*C8));
+            t2 = vmuls(vadd(in1[2*2], in1[2*8]), vset1(-C4), 31);
+
+            tmp1[10] = vsub(vsub(t3, t0), t2);
+            tmp1[ 2] = vadd(vadd(t3, t0), t1);
+            tmp1[14] = vsub(vadd(t3, t2), t1);
+
+            tmp1[ 4] = vmuls(vsub(vadd(in1[2*5], in1[2*7]), in1[2*1]), vset1(-C3), 31);
+            t2 = vmuls(vadd(in1[2*1], in1[2*5]), vset1(C1), 31);
+            t3 = vmulh(vsub(in1[2*5], in1[2*7]), vset1(-2*C7));
+            t0 = vmuls(in1[2*3], vset1(C3), 31);
+
+            t1 = vmuls(vadd(in1[2*1], in1[2*7]), vset1(-C5), 31);
+
+            tmp1[ 0] = vadd(vadd(t2, t3), t0);
+            tmp1[12] = vsub(vadd(t2, t1), t0);
+            tmp1[ 8] = vsub(vsub(t3, t1), t0);
+        }
+
+        for (int j = 0, i = 0; j < 4; j++, i += 4) {
+            t0 = tmp[i];
+            t1 = tmp[i + 2];
+            s0 = vadd(t1, t0);
+            s2 = vsub(t1, t0);
+
+            t2 = tmp[i + 1];
+            t3 = tmp[i + 3];
+            s1 = vmuls(vadd(t3, t2), vset1(icos36h[j]), 31);
+            s3 = vmull(vsub(t3, t2), vset1(icos36[8 - j]));
+
+            t0 = vadd(s0, s1);
+            t1 = vsub(s0, s1);
+            overlap_add(out, buf, win, 9 + j, t1, t0);
+            overlap_add(out, buf, win, 8 - j, t1, t0);
+
+            t0 = vadd(s2, s3);
+            t1 = vsub(s2, s3);
+            overlap_add(out, buf, win, 9 + 8 - j, t1, t0);
+            overlap_add(out, buf, win, j, t1, t0);
+        }
+
+        s0 = tmp[16];
+        s1 = vmuls(tmp[17], vset1(icos36h[4]), 31);
+        t0 = vadd(s0, s1);
+        t1 = vsub(s0, s1);
+        overlap_add(out, buf, win, 9 + 4, t1, t0);
+        overlap_add(out, buf, win, 8 - 4, t1, t0);
+    }
+
+    return n;
+}
+
+/* imdct12 of the samples in[0], in[3] ... in[15] */
+static INLINE void imdct12v(vec *out, const vec *in)
+{
+    vec in0, in1, in2, in3, in4, in5, t1, t2;
+
+    in0 = in[0*3];
+    in1 = vadd(in[1*3], in[0*3]);
+    in2 = vadd(in[2*3], in[1*3]);
+    in3 = vadd(in[3*3], in[2*3]);
+    in4 = vadd(in[4*3], in[3*3]);
+    in5 = vadd(in[5*3], in[4*3]);
+    in5 = vadd(in5, in3);
+    in3 = vadd(in3, in1);
+
+    in2 = vmuls(in2, vset1(C3), 31);
+    in3 = vmuls(in3, vset1(C3), 30);
+
+    t1 = vsub(in0, in4);
+    t2 = vmuls(vsub(in1, in5), vset1(icos36h[4]), 31);
+
+    out[ 7] = out[10] = vadd(t1, t2);
+    out[ 1] = out[ 4] = vsub(t1, t2);
+
+    in0 = vadd(in0, vsra(in4, 1));
+    in4 = vadd(in0, in2);
+    in5 = vadd(in5, vsll(in1, 1));
+    in1 = vmulh(vadd(in5, in3), vset1(icos36h[1]));
+    out[ 8] = out[ 9] = vadd(in4, in1);
+    out[ 2] = out[ 3] = vsub(in4, in1);
+
+    in0 = vsub(in0, in2);
+    in5 = vmuls(vsub(in5, in3), vset1(icos36h[7]), 31);
+    out[ 0] = out[ 5] = vsub(in0, in5);
+    out[ 6] = out[11] = vadd(in0, in5);
+}
+
+/* the short block loop of compute_imdct, on the last subbands of
+   [begin, end) like imdct36_bands */
+static int imdct12_bands(
+    int32_t *out, int32_t *buf, const int32_t *in,
+    const int32_t (*win_lanes)[36][8], int begin, int end
+) {
+    int n = end - begin < 0 ? 0 : (end - begin) / W * W;
+    int start = end - n;
+    const int32_t (*win)[8] = win_lanes[start & 1];
+
+    out += start;
+    buf += start;
+    in += 18 * start;
+
+    for (int b = 0; b < n; b += W, out += W, buf += W, in += 18 * W) {
+        vec x[18], out2[12];
+        load_columns(x, in);
+
+        for (int i = 0; i < 6; i++)
+            vstore(out + i * SBLIMIT, vload(buf + i * SBLIMIT));
+
+        imdct12v(out2, x + 0);
+        for (int i = 0; i < 6; i++) {
+            vstore(out + (i + 6) * SBLIMIT,
+                   vadd(vmulh(out2[i], vload(win[i])), vload(buf + (i + 6*1) * SBLIMIT)));
+            vstore(buf + (i + 6*2) * SBLIMIT, vmulh(out2[i + 6], vload(win[i + 6])));
+        }
+        imdct12v(out2, x + 1);
+        for (int i = 0; i < 6; i++) {
+            vstore(out + (i + 12) * SBLIMIT,
+                   vadd(vmulh(out2[i], vload(win[i])), vload(buf + (i + 6*2) * SBLIMIT)));
+            vstore(buf + (i + 6*0) * SBLIMIT, vmulh(out2[i + 6], vload(win[i + 6])));
+        }
+        imdct12v(out2, x + 2);
+        for (int i = 0; i < 6; i++) {
+            vstore(buf + (i + 6*0) * SBLIMIT,
+                   vadd(vmulh(out2[i], vload(win[i])), vload(buf + (i + 6*0) * SBLIMIT)));
+            vstore(buf + (i + 6*1) * SBLIMIT, vmulh(out2[i + 6], vload(win[i + 6])));
+            vstore(buf + (i + 6*2) * SBLIMIT, vset1(0));
+        }
+    }
+
+    return n;
+}
+
+/* the windowed sums of mp3_synth_filter before rounding: sums[j] for
+   output j, sums[16 + j] for output 32 - j, j = 1 ... 15, and sums[0]
+   for output 0. The window comes as int16 pairs for pmaddwd, coef[k][0]
+   for the first sums and coef[k][1] for the second */
+static void synth_window(const int16_t *synth_buf, const int16_t (*coef)[2][32], int32_t *sums)
+{
+    vec a[16 / W], b[16 / W], x[16 / W];
+
+    for (int m = 0; m < 16 / W; m++)
+        a[m] = b[m] = vset1(0);
+
+    for (int k = 0; k < 8; k++) {
+        vpairs(x, synth_buf + 16 + 64 * k, synth_buf + 48 + 64 * k);
+
+        for (int m = 0; m < 16 / W; m++) {
+            a[m] = vadd(a[m], vmadd16(x[m], vload16(coef[k][0] + 2 * W * m)));
+            b[m] = vadd(b[m], vmadd16(x[m], vload16(coef[k][1] + 2 * W * m)));
+        }
+    }
+
+    for (int m = 0; m < 16 / W; m++) {
+        vstore(sums + W * m, a[m]);
+        vstore(sums + 16 + W * m, b[m]);
+    }
+}
@@ -0,0 +1,221 @@
+//mp3batch [-j threads] [-b] file.mp3..., decodes every file to file.wav,
+//one decoder per thread. -b decodes the files in memory with 1, 2, 4 ...
+//threads instead and prints how the throughput scales; give it at least
+//as many files as threads, a file never spreads over two threads.
+
+#include "minimp3.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+//the decoder reads a few bytes past the frame it decodes
+static constexpr size_t PADDING = 64;
+
+struct Pcm
+{
+    std::vector<int16_t> samples;
+    int rate = 0, channels = 0;
+};
+
+static bool load(const char *fn, std::vector<uint8_t> &mp3)
+{
+    std::ifstream ifs(fn, std::ios::binary | std::ios::ate);
+
+    if (!ifs)
+        return false;
+
+    mp3.resize(size_t(ifs.tellg()) + PADDING);
+    ifs.seekg(0);
+    ifs.read((char *)mp3.data(), mp3.size() - PADDING);
+    return bool(ifs);
+}
+
+//false when not a single frame decodes
+static bool decode(const std::vector<uint8_t> &mp3, Pcm &pcm)
+{
+    mp3_decoder_t dec = mp3_create();
+    int16_t buf[MP3_MAX_SAMPLES_PER_FRAME];
+    mp3_info_t info;
+    uint8_t *pos = (uint8_t *)mp3.data();
+    int left = int(mp3.size() - PADDING);
+    pcm.samples.clear();
+
+    for (int n; left > 0 && (n = mp3_decode((mp3_decoder_t *)dec, pos, left, buf, &info)) > 0;
+         pos += n, left -= n)
+    {
+        //a frame that fails to decode still advances, but yields nothing
+        if (info.audio_bytes <= 0)
+            continue;
+
+        pcm.rate = info.sample_rate, pcm.channels = info.channels;
+        pcm.samples.insert(pcm.samples.end(), buf, buf + info.audio_bytes / 2);
+    }
+
+    mp3_done((mp3_decoder_t *)dec);
+    return pcm.channels > 0;
+}
+
+static void put16(std::ostream &os, uint16_t w)
+{
+    os.put(w & 0xff), os.put(w >> 8);
+}
+
+static void put32(std::ostream &os, uint32_t dw)
+{
+    put16(os, dw & 0xffff), put16(os, dw >> 16);
+}
+
+static bool writeWav(const std::string &fn, const Pcm &pcm)
+{
+    std::ofstream ofs(fn, std::ios::binary);
+    uint32_t bytes = uint32_t(pcm.samples.size() * 2);
+    ofs << "RIFF";
+    put32(ofs, 36 + bytes);
+    ofs << "WAVEfmt ";
+    put32(ofs, 16);
+    put16(ofs, 1);
+    put16(ofs, pcm.channels);
+    put32(ofs, pcm.rate);
+    put32(ofs, pcm.rate * pcm.channels * 2);
+    put16(ofs, pcm.channels * 2);
+    put16(ofs, 16);
+    ofs << "data";
+    put32(ofs, bytes);
+
+    for (int16_t s : pcm.samples)
+        put16(ofs, s);
+
+    return bool(ofs);
+}
+
+static std::string wavName(std::string fn)
+{
+    if (fn.size() > 4 && strcasecmp(fn.c_str() + fn.size() - 4, ".mp3") == 0)
+        fn.resize(fn.size() - 4);
+
+    return fn + ".wav";
+}
+
+//runs fn(i) for every i below n on the given number of threads
+template <class F> static void forEach(size_t n, unsigned nThreads, F fn)
+{
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> threads;
+
+    for (unsigned t = 0; t < nThreads; ++t)
+        threads.emplace_back([&] { for (size_t i; (i = next++) < n;) fn(i); });
+
+    for (std::thread &t : threads)
+        t.join();
+}
+
+static int convert(char **files, size_t n, unsigned nThreads)
+{
+    std::atomic<int> ret = 0;
+
+    forEach(n, nThreads, [&](size_t i)
+    {
+        std::vector<uint8_t> mp3;
+        Pcm pcm;
+        const char *err = nullptr;
+
+        if (!load(files[i], mp3))
+            err = "cannot read";
+        else if (!decode(mp3, pcm))
+            err = "not an MP3 file";
+        else if (!writeWav(wavName(files[i]), pcm))
+            err = "cannot write the WAV file for";
+
+        if (err)
+        {
+            std::string msg = std::string("mp3batch: ") + err + " " + files[i] + "\n";
+            std::cerr << msg;
+            ret = 1;
+        }
+    });
+
+    return ret;
+}
+
+static int bench(char **files, size_t n, unsigned maxThreads)
+{
+    std::vector<std::vector<uint8_t>> mp3(n);
+    std::vector<Pcm> pcm(n);
+    double audio = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!load(files[i], mp3[i]) || !decode(mp3[i], pcm[i]))
+        {
+            std::cerr << "mp3batch: cannot decode " << files[i] << "\n";
+            return 1;
+        }
+
+        audio += double(pcm[i].samples.size()) / pcm[i].channels / pcm[i].rate;
+    }
+
+    std::cout << "threads  seconds  x realtime  speedup  efficiency\n" << std::fixed;
+    double single = 0;
+
+    for (unsigned t = 1;; t = std::min(t * 2, maxThreads))
+    {
+        double secs = 1e9;
+
+        //the best of three, the first pass also warms the caches
+        for (int run = 0; run < 3; ++run)
+        {
+            auto start = std::chrono::steady_clock::now();
+            forEach(n, t, [&](size_t i) { decode(mp3[i], pcm[i]); });
+            secs = std::min(secs, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        if (t == 1)
+            single = secs;
+
+        std::cout << std::setw(7) << t << std::setprecision(3) << std::setw(9) << secs
+                  << std::setprecision(1) << std::setw(12) << audio / secs
+                  << std::setprecision(2) << std::setw(9) << single / secs
+                  << std::setw(12) << single / secs / t << "\n";
+
+        if (t == maxThreads)
+            break;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned nThreads = std::max(1U, std::thread::hardware_concurrency());
+    bool benchmark = false;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; ++i)
+    {
+        if (strcmp(argv[i], "-b") == 0)
+            benchmark = true;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            nThreads = std::max(1, atoi(argv[++i]));
+    }
+
+    if (i == argc)
+    {
+        std::cerr << "usage: mp3batch [-j threads] [-b] file.mp3...\n";
+        return 1;
+    }
+
+    if (benchmark)
+        return bench(argv + i, argc - i, nThreads);
+
+    return convert(argv + i, argc - i, nThreads);
+}
@@ -12,6 +12,11 @@
 #include <cassert>
 #include <iostream>
 #include <stdexcept>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using std::ifstream;
 using std::istream;
@@ -88,140 +93,165 @@ static void heapify(uint32_t i, const uint32_t n, Heap *heap)
     heap[i].set(heapsubi);
 }
 
-void pack(ifstream &ifs, ostream &os, uint32_t &insize, uint32_t &outsize)
-{           
-    uint32_t maxlev = 0;
+/* Huffman code lengths and bit patterns from doubled counts */
+class Code
+{
+public:
+    uint32_t insize = 0, maxlev = 0;
     uint32_t levcount[25] = {0};
     uint8_t length[END + 1];
     uint32_t bits[END + 1];
-            
-    {           
-        uint32_t count[END + 1] = {0};
-            
-        // gather frequency statistics
-        while (ifs.good())
+    void build(uint32_t *count);
+    char *header(char *outp) const;
+};
+
+void Code::build(uint32_t *count)
+{
+    uint32_t parent[2 * END + 1];
+
+    /* put occurring chars in heap with their counts */
+    {
+        count[END] = 1;
+        uint32_t n = 0;
+        insize = 0;
+
+        Heap g_heap[END + 2];
+
+        for (int i = END; i >= 0; i--)
         {
-            char g_inbuff[BLKSIZE];
-            ifs.read(g_inbuff, BLKSIZE);
-            uint32_t bytes_read = uint32_t(ifs.gcount());
+            parent[i] = 0;
 
-            for (uint32_t i = 0; i < bytes_read; ++i)
+            if (count[i] > 0)
             {
-                uint8_t byte = g_inbuff[i];
-                count[byte] += 2;
+                insize += count[i];
+                ++n;
+                g_heap[n].set(count[i], i);
             }
         }
 
-        uint32_t parent[2 * END + 1];
+        insize >>= 1;
 
-        /* put occurring chars in heap with their counts */
-        {
-            count[END] = 1;
-            uint32_t n = 0;
-            insize = 0;
+        for (uint32_t i = n / 2; i >= 1; --i)
+            heapify(i, n, g_heap);
 
-            Heap g_heap[END + 2];
+        /* build Huffman tree */
+        {
+            uint32_t lastnode = END;
 
-            for (int i = END; i >= 0; i--)
+            while (n > 1)
             {
-                parent[i] = 0;
-
-                if (count[i] > 0)
-                {
-                    insize += count[i];
-                    ++n;
-                    g_heap[n].set(count[i], i);
-                }
+                uint32_t tmp = g_heap[1].node();
+                parent[tmp] = ++lastnode;
+                uint32_t inc = g_heap[1].count();
+                g_heap[1].set(g_heap[n]);
+                n--;
+                heapify(1, n, g_heap);
+                tmp = g_heap[1].node();
+                parent[tmp] = lastnode;
+                tmp = g_heap[1].count();
+                g_heap[1].set(tmp + inc, lastnode);
+                heapify(1, n, g_heap);
             }
 
-            insize >>= 1;
+            parent[lastnode] = 0;
+        }
+    }
 
-            for (uint32_t i = n / 2; i >= 1; --i)
-                heapify(i, n, g_heap);
+    for (uint32_t i = 0; i <= END; i++)
+    {
+        uint32_t c = 0;
 
-            /* build Huffman tree */
-            {
-                uint32_t lastnode = END;
+        for (int p = parent[i]; p != 0; p = parent[p])
+            c++;
 
-                while (n > 1)
-                {
-                    uint32_t tmp = g_heap[1].node();
-                    parent[tmp] = ++lastnode;
-                    uint32_t inc = g_heap[1].count();
-                    g_heap[1].set(g_heap[n]);
-                    n--;
-                    heapify(1, n, g_heap);
-                    tmp = g_heap[1].node();
-                    parent[tmp] = lastnode;
-                    tmp = g_heap[1].count();
-                    g_heap[1].set(tmp + inc, lastnode);
-                    heapify(1, n, g_heap);
-                }
+        levcount[c]++;
+        length[i] = c;
+        maxlev = std::max(maxlev, c);
+    }
 
-                parent[lastnode] = 0;
+    if (maxlev > LEVEL_LIMIT)
+    {
+        /* can't occur unless insize >= 2**24 */
+        throw std::range_error(": Huffman tree has too many levels");
+    }
+
+    /* compute bit patterns for each character */
+    for (uint32_t i = maxlev, foo = 0, inc = 1 << (LEVEL_LIMIT - maxlev); i > 0; --i)
+    {
+        for (uint16_t c = 0; c <= END; ++c)
+        {
+            if (length[c] == i)
+            {
+                bits[c] = foo;
+                foo += inc;
             }
         }
 
-        for (uint32_t i = 0; i <= END; i++)
-        {
-            uint32_t c = 0;
+        foo &= ~inc;
+        inc <<= 1;
+    }
+}
 
-            for (int p = parent[i]; p != 0; p = parent[p])
-                c++;
+/* magic, size, levels and characters, at most 6 + 1 + 24 + 256 bytes */
+char *Code::header(char *outp) const
+{
+    outp[0] = 0x1f;
+    outp[1] = 0x1e;
+    long temp = insize;
 
-            levcount[c]++;
-            length[i] = c;
-            maxlev = std::max(maxlev, c);
-        }
+    for (int i = 5; i >= 2; --i)
+    {
+        outp[i] = char(temp & 0xff);
+        temp >>= 8;
+    }
 
-        if (maxlev > LEVEL_LIMIT)
-        {
-            /* can't occur unless insize >= 2**24 */
-            throw std::range_error(": Huffman tree has too many levels");
-        }
+    outp += 6;
+    *outp++ = maxlev;
+
+    for (uint32_t i = 1; i < maxlev; i++)
+        *outp++ = levcount[i];
+
+    *outp++ = levcount[maxlev] - 2;
+
+    for (uint32_t i = 1; i <= maxlev; ++i)
+        for (uint16_t j = 0; j < END; ++j)
+            if (length[j] == i)
+                *outp++ = j;
 
-        /* compute bit patterns for each character */
-        for (uint32_t i = maxlev, foo = 0, inc = 1 << (LEVEL_LIMIT - maxlev); i > 0; --i)
+    return outp;
+}
+
+void pack(ifstream &ifs, ostream &os, uint32_t &insize, uint32_t &outsize)
+{           
+    Code code;
+    const uint8_t *length = code.length;
+    const uint32_t *bits = code.bits;
+            
+    {           
+        uint32_t count[END + 1] = {0};
+            
+        // gather frequency statistics
+        while (ifs.good())
         {
-            for (uint16_t c = 0; c <= END; ++c)
+            char g_inbuff[BLKSIZE];
+            ifs.read(g_inbuff, BLKSIZE);
+            uint32_t bytes_read = uint32_t(ifs.gcount());
+
+            for (uint32_t i = 0; i < bytes_read; ++i)
             {
-                if (length[c] == i)
-                {
-                    bits[c] = foo;
-                    foo += inc;
-                }
+                uint8_t byte = g_inbuff[i];
+                count[byte] += 2;
             }
-
-            foo &= ~inc;
-            inc <<= 1;
         }
+
+        code.build(count);
+        insize = code.insize;
     }
 
     {
         char g_inbuff[BLKSIZE];
         char outbuff[BLKSIZE + 4];
-        outbuff[0] = 0x1f;
-        outbuff[1] = 0x1e;
-        long temp = insize;
-
-        for (int i = 5; i >= 2; --i)
-        {
-            outbuff[i] = char(temp & 0xff);
-            temp >>= 8;
-        }
-
-        char *outp = outbuff + 6;
-        *outp++ = maxlev;
-
-        for (uint32_t i = 1; i < maxlev; i++)
-            *outp++ = levcount[i];
-
-        *outp++ = levcount[maxlev] - 2;
-
-        for (uint32_t i = 1; i <= maxlev; ++i)
-            for (uint16_t j = 0; j < END; ++j)
-                if (length[j] == i)
-                    *outp++ = j;
+        char *outp = code.header(outbuff);
 
         //status bits moeten gecleared worden om te kunnen seeken
         ifs.clear();
@@ -259,10 +289,10 @@ void pack(ifstream &ifs, ostream &os, uint32_t &insize, uint32_t &outsize)
                 while (bitsleft < 0)
                     *++outp = **q++, bitsleft += 8;
 
-                if (outp >= &outbuff[BLKSIZE])
+                while (outp >= &outbuff[BLKSIZE])
                 {
                     os.write(outbuff, BLKSIZE);
-                    ((union FOUR *) outbuff)->l.lng = ((union FOUR *) &outbuff[BLKSIZE])->l.lng;
+                    std::copy(outbuff + BLKSIZE, outp + 1, outbuff);
                     outp -= BLKSIZE;
                     outsize += BLKSIZE;
                 }
@@ -279,14 +309,151 @@ void pack(ifstream &ifs, ostream &os, uint32_t &insize, uint32_t &outsize)
     }
 }
 
+/*
+ * Single pass over data in memory. The histogram spreads its counts over
+ * four tables so that runs of one byte value don't serialize on a single
+ * counter. Codes are right aligned from the LEVEL_LIMIT bit patterns and
+ * gathered MSB first in a 64 bit word that is stored whole when full.
+ */
+void pack(const uint8_t *data, size_t size, ostream &os, uint32_t &insize, uint32_t &outsize)
+{
+    static constexpr size_t OUTBUF = 1024 * 1024;
+
+    if (size > 0xffffffff)
+        throw std::range_error(": input too large for pack");
+
+    uint32_t count[END + 1] = {0};
+
+    {
+        uint32_t hist[4][256] = {{0}};
+        size_t i = 0;
+
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t w;
+            memcpy(&w, data + i, 8);
+            ++hist[0][w & 0xff], ++hist[1][w >> 8 & 0xff];
+            ++hist[2][w >> 16 & 0xff], ++hist[3][w >> 24 & 0xff];
+            ++hist[0][w >> 32 & 0xff], ++hist[1][w >> 40 & 0xff];
+            ++hist[2][w >> 48 & 0xff], ++hist[3][w >> 56];
+        }
+
+        for (; i < size; ++i)
+            ++hist[0][data[i]];
+
+        for (unsigned c = 0; c < 256; ++c)
+            count[c] = 2 * (hist[0][c] + hist[1][c] + hist[2][c] + hist[3][c]);
+    }
+
+    Code code;
+    code.build(count);
+    insize = code.insize;
+    uint32_t table[END + 1];
+
+    for (unsigned c = 0; c <= END; ++c)
+        table[c] = code.bits[c] >> LEVEL_LIMIT - code.length[c];
+
+    std::vector<uint8_t> out(OUTBUF + 300);
+    size_t pos = code.header((char *)out.data()) - (char *)out.data();
+    outsize = 0;
+    uint64_t acc = 0;
+    unsigned n = 0;
+
+    for (size_t i = 0; i <= size; ++i)
+    {
+        const unsigned c = i < size ? data[i] : END;
+        const uint64_t bits = table[c];
+        n += code.length[c];
+
+        if (n < 64)
+        {
+            acc |= bits << 64 - n;
+            continue;
+        }
+
+        n -= 64;
+        uint64_t word = __builtin_bswap64(acc | bits >> n);
+        memcpy(out.data() + pos, &word, 8);
+        pos += 8;
+        acc = n ? bits << 64 - n : 0;
+
+        if (pos >= OUTBUF)
+        {
+            os.write((const char *)out.data(), pos);
+            outsize += pos;
+            pos = 0;
+        }
+    }
+
+    for (; n > 0; n -= std::min(n, 8U), acc <<= 8)
+        out[pos++] = uint8_t(acc >> 56);
+
+    os.write((const char *)out.data(), pos);
+    outsize += pos;
+}
+
+/* regular files are mapped, anything else is read into memory first */
+static void packSingle(const char *fn, ostream &os, uint32_t &insize, uint32_t &outsize)
+{
+    int fd = fn ? open(fn, O_RDONLY) : 0;
+
+    if (fd < 0)
+        throw std::runtime_error(std::string(": cannot open ") + fn);
+
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (p != MAP_FAILED)
+        {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            pack((const uint8_t *)p, st.st_size, os, insize, outsize);
+            munmap(p, st.st_size);
+
+            if (fn)
+                close(fd);
+
+            return;
+        }
+    }
+
+    std::vector<uint8_t> data;
+    size_t size = 0;
+
+    for (ssize_t r = 1; r > 0; size += r)
+    {
+        data.resize(std::max<size_t>(size * 2, 1 << 20));
+        r = read(fd, data.data() + size, data.size() - size);
+
+        if (r < 0)
+            throw std::runtime_error(": read error");
+    }
+
+    if (fn)
+        close(fd);
+
+    pack(data.data(), size, os, insize, outsize);
+}
+
+//pack [-r] [file], -r reads a seekable file twice in small blocks
 int main(int argc, char **argv)
 {
     uint32_t insize, outsize;
-    ifstream ifs(argv[1]);
-    pack(ifs, cout, insize, outsize);
+    bool reread = argc > 2 && strcmp(argv[1], "-r") == 0;
+
+    if (reread)
+    {
+        ifstream ifs(argv[2], std::ios::binary);
+        pack(ifs, cout, insize, outsize);
+    }
+    else
+    {
+        packSingle(argc > 1 ? argv[1] : nullptr, cout, insize, outsize);
+    }
+
+    cout.flush();
     cerr << ": " << insize << " in, " << outsize << " out\r\n";
     return 0;
 }
-
-
-
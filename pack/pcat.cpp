@@ -4,6 +4,7 @@
 #include <fstream>
 #include <cstdint>
 #include <cassert>
+#include <cstring>
 
 #ifdef WIN32
 #include <io.h>
@@ -134,14 +135,213 @@ static void unpack(istream &is, ostream &os, ostream &msg, bool verbose = false)
     }
 }
 
+/*
+ * Table driven decoder. The first K bits of the 64 bit window index a
+ * table whose entries hold up to three whole codes: count in bits 0-1,
+ * bits used in 2-7 and the characters from bit 8 up. Entries with count
+ * zero start a longer code or the end marker, they point at a second
+ * level that decodes one code from W = max(K, maxlev) bits.
+ */
+class TableDecoder
+{
+    static constexpr unsigned K = 12, LEVEL_LIMIT = 24, EOF_SYM = 256;
+    static constexpr size_t INBUF = 64 * 1024, OUTBUF = 1024 * 1024;
+    uint32_t _origsize;
+    unsigned _maxlev, _width, _eof;
+    uint16_t _intnodes[LEVEL_LIMIT];
+    uint16_t _first[LEVEL_LIMIT];
+    uint8_t _characters[256];
+    uint32_t _primary[1 << K];
+    std::vector<uint32_t> _sub;
+    int _walk(uint32_t bits, unsigned width, unsigned &len) const;
+    void _build();
+public:
+    TableDecoder(istream &is);
+    void decode(istream &is, ostream &os);
+};
+
+TableDecoder::TableDecoder(istream &is)
+{
+    assert(is.get() == 0x1f);
+    assert(is.get() == 0x1e);
+    _origsize = 0;
+
+    for (int i = 0; i < 4; ++i)
+        _origsize = _origsize << 8 | uint8_t(is.get());
+
+    _maxlev = uint8_t(is.get());
+    assert(_maxlev >= 1 && _maxlev <= LEVEL_LIMIT);
+    unsigned n = 0;
+
+    for (unsigned i = 0; i < _maxlev; ++i)
+        _intnodes[i] = uint16_t(is.get());
+
+    for (unsigned i = 0; i < _maxlev; ++i)
+    {
+        _first[i] = n;
+
+        for (int c = _intnodes[i]; c > 0; --c)
+        {
+            assert(n < 255);
+            _characters[n++] = uint8_t(is.get());
+        }
+    }
+
+    _characters[n++] = uint8_t(is.get());
+    _eof = n;
+    _intnodes[_maxlev - 1] += 2;
+    uint32_t nchildren = 0;
+
+    for (unsigned i = _maxlev; i >= 1; --i)
+    {
+        int c = _intnodes[i - 1];
+        _intnodes[i - 1] = nchildren /= 2;
+        nchildren += c;
+    }
+
+    _width = std::max(K, _maxlev);
+    _build();
+}
+
+//walks the levels over the top bits of a width bit value, -1 if no code fits
+int TableDecoder::_walk(uint32_t bits, unsigned width, unsigned &len) const
+{
+    for (uint32_t lev = 1, i = 0; lev <= _maxlev && lev <= width; ++lev)
+    {
+        i = i * 2 + (bits >> width - lev & 1);
+        int j = i - _intnodes[lev - 1];
+
+        if (j >= 0)
+        {
+            len = lev;
+            return _first[lev - 1] + j;
+        }
+    }
+
+    return -1;
+}
+
+void TableDecoder::_build()
+{
+    const unsigned subBits = _width - K;
+
+    for (uint32_t p = 0; p < 1 << K; ++p)
+    {
+        uint32_t syms = 0;
+        unsigned used = 0, n = 0, len;
+
+        while (n < 3)
+        {
+            int s = _walk(p & (1 << K - used) - 1, K - used, len);
+
+            if (s < 0 || unsigned(s) == _eof)
+                break;
+
+            syms |= uint32_t(_characters[s]) << 8 * n;
+            used += len, ++n;
+        }
+
+        if (n)
+        {
+            _primary[p] = syms << 8 | used << 2 | n;
+            continue;
+        }
+
+        _primary[p] = _sub.size() << 8;
+
+        for (uint32_t q = 0; q < 1U << subBits; ++q)
+        {
+            int s = _walk(p << subBits | q, _width, len);
+            uint32_t sym = s < 0 ? 0xffff : unsigned(s) == _eof ? EOF_SYM : _characters[s];
+            _sub.push_back(sym | len << 16);
+        }
+    }
+}
+
+void TableDecoder::decode(istream &is, ostream &os)
+{
+    std::vector<uint8_t> in(INBUF);
+    std::vector<char> out(OUTBUF + 4);
+    size_t head = 0, tail = 0, pos = 0;
+    uint64_t window = 0, total = 0;
+    unsigned count = 0;
+
+    while (true)
+    {
+        while (count <= 56)
+        {
+            if (tail == head)
+            {
+                is.read((char *)in.data(), INBUF);
+                head = is.gcount(), tail = 0;
+
+                //past the end the window fills with zeros
+                if (head == 0)
+                    in[0] = 0, head = 1;
+            }
+
+            window |= uint64_t(in[tail++]) << 56 - count;
+            count += 8;
+        }
+
+        uint32_t e = _primary[window >> 64 - K];
+
+        if (e & 3)
+        {
+            uint32_t syms = e >> 8;
+            memcpy(out.data() + pos, &syms, 4);
+            pos += e & 3;
+            window <<= e >> 2 & 63;
+            count -= e >> 2 & 63;
+        }
+        else
+        {
+            uint32_t s = _sub[(e >> 8) + (window >> 64 - _width & (1 << _width - K) - 1)];
+
+            if ((s & 0xffff) == EOF_SYM)
+                break;
+
+            assert((s & 0xffff) != 0xffff);
+            out[pos++] = char(s);
+            window <<= s >> 16;
+            count -= s >> 16;
+        }
+
+        if (pos >= OUTBUF)
+        {
+            total += pos;
+            assert(total <= _origsize);
+            os.write(out.data(), pos);
+            pos = 0;
+        }
+    }
+
+    total += pos;
+    assert(total == _origsize);
+    os.write(out.data(), pos);
+    os.flush();
+}
+
+//pcat [-b] file, -b walks the tree bit by bit
 int main(int argc, char **argv)
 {
 #ifdef WIN32
     _setmode(_fileno(stdin), _O_BINARY);
     _setmode(_fileno(stdout), _O_BINARY);
 #endif
-    ifstream ifs(argv[1]);
-    unpack(ifs, cout, cerr, true);
+    bool bitwise = argc > 2 && strcmp(argv[1], "-b") == 0;
+    ifstream ifs(argv[1 + bitwise], std::ios::binary);
+
+    if (bitwise)
+    {
+        unpack(ifs, cout, cerr, true);
+    }
+    else
+    {
+        TableDecoder decoder(ifs);
+        decoder.decode(ifs, cout);
+    }
+
     ifs.close();
     return 0;
 }
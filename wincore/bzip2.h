@@ -0,0 +1,442 @@
+//bzip2 decoder, shared by bzcat and xcat
+
+#ifndef BZIP2_H
+#define BZIP2_H
+
+#include "mystd.h"
+#include "crc32.h"
+#include <cstdint>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+namespace bzip2
+{
+using mystd::istream;
+using mystd::ostream;
+
+class Toolbox
+{
+public:
+    template <class T> static T min(T a, T b) { return b < a ? b : a; }
+    template <class T> static T max(T a, T b) { return a < b ? b : a; }
+
+    static char nibble(uint8_t n)
+    { return n <= 9 ? '0' + char(n) : 'a' + char(n - 10); }
+
+    static void hex32(unsigned dw, ostream &os)
+    { for (unsigned i = 0; i <= 28; i += 4) os.put(nibble(dw >> 28 - i & 0xf)); }
+};
+
+class BitInputStream
+{
+    istream &_is;
+    uint64_t _window = 0;
+    unsigned _bitCount = 0;
+
+    //top up the window to at least 57 bits, 8 bytes at a time from the buffer,
+    //near the end of the input to whatever is left
+    void _fill()
+    {
+        std::span<const uint8_t> buf = _is.peek();
+
+        if (buf.size() >= 8)
+        {
+            uint64_t word;
+            memcpy(&word, buf.data(), 8);
+            unsigned bytes = 63 - _bitCount >> 3;
+            _window = _window << bytes * 8 | __builtin_bswap64(word) >> 64 - bytes * 8;
+            _is.skip(bytes), _bitCount += bytes * 8;
+            return;
+        }
+
+        for (int c; _bitCount <= 56 && (c = _is.get()) >= 0; _bitCount += 8)
+            _window = _window << 8 | c;
+    }
+public:
+    BitInputStream(istream &is) : _is(is) { }
+
+    unsigned readBits24(unsigned n)
+    {
+        assert(n <= 24);
+        if (_bitCount < n)
+            _fill();
+        if (_bitCount < n)
+            throw std::runtime_error("Unexpected end of input");
+        _bitCount -= n;
+        return _window >> _bitCount & (1 << n) - 1;
+    }
+
+    unsigned readBits32(unsigned n)
+    {
+        assert(n <= 32);
+        unsigned ret = 0;
+        while (n)
+        {
+            unsigned foo = Toolbox::min(16U, n);
+            ret = ret << foo | readBits24(foo), n -= foo;
+        }
+        return ret;
+    }
+
+    //streams end on a byte boundary, the next one starts on the following byte
+    void align() { _bitCount &= ~7U; }
+    bool more() { return _bitCount >= 8 || !_is.peek().empty(); }
+};
+
+class MoveToFront
+{
+    uint8_t _buf[256];
+public:
+    MoveToFront()
+    { for (unsigned i = 0; i < 256; ++i) _buf[i] = i; }
+
+    uint8_t indexToFront(unsigned i)
+    { uint8_t val = _buf[i]; for (; i; --i) _buf[i] = _buf[i - 1]; return _buf[0] = val; }
+};
+
+class Table
+{
+    uint8_t _codeLengths[258];
+    unsigned _pos = 0;
+    unsigned _bases[25] = {0};
+    unsigned _limits[24] = {0};
+    unsigned _symbols[258] = {0};
+    uint8_t _minLen = 23;
+    uint8_t _maxLen = 0;
+public:
+    void read(BitInputStream &bis, unsigned symbolCount);
+    uint8_t minLength() const { return _minLen; }
+    uint32_t limit(uint8_t i) const { return _limits[i]; }
+    uint32_t symbol(uint16_t i) const { return _symbols[i]; }
+    uint32_t base(uint8_t i) const { return _bases[i]; }
+};
+
+//read the canonical Huffman code lengths for table
+void Table::read(BitInputStream &bis, unsigned symbolCount)
+{
+    for (unsigned i = 0, c = bis.readBits24(5); i <= symbolCount + 1; ++i)
+    {
+        while (c >= 1 && c <= 20 && bis.readBits24(1))
+            c += bis.readBits24(1) ? -1 : 1;
+
+        if (c < 1 || c > 20)
+            throw std::domain_error("Code length out of range");
+
+        _codeLengths[_pos++] = c;
+    }
+
+    //an over-subscribed code runs the symbols below past the end
+    uint32_t kraft = 0;
+
+    for (unsigned i = 0; i < symbolCount + 2; ++i)
+        kraft += 1 << 20 - _codeLengths[i];
+
+    if (kraft > 1 << 20)
+        throw std::domain_error("Over-subscribed code");
+
+    for (unsigned i = 0; i < symbolCount + 2; ++i)
+        _bases[_codeLengths[i] + 1]++;
+
+    for (unsigned i = 1; i < 25; ++i)
+        _bases[i] += _bases[i - 1];
+
+    for (unsigned i = 0; i < symbolCount + 2; ++i)
+    {
+        _minLen = Toolbox::min(_codeLengths[i], _minLen);
+        _maxLen = Toolbox::max(_codeLengths[i], _maxLen);
+    }
+
+    for (unsigned i = _minLen, code = 0; i <= _maxLen; ++i)
+    {
+        unsigned base = code;
+        code += _bases[i + 1] - _bases[i];
+        _bases[i] = base - _bases[i];
+        _limits[i] = code - 1;
+        code <<= 1;
+    }
+
+    for (unsigned i = 0, minLen = _minLen; minLen <= _maxLen; ++minLen)
+        for (unsigned symbol = 0; symbol < symbolCount + 2; ++symbol)
+            if (_codeLengths[symbol] == minLen)
+                _symbols[i++] = symbol;
+}
+
+class Tables
+{
+    Table _tables[6];
+    uint8_t *_selectors;
+    uint32_t _nSelectors, grpIdx, grpPos, curTbl;
+public:
+    ~Tables() { delete[] _selectors; }
+    void read(BitInputStream &bis, uint32_t symbolCount);
+    uint32_t nextSymbol(BitInputStream &bis);
+};
+
+void Tables::read(BitInputStream &bis, uint32_t symbolCount)
+{
+    uint8_t nTables = bis.readBits24(3);
+    _nSelectors = bis.readBits24(15);
+
+    if (nTables < 2 || nTables > 6 || _nSelectors == 0)
+        throw std::domain_error("Bad table count");
+
+    _selectors = new uint8_t[_nSelectors];
+    MoveToFront tableMTF;
+    
+    for (uint32_t i = 0; i < _nSelectors; ++i)
+    {
+        uint8_t u = 0;
+
+        while (bis.readBits24(1))
+            if (++u >= nTables)
+                throw std::domain_error("Selector out of range");
+
+        _selectors[i] = tableMTF.indexToFront(u);
+    }
+
+    for (uint32_t t = 0; t < nTables; ++t)
+        _tables[t].read(bis, symbolCount);
+
+    curTbl = _selectors[0], grpIdx = 0, grpPos = 0;
+}
+
+uint32_t Tables::nextSymbol(BitInputStream &bis)
+{
+    if (grpPos++ % 50 == 0)
+    {
+        if (grpIdx == _nSelectors)
+            throw std::domain_error("Out of selectors");
+
+        curTbl = _selectors[grpIdx++];
+    }
+
+    unsigned i = _tables[curTbl].minLength();
+    unsigned codeBits = bis.readBits24(i);
+
+    for (;i <= 23; ++i)
+    {
+        if (codeBits <= _tables[curTbl].limit(i))
+            return _tables[curTbl].symbol(codeBits - _tables[curTbl].base(i));
+
+        codeBits = codeBits << 1 | bis.readBits24(1);
+    }
+
+    throw std::domain_error("Invalid code");
+}
+
+class Block
+{
+    CRC32BZ _crc;
+    uint32_t _dec = 0, _curp = 0, *_merged;
+    uint8_t _nextByte();
+public:
+    uint32_t process(BitInputStream &bi, uint32_t blockSize, ostream &os);
+};
+
+uint8_t Block::_nextByte()
+{       
+    uint8_t ret = _curp & 0xff;
+    _curp = _merged[_curp >> 8];
+    ++_dec;
+    return ret;
+}
+
+uint32_t Block::process(BitInputStream &bi, uint32_t blockSize, ostream &os)
+{
+    uint32_t _blockCRC = bi.readBits32(32);
+
+    if (bi.readBits24(1))
+        throw std::domain_error("Randomised blocks not supported");
+
+    unsigned bwtStartPointer = bi.readBits24(24), symbolCount = 0;
+    unsigned bwtByteCounts[256] = {0};
+    uint8_t symbolMap[256] = {0};
+
+    for (unsigned i = 0, ranges = bi.readBits24(16); i < 16; ++i)
+        if ((ranges & 1 << 15 >> i) != 0)
+            for (unsigned j = 0, k = i << 4; j < 16; ++j, ++k)
+                if (bi.readBits24(1))
+                    symbolMap[symbolCount++] = uint8_t(k);
+
+    Tables tables;
+    tables.read(bi, symbolCount);
+    uint8_t bwtBlock[blockSize], mtfValue = 0;
+    MoveToFront symbolMTF;
+    uint32_t _length = 0;
+
+    for (unsigned n = 0, inc = 1;;)
+    {
+        unsigned nextSymbol = tables.nextSymbol(bi);
+
+        if (nextSymbol == 0)
+        {
+            n += inc;
+            inc <<= 1;
+            continue;
+        }
+
+        if (nextSymbol == 1)
+        {
+            n += inc << 1;
+            inc <<= 1;
+            continue;
+        }
+
+        if (n > 0)
+        {
+            if (n > blockSize - _length)
+                throw std::domain_error("Block overflow");
+
+            uint8_t nextByte = symbolMap[mtfValue];
+            bwtByteCounts[nextByte] += n;
+            ++n, inc = 1;
+
+            while (--n >= 1)
+                bwtBlock[_length++] = nextByte;
+        }
+
+        //end of block
+        if (nextSymbol == symbolCount + 1)
+            break;
+
+        if (_length == blockSize)
+            throw std::domain_error("Block overflow");
+
+        mtfValue = symbolMTF.indexToFront(nextSymbol - 1);
+        uint8_t nextByte = symbolMap[mtfValue];
+        bwtByteCounts[nextByte]++;
+        bwtBlock[_length++] = nextByte;
+    }
+
+    if (bwtStartPointer >= _length)
+        throw std::domain_error("Start pointer out of range");
+
+    _merged = new uint32_t[_length];
+    unsigned characterBase[256] = {0};
+
+    for (unsigned i = 0; i < 255; ++i)
+        characterBase[i + 1] = bwtByteCounts[i];
+
+    for (unsigned i = 2; i <= 255; ++i)
+        characterBase[i] += characterBase[i - 1];
+
+    for (unsigned i = 0; i < _length; ++i)
+    {
+        unsigned val = bwtBlock[i] & 0xff;
+        _merged[characterBase[val]++] = (i << 8) | val;
+    }
+
+    _curp = _merged[bwtStartPointer];
+    unsigned repeat = 0, acc = 0;
+    int last = -1;
+
+    while (true)
+    {
+        if (repeat < 1)
+        {
+            //a run length as the last byte steps past the end
+            if (_dec >= _length)
+                break;
+
+            uint8_t nextByte = _nextByte();
+
+            if (nextByte != last)
+            {
+                last = nextByte, repeat = 1, acc = 1;
+                _crc.update(nextByte);
+            }
+            else if (++acc == 4)
+            {
+                repeat = _nextByte() + 1, acc = 0;
+
+                for (unsigned i = 0; i < repeat; ++i)
+                    _crc.update(nextByte);
+            }
+            else
+            {
+                repeat = 1;
+                _crc.update(nextByte);
+            }
+        }
+
+        --repeat;
+        os.put(last);
+    }
+
+    delete[] _merged;
+
+    if (_blockCRC != _crc.crc())
+        throw std::runtime_error("Block CRC mismatch");
+
+    return _crc.crc();
+}
+
+//a whole stream, from the block size to the end of stream marker
+static uint32_t decompressStream(BitInputStream &bi, ostream &os, ostream &msg)
+{
+    uint8_t blockSize = bi.readBits24(8) - '0';
+    uint32_t streamCRC = 0;
+
+    if (blockSize < 1 || blockSize > 9)
+        throw std::domain_error("Bad block size");
+
+    while (true)
+    {
+        uint32_t marker1 = bi.readBits24(24), marker2 = bi.readBits24(24);
+
+        if (marker1 == 0x314159 && marker2 == 0x265359)
+        {
+            Block b;
+            uint32_t blockCRC = b.process(bi, blockSize * 100000, os);
+            streamCRC = (streamCRC << 1 | streamCRC >> 31) ^ blockCRC;
+            continue;
+        }
+
+        if (marker1 == 0x177245 && marker2 == 0x385090)
+        {
+            uint32_t crc = bi.readBits32(32);
+
+            if (crc != streamCRC)
+                throw std::runtime_error("Stream CRC mismatch");
+
+            msg << "0x";
+            Toolbox::hex32(crc, msg);
+            msg << " 0x";
+            Toolbox::hex32(streamCRC, msg);
+            msg << "\r\n";
+            msg.flush();
+            os.flush();
+            return streamCRC;
+        }
+
+        throw std::domain_error("Bad block header");
+    }
+}
+
+//streams follow one another, like bzip2 anything else after the first is ignored
+static uint32_t decompress(istream &is, ostream &os, ostream &msg)
+{
+    BitInputStream bi(is);
+
+    if (bi.readBits24(24) != 0x425a68)
+        throw std::domain_error("Not in bzip2 format");
+
+    uint32_t streamCRC = decompressStream(bi, os, msg);
+
+    for (bi.align(); bi.more(); bi.align())
+    {
+        if (bi.readBits24(24) != 0x425a68)
+        {
+            msg << "Trailing garbage ignored\r\n";
+            break;
+        }
+
+        streamCRC = decompressStream(bi, os, msg);
+    }
+
+    return streamCRC;
+}
+}
+
+#endif
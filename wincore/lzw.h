@@ -0,0 +1,263 @@
+//compress (.Z) decoder, shared by zcat and xcat
+
+#ifndef LZW_H
+#define LZW_H
+
+#include "generator.h"
+#include "mystd.h"
+#include <stdexcept>
+#include <cstring>
+#include <vector>
+
+namespace lzw
+{
+using std::vector;
+using mystd::ostream;
+using mystd::istream;
+
+class ByteStack
+{
+    vector<char> _stack;
+public:
+    void push(char c) { _stack.push_back(c); }
+    char top() const { return _stack.back(); }
+    void pop_all(ostream &os) { for (; _stack.size(); _stack.pop_back()) os.put(top()); }
+};
+
+class Dictionary
+{
+    unsigned _cap;
+    uint16_t *_codes;
+    char *_bytes;
+    unsigned _pos = 0;
+public:
+    Dictionary(unsigned cap)
+      : _cap(cap), _codes(new uint16_t[cap - 256]), _bytes(new char[cap - 256]) { }
+
+    void lookup(ByteStack &s, uint16_t code) const
+    {
+        for (; code >= 256U; code = _codes[code - 256])
+            s.push(_bytes[code - 256]);
+
+        s.push(code);
+    }
+
+    void store(unsigned code, char c)
+    {
+        if (_pos + 256 < _cap)
+            _codes[_pos] = code, _bytes[_pos] = c, ++_pos;
+    }
+
+    ~Dictionary() { delete[] _codes; delete[] _bytes; }
+    auto size() const { return _pos + 256; }
+    void clear() { _pos = 0; }
+};
+
+static Generator<unsigned>
+codes(istream &is, unsigned bitdepth)
+{
+    char buf[20];
+start_block:
+    for (unsigned nbits = 9; nbits <= bitdepth; ++nbits)
+    {
+        for (unsigned i = 0; i < 1U << nbits - 1 || nbits == bitdepth;)
+        {
+            is.read(buf, nbits);
+            unsigned ncodes = is.gcount() * 8 / nbits;
+
+            if (ncodes == 0)
+                co_return;
+            
+            for (unsigned bits = 0, j = 0; ncodes--; bits += nbits, ++i, ++j)
+            {
+                unsigned *window = (unsigned *)(buf + bits / 8);
+                unsigned code = *window >> j * (nbits - 8) % 8 & (1 << nbits) - 1;
+                co_yield code;
+
+                if (code == 256)
+                    goto start_block;
+            }
+        }
+    }
+}
+
+static void
+lzw(unsigned dictcap, ostream &os, Generator<unsigned> codes)
+{
+    Dictionary dict(dictcap);
+    ByteStack stack;
+    unsigned oldcode = 0;
+    char finchar = 0;
+
+    while (codes)
+    {
+        unsigned newcode, c;
+        newcode = c = codes();
+
+        if (c > dict.size())
+            throw std::domain_error("Invalid code");
+        
+        if (c == 256)
+        {
+            dict.clear();
+            continue;
+        }
+
+        if (c == dict.size())
+            stack.push(finchar), c = oldcode;
+
+        dict.lookup(stack, c);
+        dict.store(oldcode, finchar = stack.top());
+        oldcode = newcode;
+        stack.pop_all(os);
+    }
+}
+
+/*
+ * Fast path, same output as lzw(). Codes come in groups of eight that
+ * take nbits bytes, a group is unpacked at once with 64-bit loads.
+ * Each dictionary entry keeps its string length and first character,
+ * so a string is written straight into the output buffer back to front.
+ */
+class FastDecoder
+{
+    static constexpr unsigned INBUF = 1 << 20, OUTBUF = 1 << 20;
+    istream &_is;
+    ostream &_os;
+    unsigned _bitdepth, _cap;
+    uint16_t *_prefix, *_length;
+    uint8_t *_suffix, *_first, *_in, *_out;
+    unsigned _inPos = 0, _inLen = 0, _outPos = 0;
+
+    //at least n bytes of input in front of _inPos, unless the input ends
+    unsigned _avail(unsigned n)
+    {
+        if (_inLen - _inPos < n)
+        {
+            mystd::copy(_in + _inPos, _in + _inLen, _in);
+            _inLen -= _inPos, _inPos = 0;
+            _is.read((char *)_in + _inLen, INBUF - _inLen);
+            _inLen += _is.gcount();
+        }
+        return _inLen - _inPos;
+    }
+
+    void _flush() { _os.write((const char *)_out, _outPos), _outPos = 0; }
+public:
+    FastDecoder(istream &is, ostream &os, unsigned bitdepth);
+    ~FastDecoder();
+    void run();
+};
+
+FastDecoder::FastDecoder(istream &is, ostream &os, unsigned bitdepth)
+  : _is(is), _os(os), _bitdepth(bitdepth), _cap(1 << bitdepth),
+    _prefix(new uint16_t[_cap]), _length(new uint16_t[_cap]),
+    _suffix(new uint8_t[_cap]), _first(new uint8_t[_cap]),
+    _in(new uint8_t[INBUF + 32]), _out(new uint8_t[OUTBUF + _cap])
+{
+    for (unsigned i = 0; i < 256; ++i)
+        _length[i] = 1, _first[i] = i;
+}
+
+FastDecoder::~FastDecoder()
+{
+    delete[] _prefix; delete[] _length; delete[] _suffix;
+    delete[] _first; delete[] _in; delete[] _out;
+}
+
+void FastDecoder::run()
+{
+    unsigned next = 256, oldcode = 0;
+
+start_block:
+    for (unsigned nbits = 9; nbits <= _bitdepth; ++nbits)
+    {
+        for (unsigned i = 0; i < 1U << nbits - 1 || nbits == _bitdepth; i += 8)
+        {
+            unsigned n = _avail(nbits), ncodes = n >= nbits ? 8 : n * 8 / nbits;
+
+            if (ncodes == 0)
+            {
+                _flush();
+                return;
+            }
+
+            uint8_t *group = _in + _inPos;
+
+            if (n < nbits)
+                mystd::fill(group + n, group + nbits + 8, 0);
+
+            _inPos += n < nbits ? n : nbits;
+            unsigned codes[8];
+
+            for (unsigned j = 0; j < ncodes; ++j)
+            {
+                uint64_t window;
+                memcpy(&window, group + j * nbits / 8, 8);
+                codes[j] = window >> j * nbits % 8 & (1 << nbits) - 1;
+            }
+
+            for (unsigned j = 0; j < ncodes; ++j)
+            {
+                unsigned c = codes[j];
+
+                if (c > next)
+                    throw std::domain_error("Invalid code");
+
+                if (c == 256)
+                {
+                    next = 256;
+                    goto start_block;
+                }
+
+                //a code equal to the next free entry is the previous string plus its first byte
+                uint8_t finchar = c == next ? _first[oldcode] : _first[c];
+
+                if (next < _cap)
+                {
+                    _prefix[next] = oldcode, _suffix[next] = finchar;
+                    _length[next] = _length[oldcode] + 1, _first[next] = _first[oldcode];
+                    ++next;
+                }
+
+                if (_outPos + _cap > OUTBUF)
+                    _flush();
+
+                unsigned len = _length[c];
+                uint8_t *p = _out + _outPos + len;
+
+                for (oldcode = c; c >= 256U; c = _prefix[c])
+                    *--p = _suffix[c];
+
+                *--p = c;
+                _outPos += len;
+            }
+        }
+    }
+
+    _flush();
+}
+
+//magic, the bit depth byte and the codes; fast picks FastDecoder
+static void decompress(istream &is, ostream &os, bool fast = true)
+{
+    if (is.get() != 0x1f || is.get() != 0x9d)
+        throw std::domain_error("Not in compress format");
+
+    int c = is.get();
+
+    if (c < 0 || !(c & 0x80))   //block mode bit is hardcoded in ncompress
+        throw std::domain_error("Block mode not set");
+
+    const unsigned bitdepth = c & 0x7f;
+
+    if (fast)
+        FastDecoder(is, os, bitdepth).run();
+    else
+        lzw(1 << bitdepth, os, codes(is, bitdepth));
+
+    os.flush();
+}
+}
+
+#endif
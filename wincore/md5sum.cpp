@@ -5,8 +5,10 @@
 #include <fstream>
 #include <iostream>
 #include <cstdint>
+#include <cstring>
 #include <cassert>
 #include <cmath>
+#include <utility>
 
 #ifdef WIN32
 #include <io.h>
@@ -38,51 +40,61 @@ struct Hash
     { _h[0] += h[0], _h[1] += h[1], _h[2] += h[2], _h[3] += h[3]; return *this; }
 };
 
+static constexpr uint32_t R[64] = {
+ 7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,
+ 5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,
+ 4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,
+ 6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21};
+
+//computed once instead of in every Chunk
+static const struct Sines
+{
+    uint32_t k[64];
+    Sines() { for (unsigned i = 0; i < 64; ++i) k[i] = uint32_t(fabs(sin(i + 1)) * double(1UL << 32)); }
+} sines;
+
+//one step with round function and message index fixed at compile time
+template <unsigned i> static inline void step(uint32_t &a, uint32_t b, uint32_t c, uint32_t d, const uint32_t *w)
+{
+    constexpr unsigned g = i < 16 ? i : i < 32 ? (5 * i + 1) % 16 : i < 48 ? (3 * i + 5) % 16 : 7 * i % 16;
+    uint32_t f;
+
+    if constexpr (i < 16)
+        f = b & c | ~b & d;
+    else if constexpr (i < 32)
+        f = d & b | ~d & c;
+    else if constexpr (i < 48)
+        f = b ^ c ^ d;
+    else
+        f = c ^ (b | ~d);
+
+    uint32_t x = a + f + sines.k[i] + w[g];
+    a = b + (x << R[i] | x >> 32 - R[i]);
+}
+
+template <size_t... I> static inline void rounds(uint32_t &a, uint32_t &b, uint32_t &c, uint32_t &d,
+    const uint32_t *w, std::index_sequence<I...>)
+{
+    ((step<I * 4>(a, b, c, d, w), step<I * 4 + 1>(d, a, b, c, w),
+      step<I * 4 + 2>(c, d, a, b, w), step<I * 4 + 3>(b, c, d, a, w)), ...);
+}
+
 class Chunk
 {
     uint32_t _w[16];
-    uint32_t _k[64];
-    static const uint32_t _r[64];
 public:
-    Chunk()
-    { for (unsigned i = 0; i < 64; ++i) _k[i] = uint32_t(fabs(sin(i + 1)) * double(1UL << 32)); }
-
-    void fillTail(uint32_t size) { _w[14] = size * 8, _w[15] = size >> 29; }
+    void fillTail(uint64_t size) { _w[14] = uint32_t(size * 8), _w[15] = uint32_t(size >> 29); }
     Hash calc(const Hash &hash) const;
     void clear() { for (int i = 0; i < 16; ++i) _w[i] = 0; }
     void stopBit(unsigned gc) { ((char *)_w)[gc] = 0x80; }
     auto read(istream &is) { clear(); is.read((char *)_w, 64); return is.gcount(); }
+    void load(const uint8_t *p) { memcpy(_w, p, 64); }
 };
 
-const uint32_t Chunk::_r[64] = {
- 7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,
- 5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,
- 4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,
- 6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21};
-
 Hash Chunk::calc(const Hash &h) const
 {
     uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
-
-    for (unsigned i = 0, f, g; i < 64; ++i)
-    {
-        if (i < 16)
-            f = b & c | ~b & d, g = i;
-        else if (i < 32)
-            f = d & b | ~d & c, g = (5 * i + 1) % 16;
-        else if (i < 48)
-            f = b ^ c ^ d, g = (3 * i + 5) % 16;
-        else
-            f = c ^ (b | ~d), g = (7 * i) % 16;
-
-        uint32_t temp = d;
-        d = c;
-        c = b;
-        uint32_t x = a + f + _k[i] + _w[g];
-        b += x << _r[i] | x >> 32 - _r[i];
-        a = temp;
-    }
-
+    rounds(a, b, c, d, _w, std::make_index_sequence<16>());
     return Hash(a, b, c, d);
 }
 
@@ -90,10 +102,28 @@ static Hash stream(istream &is)
 {
     Hash hash(0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476);
     Chunk chunk;
-    unsigned sz = 0, gc = 0;
+    uint64_t sz = 0;
+    unsigned gc = 0;
+
+    //whole blocks straight from the input buffer, read() only stitches a block across refills
+    while (true)
+    {
+        std::span<const uint8_t> buf = is.peek();
+        size_t n = buf.size() & ~size_t(63);
+
+        for (size_t i = 0; i < n; i += 64)
+            chunk.load(buf.data() + i), hash += chunk.calc(hash);
+
+        is.skip(n), sz += n;
+
+        if (n > 0)
+            continue;
+
+        if ((gc = chunk.read(is)) < 64)
+            break;
 
-    while ((gc = chunk.read(is)) == 64)
         hash += chunk.calc(hash), sz += gc;
+    }
 
     sz += gc;
     chunk.stopBit(gc);
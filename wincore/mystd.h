@@ -1,6 +1,16 @@
+//shared by wincore and bzcat, which builds with -I../wincore
+
+#ifndef MYSTD_H
+#define MYSTD_H
+
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <cstdint>
+#include <cstring>
+#include <span>
 #include <concepts>
 #include <bit>
 #include <array>
@@ -66,47 +76,131 @@ public:
     }
 };
 
+/*
+ * Buffered I/O straight on file descriptors. get() and put() are inline
+ * and not virtual, bulk transfers take spans, and bit readers can look
+ * at the buffered bytes through peek()/skip() and the output buffer
+ * through reserve()/commit() instead of going byte by byte.
+ *
+ * A regular file on the input side is mapped rather than read, the
+ * buffer then is the whole file. On the output side splice() switches a
+ * pipe to vmsplice: the buffer becomes two halves the size of the pipe,
+ * and a half is only reused after the other half went into the pipe in
+ * full, which means the reader has taken everything before it. That
+ * holds for readers that read(); one that splices the data on keeps
+ * pointing at our pages and sees them change under it. write() stays
+ * the default, the tools only call splice() when given -s.
+ */
+#ifndef MYSTD_BUFSIZE
+#define MYSTD_BUFSIZE (1 << 16)
+#endif
+
 class istream
 {   
 private:
-    uint32_t _cap, _head = 0, _tail = 0;
-    uint8_t *_buf;
+    size_t _cap;
+    uint8_t *_own;
+    void *_map = nullptr;
+    size_t _mapLen = 0;
+    bool _tried = false;
     ssize_t _gcount = -1;
+
+    //map the rest of a regular file, from wherever the descriptor is
+    bool _mapFile()
+    {
+        struct stat st;
+        off_t off = lseek(_fd, 0, SEEK_CUR);
+
+        if (fstat(_fd, &st) < 0 || !S_ISREG(st.st_mode) || off < 0 || st.st_size <= off)
+            return false;
+
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+
+        if (p == MAP_FAILED)
+            return false;
+
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        _map = p, _mapLen = st.st_size;
+        _buf = (uint8_t *)p, _tail = off, _head = st.st_size;
+        return true;
+    }
+
 protected:
+    uint8_t *_buf;
+    size_t _head = 0, _tail = 0;
     int _fd; 
+
+    //next piece of input into _buf, _head and _tail, false at the end
+    virtual bool _refill()
+    {
+        if (!_tried && (_tried = true) && _mapFile())
+            return true;
+
+        if (_map)
+            return false;
+
+        ssize_t n = ::read(_fd, _buf, _cap);
+        _head = n > 0 ? n : 0, _tail = 0;
+        return _head > 0;
+    }
+
+    void _unmap()
+    {
+        if (_map)
+            munmap(_map, _mapLen);
+
+        _map = nullptr, _buf = _own, _head = _tail = 0, _tried = false;
+    }
 public:
-    ~istream() { delete[] _buf; }
+    virtual ~istream() { _unmap(); delete[] _own; }
     ssize_t gcount() const { return _gcount; }
     
-    istream(int fd = -1, uint32_t capacity = 8192)
-      : _cap(capacity), _buf(new uint8_t[capacity]), _fd(fd) { }
+    istream(int fd = -1, size_t capacity = MYSTD_BUFSIZE)
+      : _cap(capacity), _own(new uint8_t[capacity]), _buf(_own), _fd(fd) { }
+
+    //refill an empty buffer, how much is buffered afterwards, 0 at the end
+    size_t underflow() { return _tail < _head || _refill() ? _head - _tail : 0; }
 
-    int get()
+    int get() { return _tail < _head || underflow() ? _buf[_tail++] : -1; }
+
+    //the buffered bytes, empty at the end; hand back what was used with skip()
+    std::span<const uint8_t> peek() { underflow(); return {_buf + _tail, _head - _tail}; }
+    void skip(size_t n) { _tail += n; }
+
+    //fills dst unless the input ends first, large reads bypass the buffer
+    size_t read(std::span<uint8_t> dst)
     {
-        if (_tail == _head)
+        size_t got = 0;
+
+        while (got < dst.size())
         {
-            ssize_t n = ::read(_fd, _buf, _cap);
-            if (n < 1) return -1;
-            _head = n;
-            _tail = 0;
+            if (_tail == _head && _fd >= 0 && !_map && _tried && dst.size() - got >= _cap)
+            {
+                ssize_t r = ::read(_fd, dst.data() + got, dst.size() - got);
+                if (r < 1) break;
+                got += r;
+                continue;
+            }
+
+            if (underflow() == 0)
+                break;
+
+            size_t len = std::min(dst.size() - got, _head - _tail);
+            memcpy(dst.data() + got, _buf + _tail, len);
+            _tail += len, got += len;
         }
-        return _buf[_tail++];
-    }
-    
-    void read(char *buf, unsigned n)
-    {
-        _gcount = 0;
-    
-        for (int c; n-- && (c = get()) != -1;)
-            buf[_gcount++] = c;
+
+        return got;
     }
+
+    void read(char *buf, unsigned n) { _gcount = read(std::span<uint8_t>((uint8_t *)buf, n)); }
 };
 
 class ifstream : public istream
 {
 public: 
-    void close() { ::close(_fd); }
-    void open(const char *fn) { _fd = ::open(fn, O_RDONLY); }
+    void close() { _unmap(); ::close(_fd); _fd = -1; }
+    void open(const char *fn) { _unmap(); _fd = ::open(fn, O_RDONLY); }
 };
 
 class special { };
@@ -116,36 +210,117 @@ special endl;
 class ostream
 {
     int _fd;
-    uint32_t _cap, _pos = 0;
+    char *_own;
+    char *_halves = nullptr;
+
+    void _writeAll(const char *s, size_t n)
+    {
+        for (ssize_t w; n; s += w, n -= w)
+            if ((w = ::write(_fd, s, n)) < 1) return;
+    }
+
+    //a full half goes to the pipe by reference, after that the other half is free
+    bool _vmsplice()
+    {
+        struct iovec iov = {_buf, _pos};
+
+        for (ssize_t w; iov.iov_len; iov.iov_base = (char *)iov.iov_base + w, iov.iov_len -= w)
+            if ((w = ::vmsplice(_fd, &iov, 1, 0)) < 1)
+                break;
+
+        if (iov.iov_base == _buf)
+            return false;
+
+        _writeAll((char *)iov.iov_base, iov.iov_len);
+        _buf = _buf == _halves ? _halves + _cap : _halves;
+        return true;
+    }
+protected:
     char *_buf;
+    size_t _cap, _pos = 0;
+
+    //hand _buf[0, _pos) on and make room, _pos is reset by the caller
+    virtual void _drain()
+    {
+        if (_fd >= 0 && _pos > 0 && !(_halves && _pos == _cap && _vmsplice()))
+            _writeAll(_buf, _pos);
+    }
 public:
-    ostream(int fd = -1, uint32_t capacity = 0)
-      : _fd(fd), _cap(capacity), _buf(new char[capacity]) { }
+    ostream(int fd = -1, size_t capacity = MYSTD_BUFSIZE)
+      : _fd(fd), _own(new char[capacity]), _buf(_own), _cap(capacity) { }
 
-    ~ostream() {
-        flush(); delete[] _buf;
+    virtual ~ostream() {
+        flush();
+        delete[] _own;
+
+        //the pipe may still hold pages of either half, unmapping leaves those alone
+        if (_halves)
+            munmap(_halves, _cap * 2);
+    }
+
+    //only for pipes, false leaves the stream as it was
+    bool splice(size_t size = 1 << 20)
+    {
+        struct stat st;
+
+        if (_halves || fstat(_fd, &st) < 0 || !S_ISFIFO(st.st_mode))
+            return false;
+
+        fcntl(_fd, F_SETPIPE_SZ, int(size));
+        int pipeSize = fcntl(_fd, F_GETPIPE_SZ);
+
+        if (pipeSize <= 0)
+            return false;
+
+        void *p = mmap(nullptr, pipeSize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (p == MAP_FAILED)
+            return false;
+
+        flush();
+        _halves = (char *)p, _buf = _halves, _cap = pipeSize;
+        return true;
     }
 
     inline void put(char c) {
-        if (_pos > _cap) flush();
+        if (_pos >= _cap) flush();
         _buf[_pos++] = c;
     }
 
-    void write(char *buf, unsigned len) {
-        for (unsigned i = 0; i < len; ++i) put(buf[i]);
-    }
+    //room for at least n <= capacity bytes at the returned pointer, then commit
+    char *reserve(size_t n) { if (_cap - _pos < n) flush(); return _buf + _pos; }
+    void commit(size_t n) { _pos += n; }
 
-    void flush() {
-        ::write(_fd, _buf, _pos), _pos = 0;
+    //large writes on a plain descriptor bypass the buffer, otherwise it is
+    //filled and handed on whole
+    void write(std::span<const char> s)
+    {
+        if (_fd >= 0 && !_halves && s.size() >= _cap)
+        {
+            flush();
+            _writeAll(s.data(), s.size());
+            return;
+        }
+
+        for (size_t len; s.size(); s = s.subspan(len))
+        {
+            if (_pos == _cap) flush();
+            len = std::min(s.size(), _cap - _pos);
+            memcpy(_buf + _pos, s.data(), len), _pos += len;
+        }
     }
 
+    void write(const char *buf, size_t len) { write(std::span<const char>(buf, len)); }
+
+    void flush() { _drain(); _pos = 0; }
+
     virtual ostream& operator<<(char c) {
         put(c);
         return *this;
     }
 
     virtual inline ostream& operator<<(const char *s) {
-        while (*s) put(*s++);
+        write(s, strlen(s));
         return *this;
     }
 
@@ -166,8 +341,9 @@ public:
         unsigned p = 32;
         char buf[p];
         
-        while (n)
+        do
             buf[--p] = n % 10 + '0', n /= 10;
+        while (n);
 
         this->write(buf + p, 32 - p);
         return *this;
@@ -175,11 +351,9 @@ public:
 
 };
 
-static istream cin(0, 8192);
-static ostream cout(1, 8192);
-static ostream cerr(2, 8192);
+static istream cin(0);
+static ostream cout(1);
+static ostream cerr(2);
 }
 
-
-
-
+#endif
@@ -0,0 +1,344 @@
+//pack (.z) decoder, shared by pcat and xcat
+
+#ifndef UNPACK_H
+#define UNPACK_H
+
+#include "mystd.h"
+#include <cstdint>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+
+namespace pack
+{
+using mystd::istream;
+using mystd::ostream;
+using mystd::endl;
+
+//a byte that has to be there
+static uint8_t byte(istream &is)
+{
+    int c = is.get();
+
+    if (c < 0)
+        throw std::runtime_error("Unexpected end of input");
+
+    return c;
+}
+
+//the magic and the original size, big endian
+static uint32_t header(istream &is)
+{
+    if (byte(is) != 0x1f || byte(is) != 0x1e)
+        throw std::domain_error("Not in pack format");
+
+    uint32_t origsize = 0;
+
+    for (int i = 0; i < 4; ++i)
+        origsize = origsize << 8 | byte(is);
+
+    return origsize;
+}
+
+static void unpack(istream &is, ostream &os, ostream &msg)
+{
+    uint32_t origsize = header(is);
+    uint8_t maxlev = byte(is);
+    msg << "Length: " << origsize << ", Levels: " << unsigned(maxlev) << endl;
+
+    if (maxlev == 0)
+        throw std::domain_error("No levels");
+
+    uint16_t intnodes[maxlev];
+
+    for (uint8_t i = 0; i < maxlev; ++i)
+        intnodes[i] = byte(is);
+
+    char *tree[maxlev];
+    char characters[256];
+    char *xeof = characters;
+
+    for (uint8_t i = 0; i < maxlev; ++i)
+    {
+        tree[i] = xeof;
+
+        for (int c = intnodes[i]; c > 0; --c)
+        {
+            if (xeof == characters + 255)
+                throw std::domain_error("Too many characters");
+
+            *xeof++ = char(byte(is));
+        }
+    }
+
+    *xeof++ = char(byte(is));
+    intnodes[maxlev - 1] += 2;
+    uint32_t nchildren = 0;
+
+    for (uint8_t i = maxlev; i >= 1; --i)
+    {
+        int c = intnodes[i - 1];
+        intnodes[i - 1] = nchildren /= 2;
+        nchildren += c;
+    }
+
+    for (uint32_t lev = 1, i = 0; true;)
+    {
+        int c = byte(is);
+
+        for (uint8_t bit = 0; bit < 8; ++bit)
+        {
+            i *= 2;
+
+            if (c & 0200)
+                ++i;
+
+            c <<= 1;
+            int j = i - intnodes[lev - 1];
+
+            if (j < 0)
+            {
+                ++lev;
+                continue;
+            }
+
+            const char *p = tree[lev - 1] + j;
+
+            if (p == xeof)
+            {
+                if (origsize != 0)
+                    throw std::runtime_error("Length mismatch");
+
+                return;
+            }
+
+            os.put(*p);
+            --origsize;
+            lev = 1;
+            i = 0;
+        }
+    }
+}
+
+/*
+ * Table driven decoder. The first K bits of the 64 bit window index a
+ * table whose entries hold up to three whole codes: count in bits 0-1,
+ * bits used in 2-7 and the characters from bit 8 up. Entries with count
+ * zero start a longer code or the end marker, they point at a second
+ * level that decodes one code from W = max(K, maxlev) bits.
+ */
+class TableDecoder
+{
+    static constexpr unsigned K = 12, LEVEL_LIMIT = 24, EOF_SYM = 256;
+    static constexpr unsigned INBUF = 64 * 1024, OUTBUF = 1024 * 1024;
+    uint32_t _origsize;
+    unsigned _maxlev, _width, _eof;
+    uint16_t _intnodes[LEVEL_LIMIT];
+    uint16_t _first[LEVEL_LIMIT];
+    uint8_t _characters[256];
+    uint32_t _primary[1 << K];
+    uint32_t *_sub = nullptr;
+    int _walk(uint32_t bits, unsigned width, unsigned &len) const;
+    void _build();
+public:
+    TableDecoder(istream &is, ostream &msg);
+    ~TableDecoder() { delete[] _sub; }
+    void decode(istream &is, ostream &os);
+};
+
+TableDecoder::TableDecoder(istream &is, ostream &msg)
+{
+    _origsize = header(is);
+    _maxlev = byte(is);
+    msg << "Length: " << _origsize << ", Levels: " << _maxlev << endl;
+
+    if (_maxlev < 1 || _maxlev > LEVEL_LIMIT)
+        throw std::domain_error("Bad number of levels");
+
+    unsigned n = 0;
+
+    for (unsigned i = 0; i < _maxlev; ++i)
+        _intnodes[i] = byte(is);
+
+    for (unsigned i = 0; i < _maxlev; ++i)
+    {
+        _first[i] = n;
+
+        for (int c = _intnodes[i]; c > 0; --c)
+        {
+            if (n == 255)
+                throw std::domain_error("Too many characters");
+
+            _characters[n++] = byte(is);
+        }
+    }
+
+    _characters[n++] = byte(is);
+    _eof = n;
+    _intnodes[_maxlev - 1] += 2;
+    uint32_t nchildren = 0;
+
+    for (unsigned i = _maxlev; i >= 1; --i)
+    {
+        int c = _intnodes[i - 1];
+        _intnodes[i - 1] = nchildren /= 2;
+        nchildren += c;
+    }
+
+    _width = _maxlev > K ? _maxlev : K;
+    _build();
+}
+
+//walks the levels over the top bits of a width bit value, -1 if no code fits
+int TableDecoder::_walk(uint32_t bits, unsigned width, unsigned &len) const
+{
+    for (uint32_t lev = 1, i = 0; lev <= _maxlev && lev <= width; ++lev)
+    {
+        i = i * 2 + (bits >> width - lev & 1);
+        int j = i - _intnodes[lev - 1];
+
+        if (j >= 0)
+        {
+            len = lev;
+            return _first[lev - 1] + j;
+        }
+    }
+
+    return -1;
+}
+
+void TableDecoder::_build()
+{
+    const unsigned subBits = _width - K;
+    unsigned nsub = 0, len;
+
+    for (uint32_t p = 0; p < 1 << K; ++p)
+    {
+        uint32_t syms = 0;
+        unsigned used = 0, n = 0;
+
+        while (n < 3)
+        {
+            int s = _walk(p & (1 << K - used) - 1, K - used, len);
+
+            if (s < 0 || unsigned(s) == _eof)
+                break;
+
+            syms |= uint32_t(_characters[s]) << 8 * n;
+            used += len, ++n;
+        }
+
+        _primary[p] = n ? syms << 8 | used << 2 | n : nsub++ << subBits << 8;
+    }
+
+    _sub = new uint32_t[nsub << subBits];
+
+    for (uint32_t p = 0; p < 1 << K; ++p)
+    {
+        if (_primary[p] & 3)
+            continue;
+
+        uint32_t *sub = _sub + (_primary[p] >> 8);
+
+        for (uint32_t q = 0; q < 1U << subBits; ++q)
+        {
+            int s = _walk(p << subBits | q, _width, len);
+            uint32_t sym = s < 0 ? 0xffff : unsigned(s) == _eof ? EOF_SYM : _characters[s];
+            sub[q] = sym | len << 16;
+        }
+    }
+}
+
+void TableDecoder::decode(istream &is, ostream &os)
+{
+    std::vector<uint8_t> inbuf(INBUF);
+    std::vector<char> outbuf(OUTBUF + 4);
+    uint8_t *in = inbuf.data();
+    char *out = outbuf.data();
+    unsigned head = 0, tail = 0, pos = 0, count = 0, padded = 0;
+    uint64_t window = 0, total = 0;
+
+    while (true)
+    {
+        //the last code may end in the padding, consuming any of it may not
+        if (count < padded)
+            throw std::runtime_error("Unexpected end of input");
+
+        while (count <= 56)
+        {
+            if (tail == head)
+            {
+                is.read((char *)in, INBUF);
+                head = is.gcount() > 0 ? is.gcount() : 0, tail = 0;
+
+                //past the end the window fills with zeros
+                if (head == 0)
+                    in[0] = 0, head = 1, padded += 8;
+            }
+
+            window |= uint64_t(in[tail++]) << 56 - count;
+            count += 8;
+        }
+
+        uint32_t e = _primary[window >> 64 - K];
+
+        if (e & 3)
+        {
+            uint32_t syms = e >> 8;
+            memcpy(out + pos, &syms, 4);
+            pos += e & 3;
+            window <<= e >> 2 & 63;
+            count -= e >> 2 & 63;
+        }
+        else
+        {
+            uint32_t s = _sub[(e >> 8) + (window >> 64 - _width & (1 << _width - K) - 1)];
+
+            if ((s & 0xffff) == EOF_SYM)
+                break;
+
+            if ((s & 0xffff) == 0xffff)
+                throw std::domain_error("Invalid code");
+
+            out[pos++] = char(s);
+            window <<= s >> 16;
+            count -= s >> 16;
+        }
+
+        if (pos >= OUTBUF)
+        {
+            total += pos;
+
+            if (total > _origsize)
+                throw std::runtime_error("Length mismatch");
+
+            os.write(out, pos);
+            pos = 0;
+        }
+    }
+
+    total += pos;
+
+    if (total != _origsize)
+        throw std::runtime_error("Length mismatch");
+
+    os.write(out, pos);
+    os.flush();
+}
+
+//header and codes; bitwise walks the tree bit by bit instead of the tables
+static void decompress(istream &is, ostream &os, ostream &msg, bool bitwise = false)
+{
+    if (bitwise)
+    {
+        unpack(is, os, msg);
+        os.flush();
+        return;
+    }
+
+    TableDecoder decoder(is, msg);
+    decoder.decode(is, os);
+}
+}
+
+#endif
@@ -0,0 +1,206 @@
+//xcat [-v] [file], bzip2, gzip, compress or pack, told apart by the magic
+
+/*
+ * Three stages: a reader thread fills blocks from the input, the main
+ * thread decodes, a writer thread empties blocks into stdout. Blocks go
+ * round between two threads through a pair of single producer, single
+ * consumer rings, one carrying full blocks and one bringing them back
+ * empty, so a slow disk or a full pipe only stalls the decoder when all
+ * blocks are waiting on it. An empty block marks the end.
+ */
+
+#include "bzip2.h"
+#include "gzip.h"
+#include "lzw.h"
+#include "unpack.h"
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+
+using mystd::istream;
+using mystd::ostream;
+using mystd::cerr;
+
+struct Block
+{
+    uint8_t *data;
+    size_t len;
+};
+
+//N a power of two, push waits while full and pop while empty
+template <class T, size_t N> class Ring
+{
+    static_assert((N & N - 1) == 0, "N is a power of two");
+    T _slots[N];
+    alignas(64) std::atomic<size_t> _head = 0;
+    alignas(64) std::atomic<size_t> _tail = 0;
+public:
+    void push(T x)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+
+        for (size_t tail; head - (tail = _tail.load(std::memory_order_acquire)) == N;)
+            _tail.wait(tail, std::memory_order_acquire);
+
+        _slots[head & N - 1] = x;
+        _head.store(head + 1, std::memory_order_release);
+        _head.notify_one();
+    }
+
+    T pop()
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+
+        for (size_t head; (head = _head.load(std::memory_order_acquire)) == tail;)
+            _head.wait(head, std::memory_order_acquire);
+
+        T x = _slots[tail & N - 1];
+        _tail.store(tail + 1, std::memory_order_release);
+        _tail.notify_one();
+        return x;
+    }
+};
+
+//eight blocks per direction, a ring also holds the end marker
+static constexpr size_t BLOCK = 1 << 18, BLOCKS = 8;
+typedef Ring<Block, BLOCKS * 2> BlockRing;
+
+class Pool
+{
+    uint8_t *_mem;
+public:
+    BlockRing full, free;
+
+    Pool() : _mem(new uint8_t[BLOCK * BLOCKS])
+    {
+        for (size_t i = 0; i < BLOCKS; ++i)
+            free.push({_mem + i * BLOCK, BLOCK});
+    }
+
+    ~Pool() { delete[] _mem; }
+};
+
+//the decoder side of the reader thread, a block at a time
+class RingInput : public istream
+{
+    Pool &_pool;
+    Block _cur = {nullptr, 0};
+    bool _end = false;
+protected:
+    bool _refill() override
+    {
+        if (_end)
+            return false;
+
+        if (_cur.data)
+            _pool.free.push({_cur.data, BLOCK});
+
+        _cur = _pool.full.pop();
+        _end = _cur.len == 0;
+        _buf = _cur.data, _head = _cur.len, _tail = 0;
+        return !_end;
+    }
+public:
+    RingInput(Pool &pool) : istream(-1, 1), _pool(pool) { }
+
+    //whatever follows the stream, so that the reader can finish
+    void drain() { while (_refill()); }
+};
+
+//the decoder side of the writer thread
+class RingOutput : public ostream
+{
+    Pool &_pool;
+protected:
+    void _drain() override
+    {
+        if (_pos == 0)
+            return;
+
+        _pool.full.push({(uint8_t *)_buf, _pos});
+        _buf = (char *)_pool.free.pop().data;
+    }
+public:
+    RingOutput(Pool &pool) : ostream(-1, 1), _pool(pool)
+    {
+        _buf = (char *)_pool.free.pop().data, _cap = BLOCK;
+    }
+
+    //the end marker after the last block
+    void close() { flush(); _pool.full.push({(uint8_t *)_buf, 0}); }
+};
+
+static void reader(int fd, Pool &pool)
+{
+    for (Block b; true; pool.full.push(b))
+    {
+        b = pool.free.pop();
+        b.len = 0;
+
+        for (ssize_t n; b.len < BLOCK; b.len += n)
+            if ((n = ::read(fd, b.data + b.len, BLOCK - b.len)) < 1)
+                break;
+
+        if (b.len == 0)
+            break;
+    }
+
+    pool.full.push({nullptr, 0});
+}
+
+static void writer(int fd, Pool &pool)
+{
+    for (Block b; (b = pool.full.pop()).len > 0; pool.free.push(b))
+        for (ssize_t w, n = 0; n < ssize_t(b.len); n += w)
+            if ((w = ::write(fd, b.data + n, b.len - n)) < 1)
+                _exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    int fd = 0;
+
+    if (argc > 1 + verbose && (fd = ::open(argv[1 + verbose], O_RDONLY)) < 0)
+    {
+        cerr << "xcat: cannot open " << argv[1 + verbose] << "\n";
+        return 1;
+    }
+
+    ostream nullStream;
+    ostream &msg = verbose ? cerr : nullStream;
+    Pool in, out;
+    std::thread rt(reader, fd, std::ref(in)), wt(writer, 1, std::ref(out));
+    RingInput is(in);
+    RingOutput os(out);
+    std::span<const uint8_t> magic = is.peek();
+    int ret = 0;
+
+    //a truncated or corrupt stream throws, the threads still have to finish
+    try
+    {
+        if (magic.size() >= 3 && memcmp(magic.data(), "BZh", 3) == 0)
+            bzip2::decompress(is, os, msg);
+        else if (magic.size() >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+            gzip::decompress(is, os, msg);
+        else if (magic.size() >= 2 && magic[0] == 0x1f && magic[1] == 0x9d)
+            lzw::decompress(is, os);
+        else if (magic.size() >= 2 && magic[0] == 0x1f && magic[1] == 0x1e)
+            pack::decompress(is, os, msg);
+        else
+            cerr << "xcat: unknown format\n", ret = 1;
+    }
+    catch (const std::exception &e)
+    {
+        cerr << "xcat: " << e.what() << "\n", ret = 1;
+    }
+
+    is.drain();
+    os.close();
+    rt.join();
+    wt.join();
+    cerr.flush();
+    return ret;
+}